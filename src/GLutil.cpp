@@ -134,8 +134,7 @@ void RenderCube (const vec3 &p, const float sz)
 
     glEnd();
 }
-// Make these inline so tha console applications can also include util.cpp
-void glColorHSV (float h, float s, float v)
+void HSV2RGB (float h, float s, float v, float &r, float &g, float &b)
 {
      // H [0, 360] S and V [0.0, 1.0].
      int i = (int)floor(h/60.0f) % 6;
@@ -145,19 +144,26 @@ void glColorHSV (float h, float s, float v)
      float t = v * (float)(1 - (1 - f) * s);
 
      switch (i) {
-         case 0: glColor3f(v, t, p);
+         case 0: r = v; g = t; b = p;
          break;
-         case 1: glColor3f(q, v, p);
+         case 1: r = q; g = v; b = p;
          break;
-         case 2: glColor3f(p, v, t);
+         case 2: r = p; g = v; b = t;
          break;
-         case 3: glColor3f(p, q, v);
+         case 3: r = p; g = q; b = v;
          break;
-         case 4: glColor3f(t, p, v);
+         case 4: r = t; g = p; b = v;
          break;
-         case 5: glColor3f(v, p, q);
+         default: r = v; g = p; b = q;
     }
 }
+void glColorHSV (float h, float s, float v)
+{
+    float r, g, b;
+    HSV2RGB (h, s, v, r, g, b);
+
+    glColor3f (r, g, b);
+}
 bool CheckGLOK (const char *doing)
 {
     GLenum status = glGetError();
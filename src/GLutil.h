@@ -41,6 +41,11 @@ void GLFrameBufferErrorString (char *out, GLenum status);
  */
 void RenderCube (const vec3 &p, const float s);
 
+/**
+ * Converts h [0, 360], s and v [0.0, 1.0] to r, g and b [0.0, 1.0].
+ */
+void HSV2RGB (float h, float s, float v, float &r, float &g, float &b);
+
 /**
  * Gives a h,s,v color to OpenGL
  */
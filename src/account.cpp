@@ -20,21 +20,52 @@
 
 #include <stdio.h>
 #include <openssl/sha.h>
+#include <openssl/rand.h>
 #include <cctype>
 #include <cstring>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include "account.h"
 #include "str.h"
 #include "err.h"
 #include <errno.h>
 
-#define HASHSTRING_LENGTH 20
+#ifdef __unix__
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <dirent.h>
+    #include <signal.h>
+#elif defined _WIN32
+    #include <windows.h>
+#endif
+
+#define ACCOUNTDB_FILENAME "accounts.db"
+#define ACCOUNTDB_MAGIC "GTAC"
+#define ACCOUNTDB_MAGIC_LENGTH 4
+#define ACCOUNTDB_VERSION 1
+#define ACCOUNTDB_MINCAPACITY 64 // must be a power of two
+
+enum AccountSlotState {SLOT_FREE = 0, SLOT_USED, SLOT_DELETED};
+enum AccountHashScheme {HASH_LEGACY = 0, HASH_SALTED};
+
+struct AccountDBHeader
+{
+    char magic [ACCOUNTDB_MAGIC_LENGTH];
+    uint32_t version,
+             recordSize,
+             capacity, // number of slots, a power of two
+             nUsed, nDeleted;
+};
+
 void getHash(const char* username, const char* password, unsigned char* hash)
 {
     /*
-        This function is used for checking passwords.
-        If it changes, all account files must be created anew.
+        This function is used for checking passwords of imported account files.
+        If it changes, those accounts must be created anew.
      */
 
     SHA_CTX ctx;
@@ -44,164 +75,704 @@ void getHash(const char* username, const char* password, unsigned char* hash)
     SHA1_Update(&ctx,(void*)password,strlen(password));
     SHA1_Final(hash,&ctx);
 }
+void getSaltedHash (const unsigned char *salt, const char* username, const char* password, unsigned char* hash)
+{
+    SHA_CTX ctx;
+    SHA1_Init (&ctx);
+    SHA1_Update (&ctx, (void*)salt, SALT_LENGTH);
+    SHA1_Update (&ctx, (void*)username, strlen (username));
+    SHA1_Update (&ctx, (void*)password, strlen (password));
+    SHA1_Final (hash, &ctx);
+}
 
-void AccountFileName (const char *directory, const char *username, char *out)
+/*
+    username is case insensitive, thus always converted to lowercase
+    password is case sensitive
+ */
+void LowerUsername (const char *username, char *out)
+{
+    int i;
+    for (i = 0; username[i] && i < (USERNAME_MAXLENGTH - 1); i++)
+        out[i] = tolower ((unsigned char)username[i]);
+    out[i] = NULL;
+}
+uint32_t UsernameHash (const char *username) // FNV-1a
 {
+    uint32_t h = 2166136261u;
+    for (int i = 0; username[i]; i++)
+    {
+        h ^= (unsigned char)username[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+std::string AccountDBPath (const char *dirPath)
+{
+    return std::string (dirPath) + PATH_SEPARATOR + ACCOUNTDB_FILENAME;
+}
+
+/**
+ * :returns: the path of the old style account file, empty if the username can't be a file name.
+ */
+std::string LegacyAccountPath (const char *dirPath, const char *username)
+{
+    if (!username [0] || username [0] == '.' || strchr (username, '/') || strchr (username, '\\'))
+        return "";
+
     // <username>.account
+    return std::string (dirPath) + PATH_SEPARATOR + username + ".account";
+}
+
+#ifdef __unix__
+    #define GetProcessID getpid
+#elif defined _WIN32
+    #define GetProcessID GetCurrentProcessId
+#endif
+
+/**
+ * :returns: true if the process that made the lock file has ended.
+ */
+bool StaleLock (const std::string &lockPath)
+{
+    long pid = 0;
+
+    FILE *f = fopen (lockPath.c_str (), "r");
+    if (!f)
+        return false;
+
+    bool read = fscanf (f, "%ld", &pid) == 1 && pid > 0;
+    fclose (f);
+    if (!read)
+        return false;
 
-    sprintf(out,"%s%c%s.account", directory, PATH_SEPARATOR, username);
+#ifdef __unix__
+    return kill ((pid_t)pid, 0) != 0 && errno == ESRCH;
+#elif defined _WIN32
+    HANDLE hProcess = OpenProcess (SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (!hProcess)
+        return GetLastError () == ERROR_INVALID_PARAMETER;
+
+    bool ended = WaitForSingleObject (hProcess, 0) == WAIT_OBJECT_0;
+    CloseHandle (hProcess);
+    return ended;
+#else
+    return false;
+#endif
 }
 
-#define LINEID_ACCOUNT "ACCOUNT"
-bool MakeAccount (const char* dirPath, const char* username, const char* password)
+/**
+ * Only one writer may load, change and save the database at a time.
+ * The lock file holds the writer's process id, so that a lock left
+ * behind by a writer that crashed can be taken over.
+ */
+bool LockAccountDB (const char *dirPath, std::string &lockPath)
 {
-    char    filepath[FILENAME_MAX],
-            _username[USERNAME_MAXLENGTH],
-            _password[PASSWORD_MAXLENGTH];
-    unsigned char hash[HASHSTRING_LENGTH];
+    lockPath = AccountDBPath (dirPath) + ".lock";
 
-    /*
-        username is case insensitive, thus always converted to lowercase
-        password is case sensitive
-     */
-    int i;
-    for (i=0;username[i];i++)
-        _username[i]=tolower(username[i]);
-    _username[i]=NULL;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        FILE *f = fopen (lockPath.c_str (), "wx");
+        if (f)
+        {
+            fprintf (f, "%ld\n", (long)GetProcessID ());
+            fclose (f);
+            return true;
+        }
+
+        if (errno != EEXIST)
+        {
+            SetError ("cannot create %s: %s", lockPath.c_str (), strerror (errno));
+            return false;
+        }
+
+        if (!StaleLock (lockPath))
+            break;
+
+        remove (lockPath.c_str ());
+    }
+
+    SetError ("%s exists, is another manager running? If not, delete that file", lockPath.c_str ());
+    return false;
+}
+void UnlockAccountDB (const std::string &lockPath)
+{
+    remove (lockPath.c_str ());
+}
+
+/**
+ * Looks up a lowercase username by linear probing.
+ * :returns: the slot index, or -1 if not found.
+ */
+long FindRecord (const AccountRecord *records, const uint32_t capacity, const char *username)
+{
+    uint32_t mask = capacity - 1,
+             i = UsernameHash (username) & mask,
+             n;
+
+    for (n = 0; n < capacity; n++, i = (i + 1) & mask)
+    {
+        if (records [i].state == SLOT_FREE)
+            return -1;
+
+        if (records [i].state == SLOT_USED &&
+                strncmp (records [i].username, username, USERNAME_MAXLENGTH) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+bool ValidHeader (const AccountDBHeader *pHeader, const size_t fileSize)
+{
+    if (fileSize < sizeof (AccountDBHeader) ||
+            strncmp (pHeader->magic, ACCOUNTDB_MAGIC, ACCOUNTDB_MAGIC_LENGTH) != 0)
+    {
+        SetError ("not an account database");
+        return false;
+    }
+
+    if (pHeader->version != ACCOUNTDB_VERSION || pHeader->recordSize != sizeof (AccountRecord))
+    {
+        SetError ("unsupported account database version");
+        return false;
+    }
+
+    if (pHeader->capacity == 0 || (pHeader->capacity & (pHeader->capacity - 1)) != 0 ||
+            fileSize != sizeof (AccountDBHeader) + (size_t)pHeader->capacity * sizeof (AccountRecord))
+    {
+        SetError ("account database is damaged");
+        return false;
+    }
 
-    strcpy (_password, password);
+    return true;
+}
 
-    // Open the account file
-    AccountFileName (dirPath, _username, filepath);
+/*
+    The in-memory copy of the database, that changes are made to.
+ */
+struct AccountDB
+{
+    AccountDBHeader header;
+    std::vector <AccountRecord> records;
+};
+
+void InitAccountDB (AccountDB &db, const uint32_t capacity)
+{
+    memcpy (db.header.magic, ACCOUNTDB_MAGIC, ACCOUNTDB_MAGIC_LENGTH);
+    db.header.version = ACCOUNTDB_VERSION;
+    db.header.recordSize = sizeof (AccountRecord);
+    db.header.capacity = capacity;
+    db.header.nUsed = 0;
+    db.header.nDeleted = 0;
+
+    db.records.assign (capacity, AccountRecord ());
+    memset (db.records.data (), 0, capacity * sizeof (AccountRecord));
+}
 
-    FILE* f = fopen (filepath, "wb");
+/**
+ * A missing file means an empty database.
+ */
+bool LoadAccountDB (const char *dirPath, AccountDB &db)
+{
+    std::string path = AccountDBPath (dirPath);
+    size_t fileSize;
+
+    FILE *f = fopen (path.c_str (), "rb");
     if (!f)
     {
-        std::string _errorstring = std::string ("cannot open output file ") + filepath + ": " + strerror (errno);
-        SetError (_errorstring.c_str ());
+        if (errno != ENOENT)
+        {
+            SetError ("cannot open %s: %s", path.c_str (), strerror (errno));
+            return false;
+        }
+
+        InitAccountDB (db, ACCOUNTDB_MINCAPACITY);
+        return true;
+    }
+
+    fseek (f, 0, SEEK_END);
+    fileSize = ftell (f);
+    fseek (f, 0, SEEK_SET);
+
+    if (fread (&db.header, sizeof (AccountDBHeader), 1, f) != 1 || !ValidHeader (&db.header, fileSize))
+    {
+        if (ferror (f))
+            SetError ("cannot read %s: %s", path.c_str (), strerror (errno));
+        fclose (f);
         return false;
     }
 
-    /*
-        Write a single line, including
-        the username and password hash.
-     */
+    db.records.resize (db.header.capacity);
+    if (fread (db.records.data (), sizeof (AccountRecord), db.header.capacity, f) != db.header.capacity)
+    {
+        SetError ("cannot read %s: %s", path.c_str (), strerror (errno));
+        fclose (f);
+        return false;
+    }
+
+    fclose (f);
+    return true;
+}
 
-    getHash (_username, _password, hash);
-    fprintf (f, "%s %s ", LINEID_ACCOUNT, _username);
+/**
+ * Writes a copy first, then replaces the original with it.
+ * Must hold the lock, see LockAccountDB.
+ */
+bool SaveAccountDB (const char *dirPath, const AccountDB &db)
+{
+    std::string path = AccountDBPath (dirPath),
+                tmpPath = path + ".tmp";
 
-    // write each hash byte
-    for (i=0; i<HASHSTRING_LENGTH; i++)
+    // A copy, left behind by a writer that crashed, is overwritten.
+    FILE *f = fopen (tmpPath.c_str (), "wb");
+    if (!f)
     {
-        fprintf (f, "%.2X", hash[i]);
+        SetError ("cannot create %s: %s", tmpPath.c_str (), strerror (errno));
+        return false;
     }
 
-    fclose(f);
+    bool success = fwrite (&db.header, sizeof (AccountDBHeader), 1, f) == 1 &&
+                   fwrite (db.records.data (), sizeof (AccountRecord), db.records.size (), f) == db.records.size () &&
+                   fflush (f) == 0;
+
+#ifdef __unix__
+    success = success && fsync (fileno (f)) == 0;
+#endif
+
+    if (!success)
+        SetError ("cannot write %s: %s", tmpPath.c_str (), strerror (errno));
+
+    fclose (f);
+
+    if (success)
+    {
+    #ifdef _WIN32
+        success = MoveFileEx (tmpPath.c_str (), path.c_str (), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        if (!success)
+            SetError ("cannot replace %s: %s", path.c_str (), WindowsErrorString (GetLastError ()).c_str ());
+    #else
+        success = rename (tmpPath.c_str (), path.c_str ()) == 0;
+        if (!success)
+            SetError ("cannot replace %s: %s", path.c_str (), strerror (errno));
+    #endif
+    }
+
+    if (!success)
+        remove (tmpPath.c_str ());
+
+    return success;
+}
+
+void InsertRecord (AccountDB &db, const AccountRecord &record);
+
+/**
+ * Doubles the capacity, when more than half of the slots are taken.
+ * Also clears out the deleted slots.
+ */
+void GrowAccountDB (AccountDB &db)
+{
+    if (2 * (db.header.nUsed + db.header.nDeleted + 1) <= db.header.capacity)
+        return;
+
+    uint32_t capacity = db.header.capacity;
+    while (2 * (db.header.nUsed + 1) > capacity)
+        capacity *= 2;
+
+    AccountDB old = db;
+    InitAccountDB (db, capacity);
+
+    for (const AccountRecord &record : old.records)
+    {
+        if (record.state == SLOT_USED)
+            InsertRecord (db, record);
+    }
+}
+void InsertRecord (AccountDB &db, const AccountRecord &record)
+{
+    long existing = FindRecord (db.records.data (), db.header.capacity, record.username);
+    if (existing >= 0)
+    {
+        db.records [existing] = record;
+        return;
+    }
+
+    GrowAccountDB (db);
+
+    uint32_t mask = db.header.capacity - 1,
+             i = UsernameHash (record.username) & mask;
+
+    while (db.records [i].state == SLOT_USED)
+        i = (i + 1) & mask;
+
+    if (db.records [i].state == SLOT_DELETED)
+        db.header.nDeleted --;
+
+    db.records [i] = record;
+    db.header.nUsed ++;
+}
+
+bool MakeAccountRecord (const char* username, const char* password, AccountRecord *pRecord)
+{
+    memset (pRecord, 0, sizeof (AccountRecord));
+    LowerUsername (username, pRecord->username);
+    pRecord->state = SLOT_USED;
+    pRecord->scheme = HASH_SALTED;
+
+    if (RAND_bytes (pRecord->salt, SALT_LENGTH) != 1)
+    {
+        SetError ("cannot generate salt");
+        return false;
+    }
+    getSaltedHash (pRecord->salt, pRecord->username, password, pRecord->hash);
 
     return true;
 }
-void delAccount(const char* dirPath, const char* username)
+struct AccountWriter
 {
-    /*
-        username is case insensitive, thus always converted to lowercase
-     */
+    std::string dirPath,
+                lockPath;
+    AccountDB db;
+};
 
-    char    filepath[FILENAME_MAX],
-            _username[USERNAME_MAXLENGTH];
-    int i;
-    for(i=0;username[i];i++)
-        _username[i]=tolower(username[i]);
-    _username[i]=NULL;
+AccountWriter *OpenAccountWriter (const char* dirPath)
+{
+    AccountWriter *pWriter = new AccountWriter;
+    pWriter->dirPath = dirPath;
 
-    // Remove the file, associated with this username
+    if (!LockAccountDB (dirPath, pWriter->lockPath))
+    {
+        delete pWriter;
+        return NULL;
+    }
 
-    AccountFileName (dirPath, _username, filepath);
+    if (!LoadAccountDB (dirPath, pWriter->db))
+    {
+        UnlockAccountDB (pWriter->lockPath);
+        delete pWriter;
+        return NULL;
+    }
 
-    remove (filepath);
+    return pWriter;
 }
-bool authenticate(const char* dirPath, const char* username, const char* password)
+void WriteAccounts (AccountWriter *pWriter, const AccountRecord *records, const int nRecords)
 {
-    const int lineLength=128;
-    char    filepath [FILENAME_MAX],
-            line [lineLength],
-            _username [USERNAME_MAXLENGTH],
-            _password [PASSWORD_MAXLENGTH];
+    for (int i = 0; i < nRecords; i++)
+        InsertRecord (pWriter->db, records [i]);
+}
+bool CloseAccountWriter (AccountWriter *pWriter, const bool save)
+{
+    bool success = !save || SaveAccountDB (pWriter->dirPath.c_str (), pWriter->db);
+
+    UnlockAccountDB (pWriter->lockPath);
+    delete pWriter;
+
+    return success;
+}
+bool MakeAccounts (const char* dirPath, const AccountRecord *records, const int nRecords)
+{
+    AccountWriter *pWriter = OpenAccountWriter (dirPath);
+    if (!pWriter)
+        return false;
+
+    WriteAccounts (pWriter, records, nRecords);
+
+    return CloseAccountWriter (pWriter, true);
+}
+bool MakeAccount (const char* dirPath, const char* username, const char* password)
+{
+    AccountRecord record;
+
+    if (!MakeAccountRecord (username, password, &record))
+        return false;
+
+    return MakeAccounts (dirPath, &record, 1);
+}
+bool delAccount (const char* dirPath, const char* username)
+{
+    char _username [USERNAME_MAXLENGTH];
+    AccountDB db;
+    std::string lockPath;
+
+    LowerUsername (username, _username);
+
+    if (!LockAccountDB (dirPath, lockPath))
+        return false;
+
+    if (!LoadAccountDB (dirPath, db))
+    {
+        UnlockAccountDB (lockPath);
+        return false;
+    }
+
+    // An old style account file would still let the user in, see authenticate.
+    std::string legacyPath = LegacyAccountPath (dirPath, _username);
+    bool legacyRemoved = !legacyPath.empty () && remove (legacyPath.c_str ()) == 0;
+
+    long i = FindRecord (db.records.data (), db.header.capacity, _username);
+    if (i < 0)
+    {
+        UnlockAccountDB (lockPath);
 
-    unsigned char b;
+        if (!legacyRemoved)
+            SetError ("no such account: %s", _username);
+        return legacyRemoved;
+    }
+
+    // Keep the slot taken, so that the probing for other accounts doesn't stop here.
+    memset (&db.records [i], 0, sizeof (AccountRecord));
+    db.records [i].state = SLOT_DELETED;
+    db.header.nUsed --;
+    db.header.nDeleted ++;
+
+    bool success = SaveAccountDB (dirPath, db);
+
+    UnlockAccountDB (lockPath);
+    return success;
+}
+bool CheckPassword (const AccountRecord *pRecord, const char *password)
+{
     unsigned char hash [HASHSTRING_LENGTH];
 
+    if (pRecord->scheme == HASH_SALTED)
+        getSaltedHash (pRecord->salt, pRecord->username, password, hash);
+    else
+        getHash (pRecord->username, password, hash);
+
+    return memcmp (hash, pRecord->hash, HASHSTRING_LENGTH) == 0;
+}
+bool ParseAccountFile (const char *filepath, AccountRecord *pRecord);
+
+/**
+ * For users that aren't in the database, because their old style
+ * account file hasn't been imported yet.
+ */
+bool AuthenticateLegacy (const char* dirPath, const char* _username, const char* password)
+{
+    AccountRecord record;
+
+    std::string path = LegacyAccountPath (dirPath, _username);
+    if (path.empty ())
+        return false;
+
+    FILE *f = fopen (path.c_str (), "rb");
+    if (!f) // the user probably doesn't exist
+        return false;
+    fclose (f);
+
+    return ParseAccountFile (path.c_str (), &record) &&
+           strncmp (record.username, _username, USERNAME_MAXLENGTH) == 0 &&
+           CheckPassword (&record, password);
+}
+#ifdef __unix__
+bool authenticate (const char* dirPath, const char* username, const char* password)
+{
+    char _username [USERNAME_MAXLENGTH];
+    std::string path = AccountDBPath (dirPath);
+    struct stat st;
+    void *p;
+    bool success;
+
+    LowerUsername (username, _username);
+
     /*
-        username is case insensitive, thus always converted to lowercase
-        password is case sensitive
+        The file is mapped, so that only the pages that the lookup touches are read.
+        A file that replaces it in the meantime, doesn't affect this mapping.
      */
-    int i;
-    for (i = 0; username[i] && i < (USERNAME_MAXLENGTH - 1); i++)
-        _username[i] = tolower (username[i]);
-    _username[i]=NULL;
+    int fd = open (path.c_str (), O_RDONLY);
+    if (fd < 0) // no accounts made yet
+        return AuthenticateLegacy (dirPath, _username, password);
+
+    if (fstat (fd, &st) != 0 || st.st_size < (off_t)sizeof (AccountDBHeader))
+    {
+        close (fd);
+        return false;
+    }
+
+    p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (p == MAP_FAILED)
+        return false;
 
-    strcpy (_password, password);
+    const AccountDBHeader *pHeader = (const AccountDBHeader *)p;
+    const AccountRecord *records = (const AccountRecord *)(pHeader + 1);
 
-    getHash (_username, _password, hash);
+    long i = -1;
+    success = false;
+    if (ValidHeader (pHeader, st.st_size))
+    {
+        i = FindRecord (records, pHeader->capacity, _username);
+        success = i >= 0 && CheckPassword (&records [i], password);
+    }
 
-    AccountFileName (dirPath, _username, filepath);
+    munmap (p, st.st_size);
+
+    if (i < 0)
+        return AuthenticateLegacy (dirPath, _username, password);
+
+    return success;
+}
+#else
+bool authenticate (const char* dirPath, const char* username, const char* password)
+{
+    char _username [USERNAME_MAXLENGTH];
+    AccountDB db;
+
+    LowerUsername (username, _username);
+
+    if (!LoadAccountDB (dirPath, db))
+        return false;
+
+    long i = FindRecord (db.records.data (), db.header.capacity, _username);
+    if (i < 0)
+        return AuthenticateLegacy (dirPath, _username, password);
+
+    return CheckPassword (&db.records [i], password);
+}
+#endif
+
+#define LINEID_ACCOUNT "ACCOUNT"
+/**
+ * Reads the username and legacy hash from an old style account file.
+ */
+bool ParseAccountFile (const char *filepath, AccountRecord *pRecord)
+{
+    const int lineLength=128;
+    char line [lineLength];
+    unsigned int b;
 
     FILE* f = fopen (filepath, "rb");
-    if (!f) // the user probably doesn't exist
+    if (!f)
+    {
+        SetError ("cannot open %s: %s", filepath, strerror (errno));
+        return false;
+    }
+
+    if (!fgets (line, lineLength, f) || strncmp (LINEID_ACCOUNT, line, strlen (LINEID_ACCOUNT)) != 0)
     {
+        SetError ("%s is not an account file", filepath);
+        fclose (f);
         return false;
     }
+    fclose (f);
+
+    int i = 0, n, j;
+
+    // Read past the recognition bytes and the spaces after it.
+    while (line[i] && !isspace (line[i])) i++;
+    while (line[i] && isspace (line[i])) i++;
 
-    while (!feof(f))
+    // Read all the non-whitespace characters, presumed to be username
+    n = i;
+    while (line[n] && !isspace (line[n])) n++;
+
+    if (n == i || (n - i) >= USERNAME_MAXLENGTH)
     {
-        fgets (line, lineLength, f);
+        SetError ("%s has no valid username", filepath);
+        return false;
+    }
+
+    memset (pRecord, 0, sizeof (AccountRecord));
+    pRecord->state = SLOT_USED;
+    pRecord->scheme = HASH_LEGACY;
+    strncpy (pRecord->username, line + i, n - i);
 
-        // Check for the recognition bytes at the beginning of the file:
-        if (strncmp (LINEID_ACCOUNT, line, strlen (LINEID_ACCOUNT)) == 0)
+    // Read the spaces past the username
+    i = n;
+    while (line[i] && isspace (line [i])) i++;
+
+    for (j = 0; j < HASHSTRING_LENGTH; j++)
+    {
+        if (sscanf (line + i + j * 2, "%2X", &b) != 1)
         {
-            int i = 0, n, j;
-
-            // Read past the recognition bytes and the spaces after it.
-            while (line[i] && !isspace (line[i])) i++;
-            while (line[i] && isspace (line[i])) i++;
-
-            // Read all the non-whitespace characters, presumed to be username
-            n = i;
-            while (line[n] && !isspace (line[n])) n++;
-
-            if (n == i) // no more non-whitespace characters found
-                return false;
-
-            // Verify the username in the file:
-            if (strncmp (_username, line + i, n - i) != 0)
-                return false;
-
-            // Read the spaces past the username
-            i = n;
-            while (line[i] && isspace (line [i])) i++;
-
-            // compare each hash byte:
-            for (j = 0; j < HASHSTRING_LENGTH; j++)
-            {
-                // Read in the hash byte:
-                if (sscanf(line + i + j * 2, "%2X", &b) != 1)
-                {
-                    fprintf (stderr, "%s: cannot read byte %d of hash\n", filepath, j);
-                    return false;
-                }
-
-                if(b != hash[j])
-                {
-                    // mismatch in hash
-
-                    return false;
-                }
-            }
-            // went through the whole hash without mismatches
+            SetError ("%s: cannot read byte %d of hash", filepath, j);
+            return false;
+        }
+        pRecord->hash [j] = b;
+    }
+
+    return true;
+}
+
+/**
+ * :returns: the names of the old style account files in the directory.
+ */
+bool ListAccountFiles (const char *dirPath, std::vector <std::string> &filenames)
+{
+    const std::string extension = ".account";
+
+#ifdef __unix__
+    DIR *pDir = opendir (dirPath);
+    if (!pDir)
+    {
+        SetError ("cannot open directory %s: %s", dirPath, strerror (errno));
+        return false;
+    }
+
+    struct dirent *pEntry;
+    while ((pEntry = readdir (pDir)) != NULL)
+    {
+        std::string name = pEntry->d_name;
+        if (name.size () > extension.size () &&
+                name.compare (name.size () - extension.size (), extension.size (), extension) == 0)
+            filenames.push_back (name);
+    }
+
+    closedir (pDir);
+    return true;
+
+#elif defined _WIN32
+    WIN32_FIND_DATA findData;
+    std::string pattern = std::string (dirPath) + PATH_SEPARATOR + "*" + extension;
+
+    HANDLE hFind = FindFirstFile (pattern.c_str (), &findData);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        if (GetLastError () == ERROR_FILE_NOT_FOUND)
             return true;
+
+        SetError ("cannot list directory %s: %s", dirPath, WindowsErrorString (GetLastError ()).c_str ());
+        return false;
+    }
+
+    do
+    {
+        filenames.push_back (findData.cFileName);
+    }
+    while (FindNextFile (hFind, &findData));
+
+    FindClose (hFind);
+    return true;
+
+#else
+    #error "directory listing is not implemented for this os"
+#endif
+}
+int ImportAccountFiles (const char* dirPath, int *pnSkipped)
+{
+    std::vector <std::string> filenames;
+    std::vector <AccountRecord> records;
+    AccountRecord record;
+
+    *pnSkipped = 0;
+
+    if (!ListAccountFiles (dirPath, filenames))
+        return -1;
+
+    for (const std::string &filename : filenames)
+    {
+        std::string filepath = std::string (dirPath) + PATH_SEPARATOR + filename;
+
+        if (!ParseAccountFile (filepath.c_str (), &record))
+        {
+            (*pnSkipped) ++;
+            continue;
         }
+
+        records.push_back (record);
     }
 
-    fclose(f);
+    if (!MakeAccounts (dirPath, records.data (), records.size ()))
+        return -1;
 
-    return false;
+    return records.size ();
 }
@@ -24,17 +24,92 @@
 #define USERNAME_MAXLENGTH 14
 #define PASSWORD_MAXLENGTH 18
 
+#define HASHSTRING_LENGTH 20
+#define SALT_LENGTH 16
+
 /*
     For using these functions in an application,
     it's necessary that dirPath points to a valid
-    directory where account files are to be stored.
+    directory where the account database is to be stored.
+
+    All accounts are kept in a single file in that directory.
+    It holds a hash table of fixed size records, indexed by the
+    lowercase username. Changes are written to a copy of the file,
+    which then replaces the original, so that readers always see
+    a complete database. Writers take turns, by means of a lock file.
+
+    Users that only have an old style <username>.account file,
+    can still log in until it's imported.
  */
 
 /**
+ * Adds the account, or replaces the password if it already exists.
  * :returns: true on success, false otherwise.
  */
 bool MakeAccount (const char* dirPath, const char* username, const char* password);
-void delAccount (const char* dirPath, const char* username);
+
+/**
+ * Also removes the user's old style account file, if any.
+ * :returns: true if the account was removed, false if it didn't exist or on error.
+ */
+bool delAccount (const char* dirPath, const char* username);
+
 bool authenticate (const char* dirPath, const char* username, const char* password);
 
+/**
+ * Copies the accounts from the old <username>.account files
+ * in the directory into the database, the files are left alone.
+ * Unreadable files are skipped and counted.
+ * :returns: the number of imported accounts, -1 on error.
+ */
+int ImportAccountFiles (const char* dirPath, int *pnSkipped);
+
+/*
+    For adding many accounts at once: hash them with MakeAccountRecord,
+    from any number of threads, then store them with MakeAccounts.
+    Batches that don't fit in memory at once go through an AccountWriter.
+ */
+struct AccountRecord
+{
+    char username [USERNAME_MAXLENGTH]; // lowercase
+    unsigned char state, scheme,
+                  salt [SALT_LENGTH], // only for salted hashes
+                  hash [HASHSTRING_LENGTH];
+};
+
+/**
+ * Can be used from any thread.
+ * :returns: true on success, false otherwise.
+ */
+bool MakeAccountRecord (const char* username, const char* password, AccountRecord *pRecord);
+
+/**
+ * Adds or replaces all the accounts in one write.
+ * :returns: true on success, false otherwise.
+ */
+bool MakeAccounts (const char* dirPath, const AccountRecord *records, const int nRecords);
+
+/*
+    Holds the lock and an in-memory copy of the database, from open
+    until close, so that any number of batches cost only one write.
+ */
+struct AccountWriter;
+
+/**
+ * Takes the lock and loads the database.
+ * :returns: NULL on error.
+ */
+AccountWriter *OpenAccountWriter (const char* dirPath);
+
+/**
+ * Adds or replaces the accounts in memory, nothing is written yet.
+ */
+void WriteAccounts (AccountWriter *, const AccountRecord *records, const int nRecords);
+
+/**
+ * Writes the database if save is true, then releases the lock and the writer.
+ * :returns: false if saving failed.
+ */
+bool CloseAccountWriter (AccountWriter *, const bool save);
+
 #endif // ACCOUNT_H
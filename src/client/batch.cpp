@@ -0,0 +1,172 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#include <algorithm>
+
+#include "batch.h"
+#include "../matrix.h"
+#include "../textmesh.h"
+
+SpriteBatch::SpriteBatch (void)
+ : vbo (0), nDrawCalls (0)
+{
+}
+SpriteBatch::~SpriteBatch (void)
+{
+    if (vbo)
+        glDeleteBuffers (1, &vbo);
+}
+void SetVertex (SpriteVertex &v, const vec3 &pos, const GLfloat tx, const GLfloat ty, const GLfloat color [4])
+{
+    v.x = pos.x;
+    v.y = pos.y;
+    v.tx = tx;
+    v.ty = ty;
+    v.r = GLubyte (255 * color [0]);
+    v.g = GLubyte (255 * color [1]);
+    v.b = GLubyte (255 * color [2]);
+    v.a = GLubyte (255 * color [3]);
+}
+void SpriteBatch::AddSprite (const Texture *pTex, const vec2 &pos, const float angle,
+                             const GLfloat tx1, const GLfloat ty1, const GLfloat tx2, const GLfloat ty2,
+                             const GLfloat px, const GLfloat py, const GLfloat color [4])
+{
+    const matrix4 m = matTranslation (vec3 (pos.x, pos.y, 0)) * matRotZ (angle);
+
+    const GLfloat w = tx2 - tx1, h = ty2 - ty1,
+                  tw = pTex->w, th = pTex->h;
+
+    BatchQuad quad;
+    quad.tex = pTex->tex;
+    quad.distanceField = false;
+
+    SetVertex (quad.vertices [0], m * vec3 (-px,     -py,     0), tx1 / tw, 1.0f - ty1 / th, color);
+    SetVertex (quad.vertices [1], m * vec3 (-px + w, -py,     0), tx2 / tw, 1.0f - ty1 / th, color);
+    SetVertex (quad.vertices [2], m * vec3 (-px + w, -py + h, 0), tx2 / tw, 1.0f - ty2 / th, color);
+    SetVertex (quad.vertices [3], m * vec3 (-px,     -py + h, 0), tx1 / tw, 1.0f - ty2 / th, color);
+
+    quads.push_back (quad);
+}
+void SpriteBatch::AddText (const Font *pFont, const char *pUTF8, const vec2 &pos,
+                           const int align, const GLfloat color [4])
+{
+    BatchQuad quad;
+    quad.distanceField = pFont->distanceField;
+
+    ThroughTextQuads (pFont, pUTF8,
+        [&] (const GlyphQuad &g)
+        {
+            quad.tex = g.tex;
+
+            SetVertex (quad.vertices [0], vec3 (pos.x + g.x1, pos.y + g.y1, 0), g.tx1, g.ty1, color);
+            SetVertex (quad.vertices [1], vec3 (pos.x + g.x2, pos.y + g.y1, 0), g.tx2, g.ty1, color);
+            SetVertex (quad.vertices [2], vec3 (pos.x + g.x2, pos.y + g.y2, 0), g.tx2, g.ty2, color);
+            SetVertex (quad.vertices [3], vec3 (pos.x + g.x1, pos.y + g.y2, 0), g.tx1, g.ty2, color);
+
+            quads.push_back (quad);
+        },
+        align);
+}
+void SpriteBatch::Render (void)
+{
+    nDrawCalls = 0;
+    if (quads.empty ())
+        return;
+
+    // Group the quads by texture, so that each texture needs only one draw call:
+    std::stable_sort (quads.begin (), quads.end (),
+                      [] (const BatchQuad &q1, const BatchQuad &q2)
+                      {
+                          return q1.distanceField != q2.distanceField ? q2.distanceField : q1.tex < q2.tex;
+                      });
+
+    vertices.clear ();
+    for (const BatchQuad &quad : quads)
+        vertices.insert (vertices.end (), quad.vertices, quad.vertices + 4);
+
+    if (!vbo)
+        glGenBuffers (1, &vbo);
+
+    // Replace the whole buffer, so the driver doesn't have to wait for the previous frame to finish with it.
+    glBindBuffer (GL_ARRAY_BUFFER, vbo);
+    glBufferData (GL_ARRAY_BUFFER, sizeof (SpriteVertex) * vertices.size (), vertices.data (), GL_STREAM_DRAW);
+
+    glEnableClientState (GL_VERTEX_ARRAY);
+    glVertexPointer (2, GL_FLOAT, sizeof (SpriteVertex), 0);
+
+    glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer (2, GL_FLOAT, sizeof (SpriteVertex), (const GLvoid *)(2 * sizeof (GLfloat)));
+
+    glEnableClientState (GL_COLOR_ARRAY);
+    glColorPointer (4, GL_UNSIGNED_BYTE, sizeof (SpriteVertex), (const GLvoid *)(4 * sizeof (GLfloat)));
+
+    GLint prevProgram = 0;
+    GLuint program = 0;
+    bool distanceField = false;
+
+    size_t first = 0;
+    while (first < quads.size ())
+    {
+        size_t last = first + 1;
+        while (last < quads.size () && quads [last].tex == quads [first].tex &&
+               quads [last].distanceField == quads [first].distanceField)
+            last ++;
+
+        // Distance field quads come last, so this switches only once:
+        if (quads [first].distanceField && !distanceField)
+        {
+            distanceField = true;
+
+            glGetIntegerv (GL_CURRENT_PROGRAM, &prevProgram);
+            program = GetDistanceFieldProgram ();
+            if (program)
+                glUseProgram (program);
+            else
+            {
+                glPushAttrib (GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT);
+                glEnable (GL_ALPHA_TEST);
+                glAlphaFunc (GL_GEQUAL, 0.5f);
+            }
+        }
+
+        glBindTexture (GL_TEXTURE_2D, quads [first].tex);
+        glDrawArrays (GL_QUADS, 4 * first, 4 * (last - first));
+        nDrawCalls ++;
+
+        first = last;
+    }
+
+    if (distanceField)
+    {
+        if (program)
+            glUseProgram (prevProgram);
+        else
+            glPopAttrib ();
+    }
+
+    glDisableClientState (GL_VERTEX_ARRAY);
+    glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState (GL_COLOR_ARRAY);
+
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+    quads.clear ();
+}
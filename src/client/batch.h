@@ -0,0 +1,85 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <vector>
+
+#include "../vec.h"
+#include "../font.h"
+#include "../texture.h"
+
+struct SpriteVertex
+{
+    GLfloat x, y,
+            tx, ty;
+    GLubyte r, g, b, a;
+};
+
+/*
+    Collects textured 2D quads during a frame and renders them with one draw call per texture,
+    from a single streaming vertex buffer. Cursors and text can go in the same batch.
+ */
+class SpriteBatch
+{
+private:
+    struct BatchQuad
+    {
+        GLuint tex;
+        bool distanceField; // text of a distance field font
+        SpriteVertex vertices [4];
+    };
+    std::vector <BatchQuad> quads;
+    std::vector <SpriteVertex> vertices;
+
+    GLuint vbo;
+    int nDrawCalls;
+
+public:
+    SpriteBatch (void);
+    ~SpriteBatch (void);
+
+    /**
+     * Like RenderSprite, but rotated by 'angle' radians around pos.
+     * tx1, ty1, tx2, ty2 are in pixels, px and py is the pivot point.
+     */
+    void AddSprite (const Texture *pTex, const vec2 &pos, const float angle,
+                    const GLfloat tx1, const GLfloat ty1, const GLfloat tx2, const GLfloat ty2,
+                    const GLfloat px, const GLfloat py, const GLfloat color [4]);
+
+    void AddText (const Font *pFont, const char *pUTF8, const vec2 &pos,
+                  const int align, const GLfloat color [4]);
+
+    /**
+     * Draws all added quads and empties the batch.
+     * Text of distance field fonts is drawn with the distance field shader.
+     * Expects GL_TEXTURE_2D to be enabled.
+     */
+    void Render (void);
+
+    int GetDrawCalls (void) const { return nDrawCalls; } // during the last Render
+};
+
+#endif // BATCH_H
@@ -32,6 +32,8 @@
 #include "../GLutil.h"
 #include "../ini.h"
 #include "../err.h"
+#include "../textmesh.h"
+#include "../thread.h"
 
 #define FULLSCREEN_SETTING "fullscreen"
 #define SCREENWIDTH_SETTING "screenwidth"
@@ -39,6 +41,11 @@
 
 #define PORT_SETTING "port"
 #define HOST_SETTING "host"
+#define ROOM_SETTING "room"
+
+#define MAXFPS_SETTING "max-fps"
+#define IDLEFPS_SETTING "idle-fps"
+#define VSYNC_SETTING "vsync"
 
 #include <SDL2/SDL_mixer.h>
 
@@ -50,6 +57,10 @@
 Client::Client():
     fromServer(NULL), toServer(NULL), udpPackets(NULL),
     udp_socket(NULL),
+    pNetThread(NULL),
+    netThreadStop(false),
+    nInDropped(0),
+    messageTicks(0),
 
     done(false),
     pScene(NULL),
@@ -103,17 +114,11 @@ void Client::MainLoop(void)
         while (SDL_PollEvent (&event)) {
 
             HandleEvent (&event);
+            pacer.OnActivity ();
         }
 
-        while(SDLNet_UDP_Recv(udp_socket, fromServer))
-        {
-            if (fromServer->address.host == serverAddress.host &&
-                fromServer->address.port == serverAddress.port)
-            {
-                if(pScene)
-                    pScene->OnServerMessage (fromServer->data, fromServer->len);
-            }
-        }
+        if (HandleIncoming ())
+            pacer.OnActivity ();
 
         // determine how much time passed since last iteration:
         ticks = SDL_GetTicks();
@@ -131,7 +136,18 @@ void Client::MainLoop(void)
 
         // Show whatever is rendered in the main window
         SDL_GL_SwapWindow (mainWindow);
+
+        // Don't render more frames than needed:
+        pacer.Wait (WindowFocus ());
     }
+
+#ifdef DEBUG
+    pacer.PrintHistogram (stderr);
+#endif
+}
+bool Client::WindowFocus () const
+{
+    return (SDL_GetWindowFlags (mainWindow) & SDL_WINDOW_INPUT_FOCUS) != 0;
 }
 void Client::HandleEvent (const SDL_Event *event)
 {
@@ -255,29 +271,142 @@ TCPsocket Client::Server_TCP_Connect ()
     }
     return socket;
 }
+/**
+ * Only queues the data, the network thread sends it.
+ */
 bool Client::SendToServer(const Uint8* data, const int len)
 {
-    toServer->address.host = serverAddress.host;
-    toServer->address.port = serverAddress.port;
-
-    if (len > toServer->maxlen)
+    if (len > PACKET_MAXSIZE)
     {
-        fprintf (stderr, "too many bytes to send: %d max = %d\n", len, toServer->maxlen);
+        fprintf (stderr, "too many bytes to send: %d max = %d\n", len, PACKET_MAXSIZE);
         return false;
     }
 
-    memcpy (toServer -> data, data, len);
-    toServer->len = len;
-    SDLNet_UDP_Send (udp_socket, -1, toServer);
-
-    if (toServer->status != len)
+    NetPacket *pPacket = outRing.Back ();
+    if (!pPacket)
     {
-        fprintf (stderr, "tried to send %d bytes to server, status returned gives %d\n", len, toServer->status);
+        fprintf (stderr, "cannot send %d bytes to server, the outgoing queue is full\n", len);
         return false;
     }
 
+    memcpy (pPacket->data, data, len);
+    pPacket->len = len;
+    outRing.Push ();
+
     return true;
 }
+/**
+ * Passes the packets that the network thread recieved to the scene.
+ * :returns: true if there were any
+ */
+bool Client::HandleIncoming (void)
+{
+    NetPacket *pPacket;
+    bool any = false;
+    while ((pPacket = inRing.Front ()))
+    {
+        any = true;
+        messageTicks = pPacket->ticks;
+
+        if (pScene)
+            pScene->OnServerMessage (pPacket->data, pPacket->len);
+
+        inRing.Pop ();
+    }
+
+    Uint32 nDropped = nInDropped.exchange (0);
+    if (nDropped > 0)
+        fprintf (stderr, "warning: %u packets from the server were dropped, the incoming queue was full\n", nDropped);
+
+    return any;
+}
+
+#define NETTHREAD_WAIT 5 // ticks, max delay for outgoing packets
+
+/**
+ * Waits for packets from the server, so that they're timestamped
+ * and ping requests are answered, no matter how long frames take.
+ */
+int Client::NetThread (void)
+{
+    SDLNet_SocketSet set = SDLNet_AllocSocketSet (1);
+    if (!set)
+    {
+        fprintf (stderr, "SDLNet_AllocSocketSet: %s\n", SDLNet_GetError ());
+        return 1;
+    }
+    SDLNet_UDP_AddSocket (set, udp_socket);
+
+    while (!netThreadStop)
+    {
+        SendOutgoing ();
+
+        if (SDLNet_CheckSockets (set, NETTHREAD_WAIT) > 0)
+            ReceiveIncoming ();
+    }
+
+    // Things like a logout message might still be waiting:
+    SendOutgoing ();
+
+    SDLNet_FreeSocketSet (set);
+
+    return 0;
+}
+void Client::SendOutgoing (void)
+{
+    NetPacket *pPacket;
+
+    toServer->address.host = serverAddress.host;
+    toServer->address.port = serverAddress.port;
+
+    while ((pPacket = outRing.Front ()))
+    {
+        memcpy (toServer->data, pPacket->data, pPacket->len);
+        toServer->len = pPacket->len;
+        outRing.Pop ();
+
+        SDLNet_UDP_Send (udp_socket, -1, toServer);
+        if (toServer->status != toServer->len)
+        {
+            fprintf (stderr, "tried to send %d bytes to server, status returned gives %d\n",
+                     toServer->len, toServer->status);
+        }
+    }
+}
+void Client::ReceiveIncoming (void)
+{
+    NetPacket *pPacket;
+
+    while (SDLNet_UDP_Recv (udp_socket, fromServer) > 0)
+    {
+        if (fromServer->address.host != serverAddress.host ||
+            fromServer->address.port != serverAddress.port)
+            continue;
+
+        if (fromServer->len > 0 && fromServer->data [0] == NETSIG_PINGSERVER)
+        {
+            // The server measures its round trip time with this, answer right away:
+            toServer->address.host = serverAddress.host;
+            toServer->address.port = serverAddress.port;
+            toServer->data [0] = NETSIG_PINGSERVER;
+            toServer->len = 1;
+            SDLNet_UDP_Send (udp_socket, -1, toServer);
+
+            // The scene still gets it, as a sign of life.
+        }
+
+        if (!(pPacket = inRing.Back ()))
+        {
+            nInDropped ++;
+            continue;
+        }
+
+        pPacket->ticks = SDL_GetTicks ();
+        pPacket->len = fromServer->len;
+        memcpy (pPacket->data, fromServer->data, fromServer->len);
+        inRing.Push ();
+    }
+}
 
 bool Client::Init ()
 {
@@ -304,6 +433,9 @@ bool Client::Init ()
         return false;
     }
 
+    if (!LoadSettingString (settingsPath, ROOM_SETTING, room))
+        room = DEFAULT_ROOM;
+
     if (SDLNet_Init () < 0)
     {
         SetError ("SDLNet_Init: %s", SDLNet_GetError());
@@ -333,6 +465,12 @@ bool Client::Init ()
     toServer = udpPackets[0];
     fromServer = udpPackets[1];
 
+    if (!(pNetThread = MakeSDLThread ([this] { return this->NetThread (); }, "client_net_thread")))
+    {
+        SetError ("Cannot start network thread: %s", SDL_GetError ());
+        return false;
+    }
+
     // initialize SDL with screen sizes from settings file:
     w = LoadSetting (settingsPath.c_str (), SCREENWIDTH_SETTING);
     if (w <= 0)
@@ -427,6 +565,17 @@ bool Client::Init ()
     if (!CheckGLOK("GL init"))
         return false;
 
+    // Frame rate limits, vsync is on unless the settings say otherwise:
+    char value [100];
+    if (LoadSettingString (settingsPath.c_str (), MAXFPS_SETTING, value))
+        pacer.SetTargetFPS (atof (value));
+    if (LoadSettingString (settingsPath.c_str (), IDLEFPS_SETTING, value))
+        pacer.SetIdleFPS (atof (value));
+
+    bool vsync = !LoadSettingString (settingsPath.c_str (), VSYNC_SETTING, value) || atoi (value) > 0;
+    if (!pacer.SetVSync (vsync))
+        fprintf (stderr, "warning: cannot set vsync to %d: %s\n", vsync, SDL_GetError ());
+
     // Initialize SDL_mixer, check if audio is enabled.
     has_audio = (Mix_OpenAudio (44100, MIX_DEFAULT_FORMAT, 2, 1024) == 0);
     if (!has_audio)
@@ -444,6 +593,13 @@ bool Client::Init ()
 }
 void Client::CleanUp()
 {
+    if (pNetThread)
+    {
+        netThreadStop = true;
+        SDL_WaitThread (pNetThread, NULL);
+        pNetThread = NULL;
+    }
+
     delete pScene;
     pScene = NULL;
 
@@ -452,6 +608,7 @@ void Client::CleanUp()
     icon = NULL;
 #endif
 
+    ClearTextMeshCache ();
     SDL_GL_DeleteContext (mainGLContext);
     SDL_DestroyWindow (mainWindow);
     SDL_Quit ();
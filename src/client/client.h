@@ -32,6 +32,20 @@
 
 #include <stdio.h>
 #include <string>
+#include <atomic>
+
+#include "ring.h"
+#include "../pacer.h"
+#include "../server/server.h"
+
+#define NETRING_SIZE 256 // packets, per direction
+
+struct NetPacket
+{
+    Uint32 ticks; // on arrival
+    int len;
+    Uint8 data [PACKET_MAXSIZE];
+};
 
 class EventListener
 {
@@ -53,12 +67,15 @@ class Client
 private:
 
     bool fullscreen, has_audio;
-    std::string settingsPath;
+    std::string settingsPath,
+                room; // to join on login
 
     SDL_Window *mainWindow;
     SDL_GLContext mainGLContext;
     bool done;
 
+    FramePacer pacer;
+
     IPaddress serverAddress,
               *pUDPAddress;
     UDPsocket udp_socket;
@@ -67,6 +84,21 @@ private:
                 *fromServer,
                 **udpPackets;
 
+    /*
+        The network thread owns the udp socket. It passes packets
+        from and to the main thread through these rings.
+     */
+    SPSCRing <NetPacket, NETRING_SIZE> inRing, outRing;
+    SDL_Thread *pNetThread;
+    std::atomic <bool> netThreadStop;
+    std::atomic <Uint32> nInDropped;
+    Uint32 messageTicks;
+
+    int NetThread (void);
+    void SendOutgoing (void);
+    void ReceiveIncoming (void);
+    bool HandleIncoming (void);
+
 #ifdef _WIN32
     HICON icon;
 #endif
@@ -104,10 +136,15 @@ public:
 
     bool SendToServer (const Uint8* data, const int len);
 
+    // Arrival time of the server message that's being handled.
+    Uint32 GetMessageTicks () const { return messageTicks; }
+
     TCPsocket Server_TCP_Connect ();
 
     IPaddress *GetUDPAddress ();
 
+    const char *GetRoom () const { return room.c_str (); }
+
     void SwitchScene (Scene* scene); // NULL to do nothing
 
     bool WindowFocus () const;
@@ -80,15 +80,12 @@ void ConnectedScene::OnServerMessage(const Uint8 *data, int len)
     timeSinceLastServerMessage = 0;
 
     Uint8 signature = data[0];
-    if(signature == NETSIG_PINGSERVER) // server requests a sign of life
-    {
-        // ping back immediatly
-        pClient->SendToServer(&signature,1);
-    }
-    else if (signature == NETSIG_PINGCLIENT) // server pings back, so reset the ping
+    // NETSIG_PINGSERVER was already answered by the client's network thread.
+
+    if (signature == NETSIG_PINGCLIENT) // server pings back, so reset the ping
     {
         timeSinceLastPing = 0;
-        ping = SDL_GetTicks() - ping0;
+        ping = pClient->GetMessageTicks () - ping0;
         pinging = false;
     }
 }
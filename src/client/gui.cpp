@@ -32,8 +32,13 @@
 
 MenuObject::MenuObject()
 {
+    menu = NULL;
     focussed = false;
     enabled = true;
+
+    displayList = 0;
+    dirty = true;
+    retained = mouseOver = false;
 }
 bool MenuObject::IsInputEnabled() const
 {
@@ -58,6 +63,9 @@ void MenuObject::SetFocus (const bool b)
     if (!b && focussed)
         OnFocusLose ();
 
+    if (b != focussed)
+        SetDirty ();
+
     focussed = b;
 }
 Menu::Menu (Client *p) : pClient (p)
@@ -70,12 +78,21 @@ Menu::~Menu ()
     for(std::list <MenuObject*>::iterator it = objects.begin(); it != objects.end(); it++)
     {
         MenuObject *obj = *it;
+        if (obj->displayList)
+            glDeleteLists (obj->displayList, 1);
         delete obj;
     }
     objects.clear ();
 }
 void Menu::DisableInput ()
 {
+    // Objects might look different without input, like buttons that light up.
+    if (inputEnabled)
+    {
+        for (MenuObject *pObj : objects)
+            pObj->SetDirty ();
+    }
+
     /*
     if(focussed)
     {
@@ -87,6 +104,12 @@ void Menu::DisableInput ()
 }
 void Menu::EnableInput ()
 {
+    if (!inputEnabled)
+    {
+        for (MenuObject *pObj : objects)
+            pObj->SetDirty ();
+    }
+
     inputEnabled = true;
 }
 void Menu::DisableObjectFocus (MenuObject* obj)
@@ -100,6 +123,7 @@ void Menu::DisableObjectFocus (MenuObject* obj)
         if (o == obj)
         {
             obj->enabled = false;
+            obj->SetDirty ();
             return;
         }
     }
@@ -120,6 +144,7 @@ void Menu::EnableObjectFocus (MenuObject* obj)
                 focussed=NULL;
             }
             obj->enabled=true;
+            obj->SetDirty ();
             return;
         }
     }
@@ -259,12 +284,20 @@ void Menu::Render()
     {
         MenuObject *pObj = *it;
 
-        if(!mouseOverObj && pObj->MouseOver((GLfloat)mX, (GLfloat)mY))
+        bool over = pObj->MouseOver((GLfloat)mX, (GLfloat)mY);
+        if(!mouseOverObj && over)
         {
             mouseOverObj = pObj;
         }
 
-        pObj->Render();
+        // Objects are allowed to look different when hovered over.
+        if (over != pObj->mouseOver)
+        {
+            pObj->mouseOver = over;
+            pObj->SetDirty ();
+        }
+
+        RenderObject (pObj);
     }
 
     int w, h;
@@ -283,6 +316,43 @@ void Menu::Render()
         }
     }
 }
+void Menu::RenderObject (MenuObject *pObj)
+{
+    /*
+        Objects that change every frame, like a blinking text cursor,
+        are rendered directly. Recording them would only cost extra.
+        Once an object stays the same for a frame, its rendering is recorded
+        and from then on the menu only replays it.
+     */
+    if (pObj->dirty)
+    {
+        pObj->Render ();
+
+        pObj->dirty = false;
+        pObj->retained = false;
+    }
+    else if (pObj->retained)
+    {
+        glCallList (pObj->displayList);
+    }
+    else
+    {
+        if (!pObj->displayList)
+            pObj->displayList = glGenLists (1);
+
+        if (!pObj->displayList) // out of display lists, just keep rendering it
+        {
+            pObj->Render ();
+            return;
+        }
+
+        glNewList (pObj->displayList, GL_COMPILE_AND_EXECUTE);
+        pObj->Render ();
+        glEndList ();
+
+        pObj->retained = true;
+    }
+}
 TextInputBox::TextInputBox(const GLfloat x, const GLfloat y,
                            const Font* f,
                            const int maxTextLength,
@@ -308,9 +378,13 @@ TextInputBox::TextInputBox(const GLfloat x, const GLfloat y,
     else showText=NULL;
 
     cursor_time=button_time=0;
+    layoutValid = false;
 }
 void TextInputBox::UpdateShowText()
 {
+    layoutValid = false;
+    SetDirty ();
+
     if (textMask) // only used when masking
     {
         // one mask char per utf-8 char
@@ -322,6 +396,15 @@ void TextInputBox::UpdateShowText()
         showText [i] = NULL;
     }
 }
+const TextLayout &TextInputBox::GetLayout () const
+{
+    if (!layoutValid)
+    {
+        LayoutText (pFont, textMask ? showText : text, layout, textAlign);
+        layoutValid = true;
+    }
+    return layout;
+}
 TextInputBox::~TextInputBox()
 {
     delete [] showText;
@@ -335,9 +418,7 @@ void TextInputBox::GetCursorCoords(GLfloat& cx, GLfloat& cy) const
 {
     if (pFont)
     {
-        char *t = textMask ? showText : text;
-
-        CoordsOfGlyph (pFont, t, cursorPos, cx, cy, textAlign);
+        CoordsOfGlyph (GetLayout (), cursorPos, cx, cy);
         cx += x; cy += y;
     }
 }
@@ -345,9 +426,7 @@ void TextInputBox::GetFixedCursorCoords(GLfloat& cx, GLfloat& cy) const
 {
     if(pFont)
     {
-        char* t = textMask ? showText : text;
-
-        CoordsOfGlyph (pFont, t, fixedCursorPos, cx, cy, textAlign);
+        CoordsOfGlyph (GetLayout (), fixedCursorPos, cx, cy);
         cx += x; cy += y;
     }
 }
@@ -506,14 +585,8 @@ void TextInputBox::RenderTextCursor() const
     }
     else // render a rectangle over the selected text
     {
-        char* t=text;
-        if(textMask)
-        {
-            t=showText;
-        }
-
         glTranslatef (x, y, 0.0f);
-        glRenderTextAsRects (pFont, t, selectionStart, selectionEnd, textAlign);
+        glRenderTextAsRects (GetLayout (), selectionStart, selectionEnd);
         glTranslatef (-x, -y, 0.0f);
     }
 
@@ -541,17 +614,17 @@ bool TextInputBox::MouseOver (GLfloat mX, GLfloat mY) const
 
     char* t = textMask ? showText : text;
 
-    int cpos = WhichGlyphAt (pFont, t, (GLfloat)(mX - x),(GLfloat)(mY - y), textAlign),
+    int cpos = WhichGlyphAt (GetLayout (), (GLfloat)(mX - x),(GLfloat)(mY - y)),
         n = strlen(t);
 
     if (cpos >= 0)
     {
         GLfloat cx1,cy1,cx2,cy2;
 
-        CoordsOfGlyph (pFont, t, 0, cx1, cy1, textAlign);
+        CoordsOfGlyph (GetLayout (), 0, cx1, cy1);
         cx1 += x; cy1 += y;
 
-        CoordsOfGlyph (pFont, t, n, cx2, cy2, textAlign);
+        CoordsOfGlyph (GetLayout (), n, cx2, cy2);
         cx2 += x; cy2 += y;
 
         /*
@@ -788,6 +861,9 @@ void TextInputBox::Update (const float dt)
     if (IsFocussed ())
     {
         cursor_time += dt; // for cursor blinking
+
+        // The cursor's alpha changes every frame.
+        SetDirty ();
     }
 }
 void TextInputBox::OnMouseMove (const SDL_MouseMotionEvent *event)
@@ -805,7 +881,7 @@ void TextInputBox::OnMouseMove (const SDL_MouseMotionEvent *event)
         {
             t=showText;
         }
-        int cpos = WhichGlyphAt (pFont, t, (GLfloat)(event->x - x), (GLfloat)(event->y - y), textAlign);
+        int cpos = WhichGlyphAt (GetLayout (), (GLfloat)(event->x - x), (GLfloat)(event->y - y));
 
         if (cpos >= 0)
         {
@@ -818,8 +894,8 @@ void TextInputBox::OnMouseMove (const SDL_MouseMotionEvent *event)
                    include the pointed character in the selection or not */
 
                 float textY, leftBound, rightBound;
-                CoordsOfGlyph (pFont, t, cpos, leftBound, textY, textAlign);
-                CoordsOfGlyph (pFont, t, cpos + 1, rightBound, textY, textAlign);
+                CoordsOfGlyph (GetLayout (), cpos, leftBound, textY);
+                CoordsOfGlyph (GetLayout (), cpos + 1, rightBound, textY);
 
                 // make leftBound and rightBound absolute:
                 leftBound += x;
@@ -835,6 +911,8 @@ void TextInputBox::OnMouseMove (const SDL_MouseMotionEvent *event)
                 else
                     cursorPos = cpos;
             }
+
+            SetDirty ();
         }
     }
 }
@@ -855,7 +933,7 @@ void TextInputBox::OnMouseClick (const SDL_MouseButtonEvent *event)
 
     const Uint8 *keystate = SDL_GetKeyboardState (NULL);
 
-    cpos = WhichGlyphAt (pFont, t, event->x - x, event->y - y, textAlign);
+    cpos = WhichGlyphAt (GetLayout (), event->x - x, event->y - y);
     if (cpos >= 0)
     {
         if (event->clicks > 1) // double click, select entire word
@@ -868,6 +946,8 @@ void TextInputBox::OnMouseClick (const SDL_MouseButtonEvent *event)
         // If shift is down, the selection start should stay where it was.
         if (keystate [SDL_SCANCODE_LSHIFT] || keystate [SDL_SCANCODE_RSHIFT])
             fixedCursorPos = prev_fixedCursorPos;
+
+        SetDirty ();
     }
 }
 void TextInputBox::OnTextInput (const SDL_TextInputEvent *event)
@@ -46,7 +46,24 @@ private:
     bool focussed, // means this is the current menu object that recieves input from the menu.
          enabled; // when disabled, it doesn't recieve mouse input.
 
+    /*
+        The menu records each object's Render calls in a display list and replays it,
+        for as long as the object looks the same. 'dirty' means that the object changed
+        since it was last rendered, 'retained' means that the display list holds its
+        latest rendering and 'mouseOver' is the hover state it was rendered with.
+     */
+    GLuint displayList;
+    bool dirty,
+         retained,
+         mouseOver;
+
 protected:
+    /*
+        Must be called when something changes, that Render depends on.
+        Otherwise the menu keeps replaying the old rendering.
+     */
+    void SetDirty () { dirty = true; }
+
     // Override this if the cursor should look different when hovering over this object.
     virtual void RenderCursor (const int mX, const int mY);
 
@@ -54,7 +71,7 @@ protected:
 
 public:
     // These functions are usefull when using a menu object without a menu.
-    void SetEnabled (const bool b) { enabled = b; }
+    void SetEnabled (const bool b) { enabled = b; SetDirty (); }
     void SetFocus (const bool);
 
     bool IsFocussed () const {return focussed;}
@@ -67,6 +84,10 @@ public:
     virtual void OnFocusGain () {}
     virtual void OnFocusLose () {}
 
+    /*
+        Inside a menu, Render is recorded and replayed until SetDirty is called.
+        So anything that Render depends on, besides hover and input state, must call SetDirty.
+     */
     virtual void Render () {}
     virtual void Update (const float dt) {}
 
@@ -108,6 +129,9 @@ private:
 
     bool inputEnabled;
 
+    // Replays the object's display list or, if it changed, renders it again.
+    void RenderObject (MenuObject *);
+
 public:
     /*
      * called when the default cursor is needed
@@ -191,6 +215,11 @@ private:
     // This changes the masked text, must be called when input text changes.
     void UpdateShowText();
 
+    // Layout of the shown text, only made again after the text changes:
+    mutable TextLayout layout;
+    mutable bool layoutValid;
+    const TextLayout &GetLayout () const;
+
     // Removes the characters at given positions from the text string.
     void ClearText (const std::size_t start, const std::size_t end);
 
@@ -257,8 +286,8 @@ public:
     void SetText (const char* text);
     const char* GetText () const;
 
-    void SetX (GLfloat _x) { x = _x; }
-    void SetY (GLfloat _y) { y = _y; }
+    void SetX (GLfloat _x) { if (x != _x) { x = _x; SetDirty (); } }
+    void SetY (GLfloat _y) { if (y != _y) { y = _y; SetDirty (); } }
 
     GLfloat GetX() const { return x; }
     GLfloat GetY() const { return y; }
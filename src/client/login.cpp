@@ -27,6 +27,7 @@
 #include "../io.h"
 #include "../err.h"
 #include "../xml.h"
+#include "../fontcache.h"
 #include "../thread.h"
 
 #include "../server/server.h"
@@ -35,6 +36,7 @@
 #define INPUT_CHAT_SPACING 10.0f
 #define CHAT_VISIBILITY_TIME 7.0f // seconds
 #define CHAT_ALPHA_DECREASE 1.0f // per second
+#define CHAT_MAXMESSAGES 500 // older ones are removed from the scroll
 
 
 void RenderSprite (Texture* tex,
@@ -622,6 +624,9 @@ void LoginScene::GetLoginParams (LoginParams *p)
     strcpy (p->username, un);
     strcpy (p->password, pw);
     p->udp_port = pClient->GetUDPAddress ()->port;
+
+    strncpy (p->room, pClient->GetRoom (), ROOMNAME_MAXLENGTH);
+    p->room [ROOMNAME_MAXLENGTH - 1] = NULL;
 }
 bool LoginScene::Init ()
 {
@@ -641,27 +646,26 @@ bool LoginScene::Init ()
         return false;
     }
 
-    xmlDocPtr pDoc = ParseXML(f);
+    std::string svgData;
+    success = ReadAll (f, svgData);
     f->close (f);
 
-    if (!pDoc)
+    if (!success)
     {
-        SetError ("error parsing handwriting.svg: %s", GetError ());
+        SetError ("error reading handwriting.svg: %s", SDL_GetError ());
         return false;
     }
 
-    if (!ParseSVGFont (pDoc, 16, &small_font))
+    // One distance field atlas serves both sizes:
+    if (!LoadSVGFontCached (svgData, 28, GetCachePath ("client", "handwriting-28-field.fontcache"), &fieldFont, true))
     {
         SetError ("error parsing handwriting.svg: %s", GetError ());
         return false;
     }
 
-    success = ParseSVGFont (pDoc, 28, &font);
-    xmlFreeDoc (pDoc);
-
-    if (!success)
+    if (!ScaleFont (&fieldFont, 28, &font) || !ScaleFont (&fieldFont, 16, &small_font))
     {
-        SetError ("error parsing handwriting.svg: %s", GetError ());
+        SetError ("error scaling handwriting.svg: %s", GetError ());
         return false;
     }
 
@@ -783,6 +787,8 @@ void LoginScene::OnServerMessage (const Uint8*data,int len)
     if(nextScene && (
         signature == NETSIG_USERSTATE ||
         signature == NETSIG_ADDPLAYER ||
+        signature == NETSIG_ROSTER ||
+        signature == NETSIG_JOINROOM ||
         signature == NETSIG_DELPLAYER
         )) // this message is meant for the next scene
     {
@@ -986,6 +992,7 @@ TestConnectionScene::ChatScroll::ChatScroll (TestConnectionScene *_parent, const
     parent (_parent),
     alpha (0.0f)
 {
+    SetMaxParagraphs (CHAT_MAXMESSAGES);
 }
 void RenderQuad (const GLfloat qx1, const GLfloat qy1, const GLfloat qx2, const GLfloat qy2,
                  const GLfloat tx1, const GLfloat ty1, const GLfloat tx2, const GLfloat ty2)
@@ -1135,6 +1142,7 @@ TestConnectionScene::TestConnectionScene(Client *p, LoginScene* s, Texture* curs
     tex (cursorTex)
 {
     fnt = pFont;
+    labelFnt = pSmallFont;
     scrollTex.tex = NULL;
     t = 0;
     posPer = 0;
@@ -1144,8 +1152,6 @@ TestConnectionScene::TestConnectionScene(Client *p, LoginScene* s, Texture* curs
 
     myUsername [0] = NULL; // not known until login
 
-    chat_text = "";
-
     int w, h;
     SDL_GL_GetDrawableSize (pClient->GetMainWindow (), &w, &h);
 
@@ -1188,17 +1194,126 @@ bool TestConnectionScene::Init (void)
 
     return true;
 }
-TestConnectionScene::~TestConnectionScene()
+size_t UsernameSlotHash (const char *username) // FNV-1a
 {
-    delete pChatInput;
-    delete pChatScroll;
+    Uint32 h = 2166136261u;
+    for (int i = 0; i < USERNAME_MAXLENGTH - 1 && username [i]; i++)
+    {
+        h ^= (unsigned char)username [i];
+        h *= 16777619u;
+    }
+    return h;
+}
+PlayerRegistry::PlayerRegistry (const size_t capacity)
+{
+    players.reserve (capacity);
+
+    size_t nSlots = 1;
+    while (nSlots < 2 * capacity)
+        nSlots *= 2;
+
+    slots.assign (nSlots, -1);
+}
+size_t PlayerRegistry::SlotOf (const char *username) const
+{
+    size_t mask = slots.size () - 1,
+           i = UsernameSlotHash (username) & mask;
+
+    // Linear probing, there's always an empty slot.
+    while (slots [i] >= 0 && strncmp (players [slots [i]].username, username, USERNAME_MAXLENGTH - 1) != 0)
+        i = (i + 1) & mask;
+
+    return i;
+}
+/**
+ * Moves the following slots back, so that probing doesn't need markers for removed players.
+ */
+void PlayerRegistry::EmptySlot (size_t i)
+{
+    size_t mask = slots.size () - 1,
+           j = i;
+
+    slots [i] = -1;
+    while (true)
+    {
+        j = (j + 1) & mask;
+        if (slots [j] < 0)
+            return;
+
+        // The player in j may fill the gap at i, unless its own slot lies cyclically in (i, j].
+        size_t home = UsernameSlotHash (players [slots [j]].username) & mask;
+        bool between = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!between)
+        {
+            slots [i] = slots [j];
+            slots [j] = -1;
+            i = j;
+        }
+    }
+}
+void PlayerRegistry::Rehash (const size_t nSlots)
+{
+    slots.assign (nSlots, -1);
+
+    for (size_t i = 0; i < players.size (); i++)
+        slots [SlotOf (players [i].username)] = i;
+}
+RegisteredPlayer *PlayerRegistry::Find (const char *username)
+{
+    size_t s = SlotOf (username);
+    if (slots [s] < 0)
+        return NULL;
 
-    for (std::list<RegisteredPlayer*>::iterator it = others.begin(); it != others.end(); it++)
+    return &players [slots [s]];
+}
+RegisteredPlayer *PlayerRegistry::Add (const char *username)
+{
+    size_t s = SlotOf (username);
+    if (slots [s] >= 0)
+        return &players [slots [s]];
+
+    if (2 * (players.size () + 1) > slots.size ())
     {
-        RegisteredPlayer *other = *it;
+        Rehash (2 * slots.size ());
+        s = SlotOf (username);
+    }
+
+    slots [s] = players.size ();
+    players.emplace_back ();
+
+    RegisteredPlayer *pPlayer = &players.back ();
+    strncpy (pPlayer->username, username, USERNAME_MAXLENGTH);
+    pPlayer->username [USERNAME_MAXLENGTH - 1] = NULL;
+
+    return pPlayer;
+}
+void PlayerRegistry::RemoveAt (const size_t i)
+{
+    EmptySlot (SlotOf (players [i].username));
 
-        delete other;
+    if (i + 1 < players.size ())
+    {
+        players [i] = players.back ();
+        slots [SlotOf (players [i].username)] = i;
     }
+
+    players.pop_back ();
+}
+void PlayerRegistry::Remove (const char *username)
+{
+    size_t s = SlotOf (username);
+    if (slots [s] >= 0)
+        RemoveAt (slots [s]);
+}
+void PlayerRegistry::Clear (void)
+{
+    players.clear ();
+    std::fill (slots.begin (), slots.end (), -1);
+}
+TestConnectionScene::~TestConnectionScene()
+{
+    delete pChatInput;
+    delete pChatScroll;
 }
 void TestConnectionScene::OnLogin(const char* username, UserParams* params, UserState* state)
 {
@@ -1211,18 +1326,12 @@ void TestConnectionScene::OnLogin(const char* username, UserParams* params, User
     me = *state;
 
     // see if I'm in this list already
-    for (std::list <RegisteredPlayer*>::iterator it = others.begin(); it != others.end(); it++)
+    RegisteredPlayer *other = others.Find (username);
+    if (other)
     {
-        RegisteredPlayer *other = *it;
-
-        if (strcmp (other->username,username)==0)
-        {
-            // If so, then take my parameters from it
-            myParams = other->params;
-            delete other;
-            it = others.erase (it);
-            break;
-        }
+        // If so, then take my parameters from it
+        myParams = other->params;
+        others.Remove (username);
     }
 
     int mX,mY; SDL_GetMouseState(&mX,&mY); me.pos = vec2(mX,mY);
@@ -1243,15 +1352,14 @@ void TestConnectionScene::Update(const float dt)
         posPer=0;
     }
 
+    // Backwards, because removal moves the last player:
     Uint32 currentTicks=GetCurrentTicks();
-    for (std::list<RegisteredPlayer*>::iterator it = others.begin(); it != others.end(); it++)
+    for (size_t i = others.Size (); i > 0; i--)
     {
-        RegisteredPlayer *other = *it;
-
-        if( currentTicks > (other->next.ticks + CONNECTION_TIMEOUT*1000) )
+        if( currentTicks > (others [i - 1].snapshots.GetLastArrival () + CONNECTION_TIMEOUT*1000) )
         {
             // forget players of which no more info is recieved
-            OnForgetUser (other);
+            others.RemoveAt (i - 1);
         }
     }
 
@@ -1304,51 +1412,49 @@ void TestConnectionScene::Render()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    /*
+        All cursors and name labels go in one batch,
+        so that the number of draw calls doesn't grow with the number of users.
+     */
+    const float angle = 0.7 * sin(8 * t);
+    GLfloat color [4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
     int mX,mY;
     SDL_GetMouseState (&mX, &mY);
 
     if (mX > 0 && mX < screenWidth && mY > 0 && mY < screenHeight)
     {
-        glPushMatrix();
-        matrix4 m =  matTranslation (vec3 (mX, mY, 0)) * matRotZ (0.7 * sin(8 * t));
-        glLoadMatrixf(m);
-
-        glColorHSV (myParams.hue, 1.0f, 1.0f);
-        RenderSprite(tex,
-                  0, 0,
-                  96, 32, 128, 64,
-                  16, 16);
-
-        glPopMatrix();
+        HSV2RGB (myParams.hue, 1.0f, 1.0f, color [0], color [1], color [2]);
+        cursorBatch.AddSprite (tex, vec2 (mX, mY), angle,
+                               96, 32, 128, 64,
+                               16, 16, color);
     }
 
     // Render the other users too:
-    for (std::list<RegisteredPlayer*>::iterator it = others.begin(); it != others.end(); it++)
+    for (RegisteredPlayer &player : others)
     {
-        RegisteredPlayer *other = *it;
+        RegisteredPlayer *other = &player;
 
         if (strcmp (other->username, myUsername) == 0)
             continue; // this is me
 
         UserState now;
-        Predict(&now,&other->prev,&other->next);
+        other->snapshots.Sample (GetCurrentTicks (), now);
 
         if (now.pos.x > 0 && now.pos.x < screenWidth && now.pos.y > 0 && now.pos.y < screenHeight)
         {
-            glPushMatrix();
-            matrix4 m = matTranslation (vec3 (now.pos.x, now.pos.y, 0)) * matRotZ (0.7 * sin(8 * t));
-            glLoadMatrixf(m);
+            HSV2RGB (other->params.hue, 1.0f, 1.0f, color [0], color [1], color [2]);
+            cursorBatch.AddSprite (tex, now.pos, angle,
+                                   96, 32, 128, 64,
+                                   16, 16, color);
 
-            glColorHSV (other->params.hue, 1.0f, 1.0f);
-            RenderSprite(tex,
-                      0, 0,
-                      96, 32, 128, 64,
-                      16, 16);
-
-            glPopMatrix();
+            cursorBatch.AddText (labelFnt, other->username, now.pos + vec2 (0, 24), TEXTALIGN_MID, color);
         }
     }
 
+    glFrontFace (GL_CW); // like glRenderText
+    cursorBatch.Render ();
+
     glPopAttrib();
 
     // Render the ping text to the screen:
@@ -1368,8 +1474,17 @@ void TestConnectionScene::Render()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glColor3f(1,1,1);
+    // Show the worst interpolation delay, to see how the connections are doing:
+    float delay = 0.0f;
+    Uint32 nUnderruns = 0;
+    for (const RegisteredPlayer &other : others)
+    {
+        delay = std::max (delay, other.snapshots.GetRenderDelay ());
+        nUnderruns += other.snapshots.GetUnderruns ();
+    }
+
     static char pingText[64];
-    sprintf(pingText,"ping: %u",GetPing());
+    sprintf(pingText,"ping: %u delay: %.0f underruns: %u",GetPing(), delay, nUnderruns);
 
     glTranslatef (10, 10, 0);
     glRenderText (fnt, pingText, TEXTALIGN_LEFT);
@@ -1427,12 +1542,25 @@ void TestConnectionScene::OnKeyPress (const SDL_KeyboardEvent *event)
     default: return;
     }
 }
+#define JOINROOM_COMMAND "/join "
 void TestConnectionScene::SendChatMessage (const char *text)
 {
     int l = strlen (text),
         len = l + 2;
 
-    if (l > 0) // check for empty strings
+    if (strncmp (text, JOINROOM_COMMAND, strlen (JOINROOM_COMMAND)) == 0)
+    {
+        // Not a chat message, but a request to move to another room.
+        text += strlen (JOINROOM_COMMAND);
+        l = std::min ((int)strlen (text), ROOMNAME_MAXLENGTH - 1);
+
+        Uint8 data [1 + ROOMNAME_MAXLENGTH];
+        data [0] = NETSIG_JOINROOM;
+        memcpy (data + 1, text, l);
+        data [1 + l] = NULL;
+        pClient->SendToServer (data, l + 2);
+    }
+    else if (l > 0) // check for empty strings
     {
         Uint8 *data = new Uint8 [len];
         data [0] = NETSIG_CHATMESSAGE;
@@ -1463,10 +1591,31 @@ void TestConnectionScene::OnServerMessage (const Uint8 *data, int len)
 
         OnAddedUser(username,params,state);
     }
+    else if (signature == NETSIG_ROSTER && len >= 1 &&
+             len == (1 + data [0] * ROSTER_ENTRY_SIZE))
+    {
+        int i, n = data [0];
+        data++;
+
+        for (i = 0; i < n; i++)
+        {
+            const char* username = (const char*)data;
+            UserParams* params = (UserParams*) (data + USERNAME_MAXLENGTH);
+            UserState* state = (UserState*) (data + USER_DESCRIPTOR_SIZE);
+
+            OnAddedUser (username, params, state);
+
+            data += ROSTER_ENTRY_SIZE;
+        }
+    }
     else if(signature == NETSIG_DELPLAYER)
     {
         OnForgetUser((const char*)data);
     }
+    else if (signature == NETSIG_JOINROOM && len == ROOMNAME_MAXLENGTH)
+    {
+        OnJoinedRoom ((const char *)data);
+    }
     else if (signature == NETSIG_CHATMESSAGE && len == sizeof (ChatEntry))
     {
         OnChatMessage ((ChatEntry *)data);
@@ -1478,13 +1627,9 @@ void TestConnectionScene::OnChatMessage (const ChatEntry *entry)
 
     sprintf (s, "[%s]: %s", entry->username, entry->message);
 
-    if (chat_text.size () > 0)
-        chat_text += '\n';
-    chat_text += s;
-
     bool max_down = pChatScroll->GetBarY () >= pChatScroll->GetMaxBarY ();
 
-    pChatScroll->SetText (chat_text.c_str());
+    pChatScroll->AppendText (s);
     pChatScroll->ResetAlpha ();
     if (max_down)
     {
@@ -1498,7 +1643,7 @@ void TestConnectionScene::OnAddedUser (const char* username, UserParams* params,
     if (serverStartTicks <= 0) // first contact, set the clock
     {
         serverStartTicks = state->ticks;
-        clientStartTicks = SDL_GetTicks();
+        clientStartTicks = pClient->GetMessageTicks ();
     }
     state->ticks -= serverStartTicks; // make it relative to the first contact
 
@@ -1508,58 +1653,31 @@ void TestConnectionScene::OnAddedUser (const char* username, UserParams* params,
         return;
     }
 
-    // First find out whether the user is already there...
-    RegisteredPlayer *n = NULL;
-    for (std::list<RegisteredPlayer*>::iterator it = others.begin(); it != others.end(); it++)
-    {
-        RegisteredPlayer *other = *it;
-
-        if (strcmp (other->username, username) == 0) // this is the one
-        {
-            n = other;
-        }
-    }
-    if (n) // already registered
-    {
-        UpdateUserState (n, state);
-    }
-    else // not yet known
-    {
-        n = new RegisteredPlayer;
-        others.push_back (n);
-
-        strcpy (n->username, username);
-        memcpy (&n->params,  params, sizeof(UserParams));
+    // Might be registered already, then it's just updated.
+    RegisteredPlayer *n = others.Add (username);
+    memcpy (&n->params,  params, sizeof(UserParams));
 
-        // Set both prev and next to this initial state
-        memcpy (&n->prev,    state,  sizeof(UserState));
-        memcpy (&n->next,    state,  sizeof(UserState));
-    }
+    UpdateUserState (n, state);
 }
 void TestConnectionScene::OnForgetUser (const char* username)
 {
-    for (std::list<RegisteredPlayer*>::iterator it = others.begin(); it != others.end(); it++)
-    {
-        RegisteredPlayer *other = *it;
-
-        if(strcmp (other->username, username)==0) // this is the one
-        {
-            OnForgetUser (other);
-            return;
-        }
-    }
+    others.Remove (username);
 }
-void TestConnectionScene::OnForgetUser (RegisteredPlayer* player)
+void TestConnectionScene::OnJoinedRoom (const char *roomName)
 {
-    others.remove (player);
-    delete player;
+    // The server will send the new room's roster, forget the old one:
+    others.Clear ();
+
+    char title [USERNAME_MAXLENGTH + ROOMNAME_MAXLENGTH + 4];
+    snprintf (title, sizeof (title), "%s (%s)", myUsername, roomName);
+    SDL_SetWindowTitle (pClient->GetMainWindow (), title);
 }
 void TestConnectionScene::OnUserState (const char* username, UserState* state)
 {
     if (serverStartTicks <= 0) // first contact, set the clock
     {
         serverStartTicks = state->ticks;
-        clientStartTicks = SDL_GetTicks();
+        clientStartTicks = pClient->GetMessageTicks ();
     }
     state->ticks -= serverStartTicks; // make it relative to the first contact
 
@@ -1568,15 +1686,11 @@ void TestConnectionScene::OnUserState (const char* username, UserState* state)
         return;
     }
 
-    for (std::list<RegisteredPlayer*>::iterator it = others.begin(); it != others.end(); it++)
+    RegisteredPlayer *other = others.Find (username);
+    if (other)
     {
-        RegisteredPlayer *other = *it;
-
-        if(strcmp(other->username,username)==0) // this is the one
-        {
-            UpdateUserState(other,state);
-            return;
-        }
+        UpdateUserState(other,state);
+        return;
     }
 
     // otherwise it isn't here yet, ask the server about it:
@@ -1593,34 +1707,10 @@ Uint32 TestConnectionScene::GetCurrentTicks() const
 }
 void TestConnectionScene::UpdateUserState(RegisteredPlayer* player, UserState* n)
 {
-    Uint32 current = GetCurrentTicks();
-
-    // Put current state at prev
-    UserState cur; Predict(&cur,&player->prev,&player->next);
-    cur.ticks = current;
-    memcpy (&player->prev, &cur, sizeof(UserState));
+    // Use the time that the packet came in, not the time that it's handled.
+    Uint32 arrival = pClient->GetMessageTicks () - clientStartTicks;
 
-    // put new state at next
-    n->ticks = current + 100;
-    memcpy (&player->next, n, sizeof(UserState));
-}
-void TestConnectionScene::Predict (UserState* out, const UserState* prev, const UserState* next) const
-{
-    Uint32 current = GetCurrentTicks();
-
-    if (current < next->ticks && next->ticks > prev->ticks)
-    {
-        // interpolate
-        Uint32 ticksRange = next->ticks - prev->ticks;
-        float d = float (current - prev->ticks) / ticksRange,
-              invd = 1.0f - d;
-
-        out->pos = invd * prev->pos + d * next->pos;
-    }
-    else
-    {
-        out->pos = next->pos;
-    }
+    player->snapshots.Add (*n, arrival);
 }
 void TestConnectionScene::OnConnectionLoss ()
 {
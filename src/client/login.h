@@ -27,12 +27,17 @@
 #include "gui.h"
 #include "textscroll.h"
 #include "connection.h"
+#include "snapshot.h"
+#include "batch.h"
 #include "../texture.h"
 #include "../server/server.h"
 #include "../account.h"
 
 #include <SDL2/SDL_mixer.h>
 
+#include <vector>
+#include <string>
+
 /*
  * This Scene allows a user to log in, using a username and password combination, created using the manager application.
  * The server application must be running for a successful login.
@@ -143,8 +148,8 @@ private:
         void Render ();
         void RenderCursor (int mX, int mY);
 
-        void SetX (GLfloat _x) { x = _x; }
-        void SetY (GLfloat _y) { y = _y; }
+        void SetX (GLfloat _x) { if (x != _x) { x = _x; SetDirty (); } }
+        void SetY (GLfloat _y) { if (y != _y) { y = _y; SetDirty (); } }
 
     friend class LoginScene;
 
@@ -154,7 +159,8 @@ private:
     // Resources
     Mix_Chunk *pSound;
     Texture cursorTex, bgTex, buttonTex;
-    Font font, small_font;
+    Font fieldFont, // the atlas, that font and small_font are scaled from
+         font, small_font;
 
 
     // scene to log into
@@ -200,7 +206,46 @@ struct RegisteredPlayer
 {
     char username [USERNAME_MAXLENGTH];
     UserParams params;
-    UserState prev, next;
+    SnapshotBuffer snapshots;
+};
+
+#define PLAYERREGISTRY_CAPACITY 256 // players, before the registry needs to allocate more memory
+
+/*
+ * Keeps the registered players in one contiguous array, indexed by username hash.
+ * Adding or removing players invalidates pointers to them.
+ * Memory is only allocated when the capacity is exceeded.
+ */
+class PlayerRegistry
+{
+private:
+    std::vector <RegisteredPlayer> players;
+
+    /*
+        Open addressing table of indices in players, -1 for empty slots.
+        Its size is a power of two, at least twice the number of players.
+     */
+    std::vector <int> slots;
+
+    // :returns: the slot that holds the username, or the empty slot where it would go
+    size_t SlotOf (const char *username) const;
+    void EmptySlot (size_t);
+    void Rehash (const size_t nSlots);
+public:
+    PlayerRegistry (const size_t capacity = PLAYERREGISTRY_CAPACITY);
+
+    RegisteredPlayer *Find (const char *username); // NULL if not there
+    RegisteredPlayer *Add (const char *username); // returns the existing player, if there
+
+    void Remove (const char *username);
+    void RemoveAt (const size_t i); // moves the last player to i
+    void Clear (void);
+
+    size_t Size (void) const { return players.size (); }
+    RegisteredPlayer &operator[] (const size_t i) { return players [i]; }
+
+    std::vector <RegisteredPlayer>::iterator begin () { return players.begin (); }
+    std::vector <RegisteredPlayer>::iterator end () { return players.end (); }
 };
 
 /*
@@ -255,36 +300,33 @@ private:
 
     Mix_Chunk *pSound;
     Texture *tex, scrollTex;
-    const Font* fnt;
+    const Font *fnt,
+               *labelFnt; // for usernames
     float t, posPer;
 
+    SpriteBatch cursorBatch; // cursors and their labels
+
     Uint32  serverStartTicks, // server time of first contact
             clientStartTicks; // client time of first contact
 
     LoginScene *loginScene;
 
-    std::string chat_text;
-
     char myUsername [USERNAME_MAXLENGTH];
     UserState me;
     UserParams myParams;
-    std::list <RegisteredPlayer*> others;
+    PlayerRegistry others;
 
     void OnKeyPress (const SDL_KeyboardEvent *event);
 
     void SendState();
     void SendChatMessage (const char *);
 
-    // This function predicts a user state by interpolation. Nessesary when ping is high
-    void Predict (UserState* out, const UserState* prev, const UserState* next) const;
-
-
     void UpdateUserState (RegisteredPlayer* player, UserState* _new);
 
     void OnChatMessage (const ChatEntry *);
     void OnAddedUser (const char* username, UserParams* params, UserState* state);
     void OnForgetUser (const char* username);
-    void OnForgetUser (RegisteredPlayer* player);
+    void OnJoinedRoom (const char* roomName);
     void OnUserState (const char* username, UserState* _new);
     Uint32 GetCurrentTicks() const;
 
@@ -0,0 +1,79 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <stddef.h>
+
+/*
+    A fixed size queue between exactly one producer thread and one consumer thread.
+    It needs no locks: the producer only moves the tail and the consumer only moves the head.
+ */
+template <typename T, size_t N> // N must be a power of two
+class SPSCRing
+{
+private:
+    T entries [N];
+
+    // Count up forever, the index is the count modulo N.
+    std::atomic <size_t> head, tail;
+
+public:
+    SPSCRing () : head (0), tail (0) {}
+
+    /*
+     * Producer side: returns a free entry to fill in, or NULL if the ring is full.
+     * The entry becomes visible to the consumer after Push.
+     */
+    T *Back (void)
+    {
+        size_t t = tail.load (std::memory_order_relaxed);
+        if (t - head.load (std::memory_order_acquire) >= N)
+            return NULL;
+
+        return &entries [t % N];
+    }
+    void Push (void)
+    {
+        tail.store (tail.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /*
+     * Consumer side: returns the oldest entry, or NULL if the ring is empty.
+     * The entry stays valid until Pop.
+     */
+    T *Front (void)
+    {
+        size_t h = head.load (std::memory_order_relaxed);
+        if (h == tail.load (std::memory_order_acquire))
+            return NULL;
+
+        return &entries [h % N];
+    }
+    void Pop (void)
+    {
+        head.store (head.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+#endif // RING_H
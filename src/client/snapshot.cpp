@@ -0,0 +1,144 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#include <algorithm>
+#include <math.h>
+
+#include "snapshot.h"
+
+#define DELAY_MIN 50.0f // ticks
+#define DELAY_MAX 500.0f
+#define DELAY_JITTERS 3.0f // how many times the jitter is added to the delay
+#define DELAY_SMOOTH 0.05f // per state, how fast the delay adapts
+
+#define JITTER_SMOOTH (1.0f / 16) // like in RFC 3550
+#define INTERVAL_SMOOTH 0.1f
+#define INTERVAL_DEFAULT 100.0f // ticks, the client's update period
+
+#define EXTRAPOLATE_MAX 250 // ticks, past the newest state
+
+SnapshotBuffer::SnapshotBuffer (void)
+ : nSnapshots (0), newest (-1),
+   jitter (0.0f), interval (INTERVAL_DEFAULT),
+   delay (INTERVAL_DEFAULT + DELAY_MIN),
+   clockOffset (0),
+   underrun (false), nUnderruns (0), nSamples (0)
+{
+}
+const SnapshotBuffer::Snapshot &SnapshotBuffer::Get (const int age) const
+{
+    return snapshots [(newest - age + SNAPSHOT_COUNT) % SNAPSHOT_COUNT];
+}
+Uint32 SnapshotBuffer::GetLastArrival (void) const
+{
+    if (nSnapshots <= 0)
+        return 0;
+
+    return Get (0).arrivalTicks;
+}
+void SnapshotBuffer::Add (const UserState &state, const Uint32 arrivalTicks)
+{
+    Sint32 offset = arrivalTicks - state.ticks;
+
+    if (nSnapshots > 0)
+    {
+        const Snapshot &last = Get (0);
+
+        Sint32 serverDiff = state.ticks - last.state.ticks,
+               arrivalDiff = arrivalTicks - last.arrivalTicks;
+
+        if (serverDiff <= 0) // out of order or duplicate, too late to use
+            return;
+
+        jitter += (fabs (float (arrivalDiff - serverDiff)) - jitter) * JITTER_SMOOTH;
+        interval += (std::min (float (serverDiff), DELAY_MAX) - interval) * INTERVAL_SMOOTH;
+
+        // The lowest offset, among the buffered states, had the least delay on its way:
+        clockOffset = offset;
+        for (int i = 0; i < nSnapshots; i++)
+        {
+            const Snapshot &s = Get (i);
+            clockOffset = std::min (clockOffset, Sint32 (s.arrivalTicks - s.state.ticks));
+        }
+    }
+    else
+        clockOffset = offset;
+
+    newest = (newest + 1) % SNAPSHOT_COUNT;
+    snapshots [newest].state = state;
+    snapshots [newest].arrivalTicks = arrivalTicks;
+    nSnapshots = std::min (nSnapshots + 1, SNAPSHOT_COUNT);
+
+    // Wait long enough for the next state to arrive, even when it's late:
+    float target = std::max (DELAY_MIN, std::min (DELAY_MAX, interval + DELAY_JITTERS * jitter));
+    delay += (target - delay) * DELAY_SMOOTH;
+}
+void SnapshotBuffer::Sample (const Uint32 clientTicks, UserState &out)
+{
+    if (nSnapshots <= 0)
+        return;
+
+    // The server time that must be shown now:
+    Sint32 t = Sint32 (clientTicks - clockOffset) - Sint32 (delay);
+
+    nSamples ++;
+
+    const Snapshot &last = Get (0);
+    Sint32 ahead = t - Sint32 (last.state.ticks);
+    if (ahead > 0)
+    {
+        // Ran out of states, extrapolate for a while.
+        if (!underrun)
+            nUnderruns ++;
+        underrun = true;
+
+        out = last.state;
+        if (nSnapshots > 1)
+        {
+            const Snapshot &prev = Get (1);
+            float dt = float (last.state.ticks - prev.state.ticks);
+
+            out.pos += (last.state.pos - prev.state.pos) * (std::min (ahead, (Sint32)EXTRAPOLATE_MAX) / dt);
+        }
+        return;
+    }
+
+    underrun = false;
+
+    // Find the two states around t:
+    for (int i = 1; i < nSnapshots; i++)
+    {
+        const Snapshot &prev = Get (i),
+                       &next = Get (i - 1);
+
+        if (Sint32 (t - prev.state.ticks) >= 0)
+        {
+            float f = float (t - prev.state.ticks) / (next.state.ticks - prev.state.ticks);
+
+            out = next.state;
+            out.pos = (1.0f - f) * prev.state.pos + f * next.state.pos;
+            return;
+        }
+    }
+
+    // Older than all the states we have:
+    out = Get (nSnapshots - 1).state;
+}
@@ -0,0 +1,74 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "../server/server.h"
+
+#define SNAPSHOT_COUNT 16 // per player, must be a power of two
+
+/*
+    Keeps the last few states of one remote player, as timestamped by the server,
+    and plays them back with a delay that covers the measured arrival jitter.
+
+    All ticks are relative to the scene's first contact with the server.
+ */
+class SnapshotBuffer
+{
+private:
+    struct Snapshot
+    {
+        UserState state; // ticks in server time
+        Uint32 arrivalTicks; // in client time
+    } snapshots [SNAPSHOT_COUNT];
+    int nSnapshots,
+        newest; // index
+
+    float jitter, // ticks, smoothed deviation in arrival intervals
+          interval, // ticks, smoothed time between server states
+          delay; // ticks, between the newest possible and the rendered state
+
+    Sint32 clockOffset; // client ticks - server ticks, lowest seen
+
+    bool underrun;
+    Uint32 nUnderruns, nSamples;
+
+    const Snapshot &Get (const int age) const; // 0 is newest
+public:
+    SnapshotBuffer (void);
+
+    void Add (const UserState &state, const Uint32 arrivalTicks);
+
+    // Puts the interpolated state at 'clientTicks' in 'out'
+    void Sample (const Uint32 clientTicks, UserState &out);
+
+    bool Empty (void) const { return nSnapshots <= 0; }
+    Uint32 GetLastArrival (void) const;
+
+    // Statistics:
+    float GetRenderDelay (void) const { return delay; }
+    float GetJitter (void) const { return jitter; }
+    Uint32 GetUnderruns (void) const { return nUnderruns; } // times that it ran out of states
+    Uint32 GetSamples (void) const { return nSamples; }
+};
+
+#endif // SNAPSHOT_H
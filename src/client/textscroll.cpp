@@ -22,6 +22,7 @@
 #include "client.h"
 
 #include <algorithm>
+#include <string.h>
 
 #include "../util.h"
 #include "../str.h"
@@ -45,7 +46,12 @@ TextScroll::TextScroll (const float _frame_left_x, const float _top_y,
     selectionStart (0), selectionEnd (0),
     scrolled_area_height (0),
     bar_height (0),
-    text_selectable (false)
+    text_selectable (false),
+    maxParagraphs (0),
+    layoutWidth (-1.0f),
+    nextParagraphY (0.0f),
+    joinedTextValid (false),
+    joinedLayoutValid (false)
 {
     // Bar top's highest position
     min_bar_y = bar_top_y = spacing_strip_bar + top_y;
@@ -63,7 +69,67 @@ void TextScroll::ClampBar ()
 }
 const char *TextScroll::GetText()
 {
-    return text.c_str();
+    return GetJoinedText ().c_str();
+}
+const std::string &TextScroll::GetJoinedText ()
+{
+    if (!joinedTextValid)
+    {
+        joinedText.clear ();
+        for (const Paragraph &paragraph : paragraphs)
+        {
+            if (joinedText.size () > 0)
+                joinedText += '\n';
+            joinedText += paragraph.text;
+        }
+        joinedTextValid = true;
+        joinedLayoutValid = false;
+    }
+
+    return joinedText;
+}
+const TextLayout &TextScroll::GetJoinedLayout (const float maxWidth)
+{
+    const std::string &text = GetJoinedText ();
+
+    if (!joinedLayoutValid || joinedLayout.maxWidth != maxWidth)
+    {
+        LayoutText (pFont, text.c_str (), joinedLayout, textAlign, maxWidth);
+        joinedLayoutValid = true;
+    }
+
+    return joinedLayout;
+}
+void TextScroll::LayoutParagraph (Paragraph &paragraph)
+{
+    GetTextLines (pFont, paragraph.text.c_str (), layoutWidth, paragraph.lines);
+}
+void TextScroll::AddParagraph (const char *_text, const size_t length)
+{
+    paragraphs.emplace_back ();
+
+    Paragraph &paragraph = paragraphs.back ();
+    paragraph.text.assign (_text, length);
+    paragraph.y = nextParagraphY;
+    LayoutParagraph (paragraph);
+
+    nextParagraphY += paragraph.lines.size () * GetLineSpacing (pFont);
+
+    if (maxParagraphs > 0 && paragraphs.size () > maxParagraphs)
+    {
+        paragraphs.pop_front ();
+
+        // Keep the positions near zero, large floats can't hold whole pixels:
+        const float baseY = paragraphs.front ().y;
+        for (Paragraph &p : paragraphs)
+            p.y -= baseY;
+        nextParagraphY -= baseY;
+
+        // The selection was in the old text:
+        selectionStart = selectionEnd = 0;
+    }
+
+    joinedTextValid = false;
 }
 void TextScroll::SetText (const char *_text)
 {
@@ -75,36 +141,68 @@ void TextScroll::SetText (const char *_text)
         return;
     }
 
-    text = std::string (_text);
+    paragraphs.clear ();
+    nextParagraphY = 0.0f;
+    layoutWidth = frame_width - 2 * spacing_text_frame;
+
+    const char *end;
+    while (*_text)
+    {
+        end = strchr (_text, '\n');
+        if (!end)
+            end = _text + strlen (_text);
+
+        AddParagraph (_text, end - _text);
+
+        _text = *end ? end + 1 : end;
+    }
+
+    joinedTextValid = false;
 
     // Text determines how big the scrolled area will be, and how big the bar will be
     DeriveDimensions ();
 }
-void TextScroll::DeriveDimensions ()
+void TextScroll::AppendText (const char *_text)
 {
-    float x1, x2, y1, y2,
+    if (pFont->glyphs.size () <= 0)
+    {
+        fprintf (stderr, "TextScroll::AppendText: error, font isn\'t ready yet\n");
+        return;
+    }
+
+    AddParagraph (_text, strlen (_text));
 
-          bar_frame_ratio,
+    DeriveDimensions ();
+}
+void TextScroll::DeriveDimensions ()
+{
+    float bar_frame_ratio,
           bar_domain,
 
           text_width = frame_width - 2 * spacing_text_frame,
           text_window_height = height - 2 * spacing_text_frame;
 
-    /*
-       Now that we know the width of the text area,
-       find out how much height the text will need
-     */
-
-    DimensionsOfText (pFont, text.c_str(), x1, y1, x2, y2, textAlign, text_width);
+    // The layouts are only valid for the width that they were made for:
+    if (text_width != layoutWidth)
+    {
+        layoutWidth = text_width;
 
-    // Convert to absolute coords:
-    x1 += frame_left_x;
-    x2 += frame_left_x;
+        const float spacing = GetLineSpacing (pFont);
+        nextParagraphY = 0.0f;
+        for (Paragraph &paragraph : paragraphs)
+        {
+            LayoutParagraph (paragraph);
 
-    y1 += top_y;
-    y2 += top_y;
+            paragraph.y = nextParagraphY;
+            nextParagraphY += paragraph.lines.size () * spacing;
+        }
+    }
 
-    scrolled_area_height = y2 - y1;
+    // The text's height follows from the paragraphs' positions:
+    if (paragraphs.empty ())
+        scrolled_area_height = 0.0f;
+    else
+        scrolled_area_height = nextParagraphY - paragraphs.front ().y;
 
     // bar_domain: the entire area that the bar can maximally occupy
     bar_domain = height - 2 * spacing_strip_bar;
@@ -151,12 +249,12 @@ void TextScroll::OnMouseClick (const SDL_MouseButtonEvent *event)
         // Remember, WhichGlyphAt takes relative coords !!
         GetTextRect (x1, y1, x2, y2);
 
-        cpos = WhichGlyphAt (pFont, text.c_str(), event->x - x1, event->y - (y1 + offY), textAlign, x2 - x1);
+        cpos = WhichGlyphAt (GetJoinedLayout (x2 - x1), event->x - x1, event->y - (y1 + offY));
         if (cpos >= 0)
         {
             if (event->clicks > 1) // double click, select entire word
 
-                WordAt (text.c_str(), cpos, selectionStart, selectionEnd);
+                WordAt (GetJoinedText ().c_str(), cpos, selectionStart, selectionEnd);
             else
                 selectionStart = selectionEnd = cpos;
 
@@ -244,9 +342,8 @@ void TextScroll::OnMouseMove (const SDL_MouseMotionEvent *event)
 
         // Remember, WhichGlyphAt takes relative coords!
 
-        int cpos = WhichGlyphAt (pFont, text.c_str(),
-                                 event->x - x1, event->y - (y1 + offY),
-                                 textAlign, x2 - x1);
+        int cpos = WhichGlyphAt (GetJoinedLayout (x2 - x1),
+                                 event->x - x1, event->y - (y1 + offY));
         if (cpos >= 0)
         {
             /*
@@ -254,7 +351,7 @@ void TextScroll::OnMouseMove (const SDL_MouseMotionEvent *event)
                 whether to include the glyph under the cursor.
              */
 
-            if (cpos < text.size() && event->xrel > 0)
+            if (cpos < GetJoinedText ().size() && event->xrel > 0)
                 selectionEnd = cpos + 1;
             else
                 selectionEnd = cpos;
@@ -296,7 +393,7 @@ void TextScroll::OnMouseWheel (const SDL_MouseWheelEvent *event)
 
         // Remember, WhichGlyphAt takes relative coords!
 
-        int cpos = WhichGlyphAt (pFont, text.c_str(), float (mX) - x1, float (mY) - (y1 + offY), textAlign, x2 - x1);
+        int cpos = WhichGlyphAt (GetJoinedLayout (x2 - x1), float (mX) - x1, float (mY) - (y1 + offY));
         if (cpos >= 0)
         {
             // Move the selection to current cursor position
@@ -339,7 +436,7 @@ void TextScroll::SetScroll (const float _bar_top_y)
 
         // Remember, WhichGlyphAt takes relative coords!
 
-        int cpos = WhichGlyphAt (pFont, text.c_str(), float (mX) - x1, float (mY) - (y1 + offY), textAlign, x2 - x1);
+        int cpos = WhichGlyphAt (GetJoinedLayout (x2 - x1), float (mX) - x1, float (mY) - (y1 + offY));
         if (cpos >= 0)
         {
             // Move the selection to current cursor position
@@ -430,7 +527,7 @@ void TextScroll::GetBarRect(float& x1, float& y1, float& x2, float& y2) const
     y1 = bar_top_y;
     y2 = y1 + GetBarHeight ();
 }
-void TextScroll::CopySelectedText() const
+void TextScroll::CopySelectedText()
 {
     int start = std::min (selectionStart, selectionEnd),
         end = std::max (selectionStart, selectionEnd);
@@ -439,7 +536,7 @@ void TextScroll::CopySelectedText() const
         return;
 
     // Get selected substring:
-    std::string ctxt = text.substr (start, end - start);
+    std::string ctxt = GetJoinedText ().substr (start, end - start);
 
     // let SDL fill up the clipboard for us
     SDL_SetClipboardText (ctxt.c_str());
@@ -505,13 +602,44 @@ void TextScroll::RenderText ()
     float x, y, x2, y2;
     GetTextRect (x, y, x2, y2);
 
-    y += GetTextYOffset(); // offset from scrolling
+    if (paragraphs.empty ())
+        return;
 
-    // glRenderText starts at the origin, so we transform:
+    const float spacing = GetLineSpacing (pFont),
+                baseY = paragraphs.front ().y,
+                offY = GetTextYOffset(); // offset from scrolling
 
-    glTranslatef (x, y, 0);
-    glRenderText (pFont, text.c_str(), textAlign, x2 - x);
-    glTranslatef (-x, -y, 0);
+    // The part of the text that's in the window, in paragraph coordinates.
+    // One line extra on both sides, for glyphs that reach out of their line.
+    const float windowY1 = baseY - offY - spacing,
+                windowY2 = baseY - offY + (y2 - y) + spacing;
+
+    // Find the first paragraph that reaches into the window:
+    std::deque <Paragraph>::const_iterator it =
+        std::upper_bound (paragraphs.begin (), paragraphs.end (), windowY1,
+                          [] (const float wy, const Paragraph &p) { return wy < p.y; });
+    if (it != paragraphs.begin ())
+        it --;
+
+    std::string line;
+    for (; it != paragraphs.end () && it->y < windowY2; it++)
+    {
+        for (size_t i = 0; i < it->lines.size (); i++)
+        {
+            const float lineY = it->y + i * spacing;
+            if (lineY + spacing < windowY1 || lineY > windowY2)
+                continue;
+
+            line.assign (it->text, it->lines [i].start, it->lines [i].end - it->lines [i].start);
+
+            // glRenderText starts at the origin, so we transform:
+            const float ly = y + offY + lineY - baseY;
+
+            glTranslatef (x, ly, 0);
+            glRenderText (pFont, line.c_str(), textAlign);
+            glTranslatef (-x, -ly, 0);
+        }
+    }
 }
 void TextScroll::RenderTextSelection ()
 {
@@ -527,6 +655,6 @@ void TextScroll::RenderTextSelection ()
     // glRenderTextAsRects starts at the origin, so we transform:
 
     glTranslatef (x, y, 0);
-    glRenderTextAsRects (pFont, text.c_str(), start, end, textAlign, x2 - x);
+    glRenderTextAsRects (GetJoinedLayout (x2 - x), start, end);
     glTranslatef (-x, -y, 0);
 }
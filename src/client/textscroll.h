@@ -24,11 +24,14 @@
 #include "gui.h"
 
 #include <string>
+#include <deque>
+#include <vector>
 
 /*
  * A vertically scrollable window of text.
  * Composed of a frame, accompanied by a strip with a shiftable bar in it.
  * Depends on a font and text string to know its dimensions.
+ * Text can be appended, the oldest paragraphs are removed when a maximum is set.
  * Text can be set mouse-selectable. (false by default) Selected text can be copied to clipboard with Ctrl + C.
  * Classes that inherit this must implement their own Render function.
  */
@@ -36,7 +39,34 @@ class TextScroll : public MenuObject
 {
 private:
 
-    std::string text; // text to be shown
+    /*
+        The text to be shown, one entry per line of input text.
+        Each keeps its own line layout, so that appending doesn't
+        require the whole text to be laid out again.
+     */
+    struct Paragraph
+    {
+        std::string text;
+        std::vector <TextLine> lines; // for layoutWidth
+        float y; // top, relative to the first paragraph ever added
+    };
+    std::deque <Paragraph> paragraphs;
+    size_t maxParagraphs; // 0 for no limit
+    float layoutWidth,
+          nextParagraphY;
+
+    // The whole text as one string, only built for selecting and copying.
+    std::string joinedText;
+    bool joinedTextValid;
+    const std::string &GetJoinedText ();
+
+    // Layout of the joined text, shared by the selection functions until the text changes:
+    TextLayout joinedLayout;
+    bool joinedLayoutValid;
+    const TextLayout &GetJoinedLayout (const float maxWidth);
+
+    void AddParagraph (const char *text, const size_t length);
+    void LayoutParagraph (Paragraph &);
 
     /*
         Font and alignment need to be set
@@ -88,7 +118,7 @@ private:
     void DeriveDimensions (); // derives dimensions from newly set text
     void ClampBar (); // keeps bar within frame
 
-    void CopySelectedText () const; // copies to clipboard
+    void CopySelectedText (); // copies to clipboard
 
 protected:
 
@@ -142,6 +172,9 @@ public:
     void SetText (const char *);
     const char *GetText ();
 
+    void AppendText (const char *); // starts a new line
+    void SetMaxParagraphs (const size_t n) { maxParagraphs = n; } // 0 for no limit
+
     TextScroll (const float frame_left_x, const float top_y,
                 const float frame_width, const float strip_width, const float height,
                 const float spacing_text_frame, const float spacing_frame_strip, const float spacing_strip_bar,
@@ -26,9 +26,12 @@
 
 #define ERRSTR_LEN 16384
 
-// String to store the error in:
-char error [ERRSTR_LEN] = "",
-      tmp [ERRSTR_LEN];
+// String to store the error in, every thread has its own:
+thread_local char error [ERRSTR_LEN] = "",
+                   tmp [ERRSTR_LEN];
+
+// When set, this thread's errors go here instead:
+thread_local std::string *pCapture = NULL;
 
 const char *GetError ()
 {
@@ -39,6 +42,16 @@ void SetError (const char* format, ...)
     // Insert args:
     va_list args; va_start (args, format);
 
+    if (pCapture)
+    {
+        char buffer [ERRSTR_LEN];
+        if (vsnprintf (buffer, ERRSTR_LEN, format, args) >= 0)
+            pCapture->assign (buffer);
+
+        va_end (args);
+        return;
+    }
+
     // use the temporary buffer, because 'error' might be one of the args
     int res = vsprintf (tmp, format, args);
 
@@ -50,3 +63,9 @@ void SetError (const char* format, ...)
         strcpy (error, tmp);
     }
 }
+std::string *CaptureErrors (std::string *p)
+{
+    std::string *pPrevious = pCapture;
+    pCapture = p;
+    return pPrevious;
+}
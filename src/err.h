@@ -21,13 +21,26 @@
 #ifndef ERR_H
 #define ERR_H
 
+#include <string>
+
 /*
     Set the error string when something goes wrong, and make the
     parser/converter/loader return false. The application can then
     read out this error string and show in in a window/console.
+
+    Every thread has its own error string, GetError only returns
+    errors that were set on the calling thread.
  */
 
 const char *GetError ();
 void SetError (const char* format, ...);
 
+/*
+    Worker threads can capture their errors, so that the thread
+    that waits for them can pass one on with SetError.
+    Pass NULL to stop capturing.
+    :returns: the previous capture string of this thread, usually NULL
+ */
+std::string *CaptureErrors (std::string *);
+
 #endif // ERR_H
@@ -21,6 +21,8 @@
 #include "font.h"
 #include "util.h"
 #include "err.h"
+#include "textmesh.h"
+#include "thread.h"
 
 #include <cstring>
 #include <string>
@@ -30,6 +32,8 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <functional>
+#include <chrono>
+#include <atomic>
 
 /**
  * Parses a XML character reference from a string.
@@ -113,12 +117,24 @@ void Quadratic2Bezier (float *px1, float *py1, float *px2, float *py2, const flo
 }
 
 /**
- * Turns a cairo surface into a GL texture of equal dimensions.
+ * A glyph's pixels, waiting to be packed onto an atlas.
+ */
+struct GlyphImage
+{
+    unicode_char ch;
+    int w, h;
+    std::vector <unsigned char> pixels; // BGRA
+
+    // Position on the atlas:
+    size_t atlas;
+    int x, y;
+};
+
+/**
+ * Copies the pixels of a cairo surface into a glyph image.
  * Only works for colored surfaces with alpha channel.
- * Should only be used for generating glyph textures, was not
- * tested for other things.
  */
-bool Cairo2GLTex (cairo_surface_t *surface, GLuint *pTex)
+bool Cairo2GlyphImage (cairo_surface_t *surface, GlyphImage *pImage)
 {
     cairo_status_t status;
 
@@ -130,7 +146,8 @@ bool Cairo2GLTex (cairo_surface_t *surface, GLuint *pTex)
     }
 
     int w = cairo_image_surface_get_width (surface),
-        h = cairo_image_surface_get_height (surface);
+        h = cairo_image_surface_get_height (surface),
+        stride = cairo_image_surface_get_stride (surface);
 
     unsigned char *pData = cairo_image_surface_get_data (surface);
 
@@ -147,49 +164,310 @@ bool Cairo2GLTex (cairo_surface_t *surface, GLuint *pTex)
         return false;
     }
 
-    glGenTextures(1, pTex);
-    if(!*pTex)
+    pImage->w = w;
+    pImage->h = h;
+    pImage->pixels.resize (w * h * 4);
+
+    /*
+     * Turn transparent black into transparent white.
+     * Looks prettier!
+     */
+    for (int y = 0; y < h; y++)
     {
-        SetError ("Error generating GL texture for glyph");
+        const unsigned char *pRow = pData + y * stride;
+        unsigned char *pOut = pImage->pixels.data () + y * w * 4;
+        for (int x = 0; x < w; x++)
+        {
+            pOut [x * 4 + 0] = 255;
+            pOut [x * 4 + 1] = 255;
+            pOut [x * 4 + 2] = 255;
+            pOut [x * 4 + 3] = pRow [x * 4 + 3];
+        }
+    }
 
-        return false;
+    return true;
+}
+
+/*
+    Distance field glyphs are drawn this many times larger, so that
+    the outlines are known more precisely than one atlas pixel.
+ */
+#define DISTANCEFIELD_OVERSAMPLE 4
+#define DISTANCEFIELD_SPREAD 4 // atlas pixels
+#define DISTANCE_INF 1e20f
+
+/**
+ * One dimensional squared euclidean distance transform, as described by Felzenszwalb and Huttenlocher.
+ *
+ * :param f: input, zero where the feature is, DISTANCE_INF elsewhere
+ * :param d: output, squared distance to the nearest feature
+ * :param v, z: work space, of size n and n + 1
+ */
+void DistanceTransform1D (const float *f, float *d, const int n, int *v, float *z)
+{
+    int k = 0;
+    v [0] = 0;
+    z [0] = -DISTANCE_INF;
+    z [1] = DISTANCE_INF;
+
+    // Lower envelope of the parabolas, rooted at each element:
+    for (int q = 1; q < n; q++)
+    {
+        float s;
+        while (true)
+        {
+            s = ((f [q] + q * q) - (f [v [k]] + v [k] * v [k])) / (2 * q - 2 * v [k]);
+            if (s > z [k] || k == 0)
+                break;
+            k --;
+        }
+
+        k ++;
+        v [k] = q;
+        z [k] = s;
+        z [k + 1] = DISTANCE_INF;
     }
 
-    glBindTexture (GL_TEXTURE_2D, *pTex);
+    k = 0;
+    for (int q = 0; q < n; q++)
+    {
+        while (z [k + 1] < q)
+            k ++;
+
+        d [q] = (q - v [k]) * (q - v [k]) + f [v [k]];
+    }
+}
+/**
+ * Two dimensional squared distance transform, first over the columns, then the rows.
+ * :param grid: w * h values, input like in DistanceTransform1D, replaced by the output
+ */
+void DistanceTransform2D (std::vector <float> &grid, const int w, const int h)
+{
+    const int n = std::max (w, h);
+    std::vector <float> f (n), d (n), z (n + 1);
+    std::vector <int> v (n);
+
+    for (int x = 0; x < w; x++)
+    {
+        for (int y = 0; y < h; y++)
+            f [y] = grid [y * w + x];
 
-    // These settings make it look smooth:
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        DistanceTransform1D (f.data (), d.data (), h, v.data (), z.data ());
 
-    // This automatically clamps texture coordinates to [0.0 -- 1.0]
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+        for (int y = 0; y < h; y++)
+            grid [y * w + x] = d [y];
+    }
+
+    for (int y = 0; y < h; y++)
+    {
+        DistanceTransform1D (grid.data () + y * w, d.data (), w, v.data (), z.data ());
+        std::copy (d.begin (), d.begin () + w, grid.begin () + y * w);
+    }
+}
+/**
+ * Turns an oversampled cairo drawing of a glyph into a distance field image.
+ * The alpha channel gets 0.5 on the outline, more inside and less outside,
+ * down to zero at 'spread' pixels from the outline.
+ */
+bool Cairo2DistanceFieldImage (cairo_surface_t *surface, const int oversample, const int spread, GlyphImage *pImage)
+{
+    GlyphImage drawing;
+    if (!Cairo2GlyphImage (surface, &drawing))
+        return false;
+
+    const int dw = drawing.w, dh = drawing.h,
+              w = dw / oversample, h = dh / oversample;
+
+    // Squared distances to the nearest pixel inside and outside of the glyph:
+    std::vector <float> toInside (dw * dh), toOutside (dw * dh);
+    for (int i = 0; i < dw * dh; i++)
+    {
+        const bool inside = drawing.pixels [i * 4 + 3] >= 128;
+
+        toInside [i] = inside ? 0.0f : DISTANCE_INF;
+        toOutside [i] = inside ? DISTANCE_INF : 0.0f;
+    }
+
+    DistanceTransform2D (toInside, dw, dh);
+    DistanceTransform2D (toOutside, dw, dh);
+
+    pImage->w = w;
+    pImage->h = h;
+    pImage->pixels.resize (w * h * 4);
 
-    /*
-     * Turn transparent black into transparent white.
-     * Looks prettier!
-     */
     for (int y = 0; y < h; y++)
     {
-        unsigned char *pRow = pData + y * w * 4;
         for (int x = 0; x < w; x++)
         {
-            unsigned char *pPixel = pRow + x * 4;
+            // Average the signed distance over the block of drawn pixels, negative is inside:
+            float sum = 0.0f;
+            for (int sy = 0; sy < oversample; sy++)
+            {
+                for (int sx = 0; sx < oversample; sx++)
+                {
+                    const int i = (y * oversample + sy) * dw + x * oversample + sx;
+
+                    // The outline lies halfway between an inside and an outside pixel:
+                    if (toOutside [i] > 0.0f)
+                        sum -= sqrt (toOutside [i]) - 0.5f;
+                    else
+                        sum += sqrt (toInside [i]) - 0.5f;
+                }
+            }
+            const float distance = sum / (oversample * oversample * oversample); // in atlas pixels
+
+            const float value = std::max (0.0f, std::min (1.0f, 0.5f - distance / (2 * spread)));
+
+            unsigned char *pOut = pImage->pixels.data () + (y * w + x) * 4;
+            pOut [0] = pOut [1] = pOut [2] = 255;
+            pOut [3] = (unsigned char) (value * 255 + 0.5f);
+        }
+    }
+
+    return true;
+}
+
+// Empty pixels between glyphs on the atlas, so that linear filtering doesn't bleed:
+#define ATLAS_PADDING 2
+#define ATLAS_MAXSIZE 2048
+
+/**
+ * Places the glyph images on shelves, tallest first.
+ * Every atlas is a square of the given size.
+ *
+ * :param order: indices of the images to pack
+ * :returns: the number of atlases needed
+ */
+size_t ShelfPack (std::vector <GlyphImage> &images, std::vector <size_t> &order, const int size)
+{
+    std::stable_sort (order.begin (), order.end (),
+                      [&images] (const size_t i, const size_t j) { return images [i].h > images [j].h; });
+
+    size_t atlas = 0;
+    int shelfX = 0, shelfY = 0, shelfH = 0;
+
+    for (const size_t i : order)
+    {
+        GlyphImage &image = images [i];
+        const int w = image.w + ATLAS_PADDING,
+                  h = image.h + ATLAS_PADDING;
+
+        if (shelfX + w > size) // start a new shelf
+        {
+            shelfY += shelfH;
+            shelfX = shelfH = 0;
+        }
 
-            pPixel [0] = 255;
-            pPixel [1] = 255;
-            pPixel [2] = 255;
+        if (shelfY + h > size) // start a new atlas
+        {
+            atlas ++;
+            shelfX = shelfY = shelfH = 0;
         }
+
+        image.atlas = atlas;
+        image.x = shelfX;
+        image.y = shelfY;
+
+        shelfX += w;
+        shelfH = std::max (shelfH, h);
+    }
+
+    return order.empty () ? 0 : atlas + 1;
+}
+/**
+ * Packs all glyph images onto as few textures as possible,
+ * then tells every glyph where its image is.
+ */
+bool PackGlyphAtlases (Font *pFont, std::vector <GlyphImage> &images)
+{
+    GLint maxSize;
+    glGetIntegerv (GL_MAX_TEXTURE_SIZE, &maxSize);
+    maxSize = std::min (maxSize, ATLAS_MAXSIZE);
+
+    std::vector <size_t> packed;
+    size_t area = 0;
+    int minSize = 1;
+    for (size_t i = 0; i < images.size (); i++)
+    {
+        const GlyphImage &image = images [i];
+        if (image.w <= 0 || image.h <= 0)
+            continue;
+
+        packed.push_back (i);
+        area += (image.w + ATLAS_PADDING) * (image.h + ATLAS_PADDING);
+        minSize = std::max (minSize, std::max (image.w, image.h) + ATLAS_PADDING);
     }
-    cairo_surface_mark_dirty (surface);
 
-    // fill the texture:
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
-                 (GLsizei)w, (GLsizei)h,
-                 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, // (cairo has ARGB, but GL wants BGRA)
-                 pData);
+    if (packed.empty ())
+        return true;
+
+    if (minSize > maxSize)
+    {
+        SetError ("glyph of %d pixels doesn\'t fit on a texture of %d pixels", minSize, maxSize);
+        return false;
+    }
+
+    // Smallest power of two, that could fit all glyphs, shelves waste some space:
+    int size = 64;
+    while (size < maxSize && (size < minSize || size_t (size) * size < area + area / 4))
+        size *= 2;
+    size = std::min (size, (int)maxSize);
+
+    size_t nAtlases = ShelfPack (images, packed, size);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    std::vector <unsigned char> pixels;
+    for (size_t i = 0; i < nAtlases; i++)
+    {
+        pixels.assign (size * size * 4, 0);
+
+        for (const size_t j : packed)
+        {
+            const GlyphImage *pImage = &images [j];
+            if (pImage->atlas != i)
+                continue;
+
+            for (int y = 0; y < pImage->h; y++)
+                memcpy (pixels.data () + ((pImage->y + y) * size + pImage->x) * 4,
+                        pImage->pixels.data () + y * pImage->w * 4, pImage->w * 4);
+        }
+
+        GLuint tex;
+        glGenTextures (1, &tex);
+        if (!tex)
+        {
+            SetError ("Error generating GL texture for glyph atlas");
+            return false;
+        }
+        pFont->atlases.push_back (tex);
+
+        glBindTexture (GL_TEXTURE_2D, tex);
+
+        // These settings make it look smooth:
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+
+        // fill the texture:
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8,
+                      (GLsizei)size, (GLsizei)size,
+                      0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, // (cairo has ARGB, but GL wants BGRA)
+                      pixels.data ());
+    }
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    for (const size_t j : packed)
+    {
+        const GlyphImage *pImage = &images [j];
+        Glyph &glyph = pFont->glyphs [pImage->ch];
+
+        glyph.tex = pFont->atlases [pFont->atlases.size () - nAtlases + pImage->atlas];
+        glyph.tex_x1 = GLfloat (pImage->x) / size;
+        glyph.tex_y1 = GLfloat (pImage->y) / size;
+        glyph.tex_x2 = GLfloat (pImage->x + pImage->w) / size;
+        glyph.tex_y2 = GLfloat (pImage->y + pImage->h) / size;
+    }
 
     return true;
 }
@@ -285,16 +563,19 @@ void cairo_svg_arc (cairo_t *cr, float current_x, float current_y,
 #define GLYPH_BBOX_MARGE 10.0f
 
 /**
- * Parses the glyph path and creates its texture.
+ * Parses the glyph path and draws its image.
  * (http://www.w3.org/TR/SVG/paths.html)
  *
- * :param pGlyph: glyph object, whose texture must be created.
+ * :param pGlyph: glyph object, whose image must be drawn.
+ * :param pImage: output image, to be packed on an atlas later
  * :param pBox: font's bounding box
  * :param d: path data as in svg
  * :param multiply: multiplies the size of the glyph
+ * :param spread: zero for a plain image, otherwise a distance field image is made with this spread
  * :returns: true on success, falso on error
  */
-bool ParseGlyphPath (const char *d, const BBox *pBox, const float multiply, Glyph *pGlyph)
+bool ParseGlyphPath (const char *d, const BBox *pBox, const float multiply, const int spread,
+                     Glyph *pGlyph, GlyphImage *pImage)
 {
     const char *nd;
     cairo_status_t status;
@@ -309,8 +590,13 @@ bool ParseGlyphPath (const char *d, const BBox *pBox, const float multiply, Glyp
 
     pGlyph->tex = NULL;
 
+    // Distance fields need room around the glyph and a finer drawing:
+    const int oversample = spread > 0 ? DISTANCEFIELD_OVERSAMPLE : 1,
+              surface_w = (tex_w + 2 * spread) * oversample,
+              surface_h = (tex_h + 2 * spread) * oversample;
+
     // bounding box is already multiplied at this point
-    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, tex_w, tex_h);
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, surface_w, surface_h);
     status = cairo_surface_status (surface);
     if (status != CAIRO_STATUS_SUCCESS)
     {
@@ -321,12 +607,14 @@ bool ParseGlyphPath (const char *d, const BBox *pBox, const float multiply, Glyp
     cr = cairo_create (surface);
 
     // Set background color to white transparent:
-    cairo_rectangle (cr, -GLYPH_BBOX_MARGE, -GLYPH_BBOX_MARGE, tex_w + GLYPH_BBOX_MARGE, tex_h + GLYPH_BBOX_MARGE);
+    cairo_rectangle (cr, -GLYPH_BBOX_MARGE, -GLYPH_BBOX_MARGE, surface_w + GLYPH_BBOX_MARGE, surface_h + GLYPH_BBOX_MARGE);
     cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 0.0);
     cairo_fill (cr);
 
+    cairo_scale (cr, oversample, oversample);
+
     // within the cairo surface, move to the glyph's coordinate system
-    cairo_translate(cr, -pBox->left, -pBox->bottom);
+    cairo_translate(cr, spread - pBox->left, spread - pBox->bottom);
 
     // modify glyph to chosen scale, bounding box is presumed to already be scaled
     cairo_scale (cr, multiply, multiply);
@@ -643,9 +931,14 @@ bool ParseGlyphPath (const char *d, const BBox *pBox, const float multiply, Glyp
     cairo_fill (cr);
     cairo_surface_flush (surface);
 
-    // Convert the cairo surface to a GL texture:
+    // Copy the pixels, the texture is made when all glyphs are done:
 
-    bool success = Cairo2GLTex (surface, &pGlyph->tex);
+    pImage->ch = pGlyph->ch;
+    bool success;
+    if (spread > 0)
+        success = Cairo2DistanceFieldImage (surface, oversample, spread, pImage);
+    else
+        success = Cairo2GlyphImage (surface, pImage);
 
     // Don't need this anymore:
     cairo_surface_destroy (surface);
@@ -657,6 +950,85 @@ bool ParseGlyphPath (const char *d, const BBox *pBox, const float multiply, Glyp
     return success;
 }
 
+#define RASTERIZE_MAXTHREADS 16
+
+/*
+    A glyph, whose path must still be drawn.
+ */
+struct GlyphJob
+{
+    Glyph *pGlyph;
+    std::string path;
+};
+
+/**
+ * Draws the glyph paths on as many threads as there are cores.
+ * Every glyph is drawn the same way as on one thread, only the order is different.
+ *
+ * :param images: output, one image per job
+ * :returns: true on success, false if any of the paths failed
+ */
+bool RasterizeGlyphs (const BBox *pBox, const float multiply, const int spread,
+                      const std::vector <GlyphJob> &jobs, std::vector <GlyphImage> &images)
+{
+    images.resize (jobs.size ());
+
+    std::atomic <size_t> next (0);
+    std::atomic <bool> failed (false);
+
+    // One per job, only set on the thread that ran it:
+    std::vector <std::string> errors (jobs.size ());
+
+    PlainThreadFunction work = [&] ()
+    {
+        std::string error;
+        std::string *pPrevious = CaptureErrors (&error);
+
+        size_t i;
+        while (!failed && (i = next ++) < jobs.size ())
+        {
+            if (!ParseGlyphPath (jobs [i].path.c_str (), pBox, multiply, spread, jobs [i].pGlyph, &images [i]))
+            {
+                errors [i] = error;
+                failed = true;
+            }
+        }
+
+        CaptureErrors (pPrevious);
+        return 0;
+    };
+
+    const int nThreads = std::max (1, std::min (std::min (SDL_GetCPUCount (), RASTERIZE_MAXTHREADS), int (jobs.size ())));
+
+    // The calling thread also works, so start one less:
+    std::vector <SDL_Thread *> threads;
+    for (int i = 1; i < nThreads; i++)
+    {
+        SDL_Thread *pThread = MakeSDLThread (work, "glyphs");
+        if (pThread)
+            threads.push_back (pThread);
+    }
+
+    work ();
+
+    for (SDL_Thread *pThread : threads)
+        SDL_WaitThread (pThread, NULL);
+
+    if (failed)
+    {
+        for (const std::string &error : errors)
+        {
+            if (!error.empty ())
+            {
+                SetError ("%s", error.c_str ());
+                break;
+            }
+        }
+    }
+
+    return !failed;
+}
+
 /**
  * The header contains important settings
  * :param pFnt: xml font tag
@@ -756,10 +1128,98 @@ bool ParseSvgFontHeader(const xmlNodePtr pFnt, const int size, Font *pFont, floa
 
 #define DEFAULT_CHAR '?'
 
-bool ParseSVGFont (const xmlDocPtr pDoc, const int size, Font *pFont)
+unsigned int NewFontID (void)
+{
+    static unsigned int lastFontID = 0;
+
+    return ++ lastFontID;
+}
+inline size_t KernHash (const unicode_char prev_c, const unicode_char c)
+{
+    return (prev_c * 0x9E3779B1u) ^ (c * 0x85EBCA77u);
+}
+void CompileGlyphTables (Font *pFont)
+{
+    std::fill (pFont->latinGlyphs, pFont->latinGlyphs + FONT_LATIN_CHARS, (const Glyph *)NULL);
+    pFont->otherGlyphs.clear ();
+
+    // std::map iterates in order, so otherGlyphs ends up sorted:
+    for (const auto &pair : pFont->glyphs)
+    {
+        if (pair.first < FONT_LATIN_CHARS)
+            pFont->latinGlyphs [pair.first] = &pair.second;
+        else
+            pFont->otherGlyphs.push_back (std::make_pair (pair.first, &pair.second));
+    }
+
+    pFont->pDefaultGlyph = FindGlyph (pFont, DEFAULT_CHAR);
+}
+/**
+ * Fills in the flat lookup tables, from the glyph and kern maps.
+ */
+void CompileFontTables (Font *pFont)
+{
+    CompileGlyphTables (pFont);
+
+    size_t nPairs = 0;
+    for (const auto &row : pFont->hKernTable)
+        nPairs += row.second.size ();
+
+    // Keep the table at most half full, so that probe sequences stay short:
+    size_t size = 16;
+    while (size < 2 * nPairs)
+        size *= 2;
+
+    pFont->hKernHash.assign (size, KernEntry {0, 0, 0.0f});
+    for (const auto &row : pFont->hKernTable)
+    {
+        if (row.first == 0)
+            continue; // never looked up
+
+        for (const auto &col : row.second)
+        {
+            size_t i = KernHash (row.first, col.first) & (size - 1);
+            while (pFont->hKernHash [i].prev_c != 0)
+                i = (i + 1) & (size - 1);
+
+            pFont->hKernHash [i] = {row.first, col.first, col.second};
+        }
+    }
+}
+const Glyph *FindGlyph (const Font *pFont, const unicode_char c)
+{
+    if (c < FONT_LATIN_CHARS)
+        return pFont->latinGlyphs [c];
+
+    auto it = std::lower_bound (pFont->otherGlyphs.begin (), pFont->otherGlyphs.end (), c,
+                                [] (const std::pair <unicode_char, const Glyph *> &p, const unicode_char ch) { return p.first < ch; });
+    if (it != pFont->otherGlyphs.end () && it->first == c)
+        return it->second;
+
+    return NULL;
+}
+/**
+ * Like FindGlyph, but missing characters are replaced by DEFAULT_CHAR, which also changes c.
+ */
+const Glyph *GetLayoutGlyph (const Font *pFont, unicode_char &c)
+{
+    const Glyph *pGlyph = FindGlyph (pFont, c);
+    if (!pGlyph)
+    {
+        fprintf (stderr, "error: 0x%X, no such glyph\n", c);
+        c = DEFAULT_CHAR;
+        pGlyph = pFont->pDefaultGlyph;
+    }
+    return pGlyph;
+}
+
+/**
+ * Does the work for ParseSVGFont and ParseSVGDistanceFont.
+ * :param spread: zero for plain glyph images, otherwise the distance field spread
+ */
+bool ParseSVGFontWithSpread (const xmlDocPtr pDoc, const int size, const int spread, Font *pFont)
 {
     // The root tag of the xml document is svg:
-    bool success;
     xmlNodePtr pRoot = xmlDocGetRootElement(pDoc);
     if (!pRoot) {
 
@@ -812,13 +1272,26 @@ bool ParseSVGFont (const xmlDocPtr pDoc, const int size, Font *pFont)
         return false;
     }
 
+    pFont->id = NewFontID ();
+
     // Get data from the font header:
     float multiply;
     if (!ParseSvgFontHeader(pFnt, size, pFont, &multiply))
         return false;
 
+    /*
+        Loading happens in phases: the xml is parsed first, then the glyphs
+        are drawn in parallel and finally the images are packed together.
+     */
+    std::vector <GlyphJob> jobs;
+    std::vector <GlyphImage> images;
+
     pFont->size = size; // size determines multiply, thus do not multiply size.
 
+    pFont->distanceField = spread > 0;
+    pFont->spread = spread;
+    pFont->imageScale = 1.0f; // glyphs are drawn at the font's size
+
     /*
         Confusing!
 
@@ -886,21 +1359,14 @@ bool ParseSVGFont (const xmlDocPtr pDoc, const int size, Font *pFont)
 
             if (pAttrib)
             {
-                success = ParseGlyphPath ((const char *)pAttrib, &pFont->bbox, multiply, &pFont->glyphs[ch]);
+                jobs.push_back ({&pFont->glyphs [ch], std::string ((const char *)pAttrib)});
             }
             else // path may be an empty string, whitespace for example
             {
                 pFont->glyphs [ch].tex = NULL;
-                success = true;
             }
             xmlFree (pAttrib);
 
-            if (!success)
-            {
-                SetError ("failed to parse glyph path");
-                return false;
-            }
-
             /*
                 horiz-adv-x, horiz-origin-x & horiz-origin-y are optional,
                 if not present, use the font's default setting.
@@ -935,6 +1401,12 @@ bool ParseSVGFont (const xmlDocPtr pDoc, const int size, Font *pFont)
         }
     }
 
+    if (!RasterizeGlyphs (&pFont->bbox, multiply, spread, jobs, images))
+    {
+        SetError ("failed to parse glyph path");
+        return false;
+    }
+
     // Now look for horizontal kerning data, iterate over hkern tags:
     for (pChild = pFnt->children; pChild; pChild = pChild->next)
     {
@@ -1077,54 +1549,139 @@ bool ParseSVGFont (const xmlDocPtr pDoc, const int size, Font *pFont)
         pFont->glyphs [DEFAULT_CHAR].tex_h = pFont->bbox.bottom - pFont->bbox.top;
     }
 
+    // All glyphs share a few textures, instead of having one each:
+    if (!PackGlyphAtlases (pFont, images))
+        return false;
+
+    CompileFontTables (pFont);
+
     // At this point, all went well.
     return true;
 }
+bool ParseSVGFont (const xmlDocPtr pDoc, const int size, Font *pFont)
+{
+    return ParseSVGFontWithSpread (pDoc, size, 0, pFont);
+}
+bool ParseSVGDistanceFont (const xmlDocPtr pDoc, const int size, Font *pFont)
+{
+    return ParseSVGFontWithSpread (pDoc, size, DISTANCEFIELD_SPREAD, pFont);
+}
+bool ScaleFont (const Font *pSource, const float size, Font *pFont)
+{
+    if (!pSource->distanceField)
+    {
+        SetError ("only distance field fonts can be scaled");
+        return false;
+    }
+
+    const float scale = size / pSource->size;
+
+    pFont->id = NewFontID ();
+    pFont->size = size;
+    pFont->horiz_origin_x = pSource->horiz_origin_x * scale;
+    pFont->horiz_origin_y = pSource->horiz_origin_y * scale;
+    pFont->horiz_adv_x = pSource->horiz_adv_x * scale;
+
+    pFont->bbox.left = pSource->bbox.left * scale;
+    pFont->bbox.bottom = pSource->bbox.bottom * scale;
+    pFont->bbox.right = pSource->bbox.right * scale;
+    pFont->bbox.top = pSource->bbox.top * scale;
+
+    // The images stay the same, only the quads they're drawn on get a different size:
+    pFont->distanceField = true;
+    pFont->spread = pSource->spread;
+    pFont->imageScale = pSource->imageScale / scale;
+    pFont->atlases = pSource->atlases;
+
+    pFont->glyphs = pSource->glyphs;
+    for (auto &pair : pFont->glyphs)
+    {
+        Glyph &glyph = pair.second;
+
+        // Negative values mean 'use the font's default', keep them negative:
+        glyph.horiz_origin_x *= scale;
+        glyph.horiz_origin_y *= scale;
+        glyph.horiz_adv_x *= scale;
+    }
+
+    pFont->hKernTable = pSource->hKernTable;
+    for (auto &row : pFont->hKernTable)
+        for (auto &col : row.second)
+            col.second *= scale;
+
+    // The source might come from a cache, without kern table. So scale the hash too:
+    pFont->hKernHash = pSource->hKernHash;
+    for (KernEntry &entry : pFont->hKernHash)
+        entry.k *= scale;
+
+    CompileGlyphTables (pFont);
+
+    return true;
+}
 
 /**
- * Renders one glyph at x,y
+ * Places one glyph's quad at x,y
  */
-void glRenderGlyph (const Font *pFont, const Glyph *pGlyph, const GLfloat x, const GLfloat y)
+void GetGlyphQuad (const Font *pFont, const Glyph *pGlyph, const GLfloat x, const GLfloat y, GlyphQuad &quad)
 {
     const BBox *pBox = &pFont->bbox;
     const GLfloat w = pBox->right - pBox->left,
-                  h = pBox->top - pBox->bottom,
-
-    // The glyph bouding box might be a little bit smaller than the texture. Use fw and fh to correct it.
-                  texcoord_fw = GLfloat (pGlyph->tex_w) / w,
-                  texcoord_fh = GLfloat (pGlyph->tex_h) / h;
-
-    // Render the glyph texture to a bbox-sized quad at x,y:
-    glBindTexture(GL_TEXTURE_2D, pGlyph->tex);
-
-    glBegin(GL_QUADS);
-
-    glTexCoord2f (0, texcoord_fh);
-    glVertex2f (x, y);
+                  h = pBox->top - pBox->bottom;
 
-    glTexCoord2f (texcoord_fw, texcoord_fh);
-    glVertex2f (x + w, y);
+    quad.tex = pGlyph->tex;
 
-    glTexCoord2f (texcoord_fw, 0);
-    glVertex2f (x + w, y + h);
+    if (pFont->distanceField)
+    {
+        /*
+            The image has 'spread' pixels around the glyph's box and
+            the font might be drawn at another size than the image's.
+         */
+        const GLfloat margin = pFont->spread / pFont->imageScale,
+                      sx = (pGlyph->tex_x2 - pGlyph->tex_x1) / (pGlyph->tex_w + 2 * pFont->spread),
+                      sy = (pGlyph->tex_y2 - pGlyph->tex_y1) / (pGlyph->tex_h + 2 * pFont->spread);
+
+        quad.x1 = x - margin;
+        quad.y1 = y - margin;
+        quad.x2 = x + w + margin;
+        quad.y2 = y + h + margin;
+
+        quad.tx1 = pGlyph->tex_x1;
+        quad.ty1 = pGlyph->tex_y1 + sy * (h * pFont->imageScale + 2 * pFont->spread);
+        quad.tx2 = pGlyph->tex_x1 + sx * (w * pFont->imageScale + 2 * pFont->spread);
+        quad.ty2 = pGlyph->tex_y1;
+        return;
+    }
 
-    glTexCoord2f (0, 0);
-    glVertex2f (x, y + h);
+    quad.x1 = x;
+    quad.y1 = y;
+    quad.x2 = x + w;
+    quad.y2 = y + h;
 
-    glEnd();
+    /*
+        The glyph bouding box might be a little bit smaller than the image. Correct it in the texture coordinates.
+        The padding around the image on the atlas keeps the overshoot transparent.
+     */
+    const GLfloat tw = pGlyph->tex_x2 - pGlyph->tex_x1,
+                  th = pGlyph->tex_y2 - pGlyph->tex_y1;
+    quad.tx1 = pGlyph->tex_x1;
+    quad.ty1 = pGlyph->tex_y1 + th * pGlyph->tex_h / h;
+    quad.tx2 = pGlyph->tex_x1 + tw * pGlyph->tex_w / w;
+    quad.ty2 = pGlyph->tex_y1;
 }
 /**
  * looks up the kern value for two characters: prev_c and c
  */
 float GetHKern (const Font *pFont, const unicode_char prev_c, const unicode_char c)
 {
-    if (prev_c && pFont->hKernTable.find(prev_c) != pFont->hKernTable.end())
+    if (!prev_c || pFont->hKernHash.empty ())
+        return 0.0f;
+
+    const size_t mask = pFont->hKernHash.size () - 1;
+    for (size_t i = KernHash (prev_c, c) & mask; pFont->hKernHash [i].prev_c != 0; i = (i + 1) & mask)
     {
-        const std::map<unicode_char, float> row = pFont->hKernTable.at(prev_c);
-        if (row.find(c) != row.end())
-        {
-            return row.at(c);
-        }
+        const KernEntry &entry = pFont->hKernHash [i];
+        if (entry.prev_c == prev_c && entry.c == c)
+            return entry.k;
     }
     return 0.0f;
 }
@@ -1139,66 +1696,62 @@ float GetHAdv (const Font *pFont, const Glyph *pGlyph)
     else
         return pFont->horiz_adv_x; // default value
 }
+/*
+    A text, decoded once for layout. The helpers below look ahead in it, by character index.
+    chars [chars.size ()] is zero, like the terminating null.
+ */
+struct DecodedText
+{
+    std::u32string chars;
+    std::vector <size_t> offsets; // of every character and the terminating null
+};
+
 /**
- * Gets the width of the first word in pUTF8.
+ * Gets the width of the first word, starting at character k.
  */
-float NextWordWidth (const Font *pFont, const char *pUTF8, unicode_char prev_c)
+float NextWordWidth (const Font *pFont, const DecodedText &text, size_t k, unicode_char prev_c)
 {
     float w = 0.0f;
     unicode_char c = prev_c;
     const Glyph *pGlyph;
-    const char *nUTF8;
 
     // First include the spaces before the word
-    while (*pUTF8)
+    while (k < text.chars.size ())
     {
         prev_c = c;
-        nUTF8 = next_from_utf8(pUTF8, &c);
+        c = text.chars [k];
 
         if (isspace (c))
         {
-            if (pFont->glyphs.find (c) == pFont->glyphs.end ())
-            {
-                fprintf (stderr, "error: 0x%X, no such glyph\n", c);
-                c = DEFAULT_CHAR;
-            }
-
-            pGlyph = &pFont->glyphs.at (c);
+            pGlyph = GetLayoutGlyph (pFont, c);
 
             w += -GetHKern (pFont, prev_c, c) + GetHAdv (pFont, pGlyph);
 
-            pUTF8 = nUTF8;
+            k ++;
         }
         else
             break;
     }
 
-    while (*pUTF8)
+    // now read till the next space
+    while (k < text.chars.size ())
     {
         prev_c = c;
-        nUTF8 = next_from_utf8(pUTF8, &c);
+        c = text.chars [k];
 
         if (isspace (c))
             break;
         else
         {
-            if (pFont->glyphs.find (c) == pFont->glyphs.end ())
-            {
-                fprintf (stderr, "error: 0x%X, no such glyph\n", c);
-                c = DEFAULT_CHAR;
-            }
-
-            pGlyph = &pFont->glyphs.at (c);
+            pGlyph = GetLayoutGlyph (pFont, c);
 
             w += -GetHKern (pFont, prev_c, c) + GetHAdv (pFont, pGlyph);
 
-            pUTF8 = nUTF8;
+            k ++;
         }
     }
 
     return w;
-
-    // now read till the next space
 }
 float GetLineSpacing (const Font *pFont)
 {
@@ -1206,12 +1759,12 @@ float GetLineSpacing (const Font *pFont)
 }
 
 /**
- * returns: true if the next word exceeds maxWidth when started at current_x, false otherwise.
+ * returns: true if the word at character k exceeds maxWidth when started at current_x, false otherwise.
  */
-bool NeedNewLine (const Font *pFont, const unicode_char prev_c, const char *pUTF8, const float current_x, const float maxWidth)
+bool NeedNewLine (const Font *pFont, const unicode_char prev_c, const DecodedText &text, const size_t k,
+                  const float current_x, const float maxWidth)
 {
-    unicode_char c;
-    next_from_utf8(pUTF8, &c);
+    unicode_char c = text.chars [k];
     const Glyph *pGlyph;
     float adv;
 
@@ -1221,15 +1774,10 @@ bool NeedNewLine (const Font *pFont, const unicode_char prev_c, const char *pUTF
     if (maxWidth > 0)
     {
         // Maybe the next char starts a new word that doesn't fit onto this line:
-        if (isspace(prev_c) && !isspace(c) && current_x > 0 && maxWidth > 0 && maxWidth < (current_x + NextWordWidth (pFont, pUTF8, prev_c)))
+        if (isspace(prev_c) && !isspace(c) && current_x > 0 && maxWidth > 0 && maxWidth < (current_x + NextWordWidth (pFont, text, k, prev_c)))
             return true;
 
-        if (pFont->glyphs.find(c) == pFont->glyphs.end())
-        {
-            fprintf (stderr, "ERROR: no such glyph: 0x%x\n", c);
-            c = DEFAULT_CHAR;
-        }
-        pGlyph = &pFont->glyphs.at (c);
+        pGlyph = GetLayoutGlyph (pFont, c);
 
         adv = GetHAdv (pFont, pGlyph);
 
@@ -1242,20 +1790,19 @@ bool NeedNewLine (const Font *pFont, const unicode_char prev_c, const char *pUTF
     return false;
 }
 /**
- * consumes characters from pUTF8 that shouldn't be taken to the next line
- * :returns: pointer to the next line
+ * consumes characters from character k on, that shouldn't be taken to the next line
+ * :returns: index of the first character of the next line
  * :param n_removed: optional, tells how many characters were removed.
  */
-const char *CleanLineEnd (const char *pUTF8, int *n_removed = NULL)
+size_t CleanLineEnd (const DecodedText &text, size_t k, int *n_removed = NULL)
 {
     unicode_char c;
-    const char *nUTF8;
 
     int n = 0;
 
     while (true)
     {
-        nUTF8 = next_from_utf8(pUTF8, &c);
+        c = text.chars [k];
 
         if (c == '\n' || c == '\r')
         {
@@ -1263,19 +1810,19 @@ const char *CleanLineEnd (const char *pUTF8, int *n_removed = NULL)
                 *n_removed = n + 1;
 
             // this will be the last character we take
-            return nUTF8;
+            return k + 1;
         }
         else if (isspace (c))
         {
             n++;
-            pUTF8 = nUTF8; // go to next
+            k ++; // go to next
         }
         else // Non-whitespace character, must not be taken away!
         {
             if (n_removed)
                 *n_removed = n;
 
-            return pUTF8;
+            return k;
         }
     }
 }
@@ -1292,168 +1839,192 @@ void GetGlyphOrigin (const Font *pFont, const Glyph *pGlyph, float &ori_x, float
     if (pGlyph && pGlyph->horiz_origin_y > 0)
         ori_y = pGlyph->horiz_origin_y;
 }
-/**
- * Computes the width of the next line at pUTF8.
- * (how many glyphs fit in)
- * It can never be longer than maxLineWidth.
- */
-float NextLineWidth (const Font *pFont, const char *pUTF8, const float maxLineWidth)
-{
-    float x = 0.0f, w = 0.0f;
-    unicode_char c = NULL, prev_c = NULL;
-    const Glyph *pGlyph;
-
-    while (*pUTF8)
-    {
-        prev_c = c;
-
-        if (NeedNewLine (pFont, prev_c, pUTF8, x, maxLineWidth))
-        {
-            return w;
-        }
-
-        pUTF8 = next_from_utf8 (pUTF8, &c);
-
-        if (pFont->glyphs.find(c) == pFont->glyphs.end())
-        {
-            fprintf (stderr, "error: 0x%X, no such glyph\n", c);
-            c = DEFAULT_CHAR;
-        }
-        pGlyph = &pFont->glyphs.at (c);
-
-        if (x > 0.0f)
-            x -= GetHKern (pFont, prev_c, c);
-
-        x += GetHAdv (pFont, pGlyph);
-
-        if (!isspace (c))
-            w = x;
-    }
-
-    return w;
-}
 /**
  * ThroughTextGlyphFuncs are callbacks that will be called for each glyph
- * that ThroughText encounters on its pass through the text.
+ * that ThroughLayout encounters on its pass through the text.
  *
  * A ThroughTextGlyphFunc should return true if it wants the next glyph.
  * Glyph pointer is NULL for the terminating null character!
  *
  * x,y are the position where the glyph's origin should be.
  * string_pos is the index of the character, starting from 0
- * the last argument is the object inserted as pObject in ThroughText.
  */
 typedef std::function <bool (const Glyph*, const float x, const float y, const int string_pos)> ThroughTextGlyphFunc;
 
 /*
- * ThroughText passes through the given utf8 string with given text formatting.
+ * ThroughLayout passes through the glyphs of a laid out text.
  * It calls the given ThroughTextGlyphFunc for every glyph it encounters.
- * pObject can be any object that must be passed on to the ThroughTextGlyphFunc
- * in each call.
  */
-void ThroughText (const Font *pFont, const char *pUTF8,
-                  ThroughTextGlyphFunc GlyphFunc,
-                  const int align, float maxWidth)
+void ThroughLayout (const TextLayout &layout, ThroughTextGlyphFunc GlyphFunc)
 {
+    for (const PlacedGlyph &placed : layout.glyphs)
+    {
+        if (!GlyphFunc (placed.pGlyph, placed.x, placed.y, placed.pos))
+            return;
+    }
+}
+/**
+ * Moves the glyphs of a finished line to the left, if alignment is mid or right.
+ */
+void AlignLine (TextLayout &layout, const LayoutLine &line, const int halign)
+{
+    float shift = 0.0f;
+    if (halign == TEXTALIGN_MID)
+
+        shift = line.width / 2;
+
+    else if (halign == TEXTALIGN_RIGHT)
+
+        shift = line.width;
+
+    for (size_t i = line.firstGlyph; i < line.endGlyph; i++)
+        layout.glyphs [i].x -= shift;
+}
+void LayoutText (const Font *pFont, const char *pUTF8, TextLayout &layout,
+                 const int align, float maxWidth)
+{
+    /*
+        Decode once, the line breaking looks ahead a lot.
+        The buffers are kept between calls, so that long texts don't need new memory every time.
+     */
+    static thread_local DecodedText text;
+    decode_utf8 (pUTF8, text.chars, &text.offsets);
+
+    const size_t nChars = text.chars.size ();
+    size_t k = 0;
+
     int i = 0, n, halign = align & 0x0f;
 
     float x = 0.0f, y = 0.0f,
-          lineWidth = NextLineWidth (pFont, pUTF8, maxWidth),
-          glyph_x;
+          lineWidth = 0.0f;
 
     unicode_char c = NULL,
                  prev_c = NULL;
 
     const Glyph *pGlyph;
 
-    while (*pUTF8)
+    layout.pFont = pFont;
+    layout.align = align;
+    layout.maxWidth = maxWidth;
+    layout.glyphs.clear ();
+    layout.lines.clear ();
+    layout.glyphAtPos.clear ();
+
+    LayoutLine line;
+    line.start = 0;
+    line.firstGlyph = 0;
+
+    while (k < nChars)
     {
         prev_c = c;
 
-        // Before moving on to the next glyph, see if we need to start a new line
-        if (NeedNewLine (pFont, prev_c, pUTF8, x, maxWidth))
+        /*
+            Before moving on to the next glyph, see if we need to start a new line.
+            Unless the text says so, a line gets at least one glyph, even when it's too wide.
+         */
+        if (NeedNewLine (pFont, prev_c, text, k, x, maxWidth) &&
+            (layout.glyphs.size () > line.firstGlyph || pUTF8 [text.offsets [k]] == '\n' || pUTF8 [text.offsets [k]] == '\r'))
         {
+            // Alignment can only be done, now that the width of the line is known:
+            line.end = text.offsets [k];
+            line.endGlyph = layout.glyphs.size ();
+            line.width = lineWidth;
+            AlignLine (layout, line, halign);
+            layout.lines.push_back (line);
+
             // start new line
-            pUTF8 = CleanLineEnd (pUTF8, &n);
+            k = CleanLineEnd (text, k, &n);
+            layout.glyphAtPos.insert (layout.glyphAtPos.end (), n, -1);
             i += n;
             prev_c = c = NULL;
 
-            lineWidth = NextLineWidth (pFont, pUTF8, maxWidth);
-            x = 0.0f;
+            x = lineWidth = 0.0f;
             y += GetLineSpacing (pFont);
 
+            line.start = text.offsets [k];
+            line.firstGlyph = layout.glyphs.size ();
+
             continue;
         }
 
-        // Get next utf8 char as c
-        pUTF8 = next_from_utf8 (pUTF8, &c);
+        // Get next char as c
+        c = text.chars [k];
 
-        if (pFont->glyphs.find(c) == pFont->glyphs.end())
-        {
-            fprintf (stderr, "error: 0x%X, no such glyph\n", c);
-            c = DEFAULT_CHAR;
-        }
-        pGlyph = &pFont->glyphs.at (c);
+        pGlyph = GetLayoutGlyph (pFont, c);
 
         // Look up horizontal kern value:
         if (x > 0.0f)
             x -= GetHKern (pFont, prev_c, c);
 
-        // move the glyph to the left if alignment is mid or right
-        glyph_x = x;
-        if (halign == TEXTALIGN_MID)
-
-            glyph_x = x - lineWidth / 2;
-
-        else if (halign == TEXTALIGN_RIGHT)
-
-            glyph_x = x - lineWidth;
-
-        // Call the given ThroughTextGlyphFunc and break out if it returns false
-        if (!GlyphFunc (pGlyph, glyph_x, y, i))
-            return;
+        layout.glyphAtPos.push_back (layout.glyphs.size ());
+        layout.glyphs.push_back ({pGlyph, x, y, i, text.offsets [k]});
+        k ++;
 
         // move on to the x after the glyph and update the index:
         x += GetHAdv (pFont, pGlyph);
         i ++;
+
+        // Trailing whitespace doesn't count for alignment:
+        if (!isspace (c))
+            lineWidth = x;
     }
 
-    // move the glyph to the left if alignment is mid or right
-    glyph_x = x;
-    if (halign == TEXTALIGN_MID)
+    // The terminating null, with the rightmost x value:
+    layout.glyphAtPos.push_back (layout.glyphs.size ());
+    layout.glyphs.push_back ({NULL, x, y, i, text.offsets [nChars]});
 
-        glyph_x = x - lineWidth / 2;
+    line.end = text.offsets [nChars];
+    line.endGlyph = layout.glyphs.size ();
+    line.width = lineWidth;
+    AlignLine (layout, line, halign);
+    layout.lines.push_back (line);
+}
+int GlyphAtOffset (const TextLayout &layout, const size_t offset)
+{
+    auto it = std::lower_bound (layout.glyphs.begin (), layout.glyphs.end (), offset,
+                                [] (const PlacedGlyph &placed, const size_t o) { return placed.offset < o; });
 
-    else if (halign == TEXTALIGN_RIGHT)
+    if (it != layout.glyphs.end () && it->offset == offset)
+        return it - layout.glyphs.begin ();
 
-        glyph_x = x - lineWidth;
+    return -1;
+}
+void GetTextLines (const Font *pFont, const char *pUTF8, const float maxWidth, std::vector <TextLine> &lines)
+{
+    TextLayout layout;
+    LayoutText (pFont, pUTF8, layout, TEXTALIGN_LEFT, maxWidth);
 
-    // Call GlyphFunc for the terminating null, with the rightmost x value:
-    GlyphFunc (NULL, glyph_x, y, i);
+    lines.assign (layout.lines.begin (), layout.lines.end ());
 }
 void glRenderText (const Font *pFont, const char *pUTF8, const int align, float maxWidth)
 {
-    glFrontFace (GL_CW);
-    glActiveTexture (GL_TEXTURE0);
-    glEnable (GL_TEXTURE_2D);
-
-    ThroughText (pFont, pUTF8,
-        [&] (const Glyph *pGlyph, const float x, const float y, const int string_pos)
-        {
-            if (!pGlyph)
-                return true;
+    // Static texts are laid out only once, changing texts reuse old buffers:
+    GetCachedTextMesh (pFont, pUTF8, align, maxWidth)->Render ();
+}
+void ThroughTextQuads (const Font *pFont, const char *pUTF8, GlyphQuadFunc QuadFunc,
+                       const int align, float maxWidth)
+{
+    TextLayout layout;
+    LayoutText (pFont, pUTF8, layout, align, maxWidth);
 
-            // Render the glyph with its origin at the given x,y
+    ThroughTextQuads (layout, QuadFunc);
+}
+void ThroughTextQuads (const TextLayout &layout, GlyphQuadFunc QuadFunc)
+{
+    const Font *pFont = layout.pFont;
+    GlyphQuad quad;
 
-            float ori_x, ori_y;
-            GetGlyphOrigin (pFont, pGlyph, ori_x, ori_y);
+    for (const PlacedGlyph &placed : layout.glyphs)
+    {
+        if (!placed.pGlyph || !placed.pGlyph->tex)
+            continue;
 
-            if (pGlyph->tex)
-                glRenderGlyph (pFont, pGlyph, x - ori_x, y - ori_y);
+        float ori_x, ori_y;
+        GetGlyphOrigin (pFont, placed.pGlyph, ori_x, ori_y);
 
-            return true;
-        },
-        align, maxWidth);
+        GetGlyphQuad (pFont, placed.pGlyph, placed.x - ori_x, placed.y - ori_y, quad);
+        QuadFunc (quad);
+    }
 }
 void glRenderTextAsRects (const Font *pFont, const char *pUTF8,
                           const int from, const int to,
@@ -1462,12 +2033,24 @@ void glRenderTextAsRects (const Font *pFont, const char *pUTF8,
     if (from >= to || from < 0)
         return; // nothing to do
 
+    TextLayout layout;
+    LayoutText (pFont, pUTF8, layout, align, maxWidth);
+
+    glRenderTextAsRects (layout, from, to);
+}
+void glRenderTextAsRects (const TextLayout &layout, const int from, const int to)
+{
+    if (from >= to || from < 0)
+        return; // nothing to do
+
+    const Font *pFont = layout.pFont;
+
     float start_x, current_y, end_x;
 
     glFrontFace (GL_CW);
     glActiveTexture (GL_TEXTURE0);
 
-    ThroughText (pFont, pUTF8,
+    ThroughLayout (layout,
         [&] (const Glyph *pGlyph, const float x, const float y, const int string_pos)
         {
             if (string_pos < from)
@@ -1526,14 +2109,22 @@ void glRenderTextAsRects (const Font *pFont, const char *pUTF8,
             end_x = x - ori_x + w;
 
             return true;
-        },
-        align, maxWidth);
+        });
 }
 
 int WhichGlyphAt (const Font *pFont, const char *pUTF8,
                   const float px, const float py,
                   const int align, float maxWidth)
 {
+    TextLayout layout;
+    LayoutText (pFont, pUTF8, layout, align, maxWidth);
+
+    return WhichGlyphAt (layout, px, py);
+}
+int WhichGlyphAt (const TextLayout &layout, const float px, const float py)
+{
+    const Font *pFont = layout.pFont;
+
     /*
         Important! Index positions must be set to a negative number at start.
         Negative is interpreted as 'unset'.
@@ -1542,7 +2133,7 @@ int WhichGlyphAt (const Font *pFont, const char *pUTF8,
         leftmost_pos = -1,
         rightmost_pos = -1;
 
-    ThroughText (pFont, pUTF8,
+    ThroughLayout (layout,
         [&] (const Glyph *pGlyph, const float x, const float y, const int string_pos)
         {
             // Calculate glyph bounding box:
@@ -1592,8 +2183,7 @@ int WhichGlyphAt (const Font *pFont, const char *pUTF8,
             }
 
             return (pos < 0); // as long as index is -1, keep checking the next glyph
-        },
-        align, maxWidth);
+        });
 
     if (pos < 0) // no exact match, but maybe the point is on the same line
     {
@@ -1612,24 +2202,26 @@ void CoordsOfGlyph (const Font *pFont, const char *pUTF8, const int pos,
                          float &outX, float &outY,
                          const int align, float maxWidth)
 {
-    ThroughText (pFont, pUTF8,
-        [&] (const Glyph *pGlyph, const float x, const float y, const int string_pos)
-        {
-            if (pos == string_pos) // is this the glyph we were looking for?
-            {
-                float ori_x,
-                      ori_y;
-                GetGlyphOrigin (pFont, pGlyph, ori_x, ori_y);
+    TextLayout layout;
+    LayoutText (pFont, pUTF8, layout, align, maxWidth);
+
+    CoordsOfGlyph (layout, pos, outX, outY);
+}
+void CoordsOfGlyph (const TextLayout &layout, const int pos, float &outX, float &outY)
+{
+    // Whitespace, left out at line breaks, has no glyph:
+    if (pos < 0 || size_t (pos) >= layout.glyphAtPos.size () || layout.glyphAtPos [pos] < 0)
+        return;
 
-                // Return its position
-                outX = x - ori_x;
-                outY = y - ori_y;
+    const PlacedGlyph &placed = layout.glyphs [layout.glyphAtPos [pos]];
 
-                return false;
-            }
-            return true;
-        },
-        align, maxWidth);
+    float ori_x,
+          ori_y;
+    GetGlyphOrigin (layout.pFont, placed.pGlyph, ori_x, ori_y);
+
+    // Return its position
+    outX = placed.x - ori_x;
+    outY = placed.y - ori_y;
 }
 void DimensionsOfText (const Font *pFont, const char *pUTF8,
                        float &outX1, float &outY1, float &outX2, float &outY2,
@@ -1642,6 +2234,22 @@ void DimensionsOfText (const Font *pFont, const char *pUTF8,
         return;
     }
 
+    TextLayout layout;
+    LayoutText (pFont, pUTF8, layout, align, maxWidth);
+
+    DimensionsOfText (layout, outX1, outY1, outX2, outY2);
+}
+void DimensionsOfText (const TextLayout &layout, float &outX1, float &outY1, float &outX2, float &outY2)
+{
+    const Font *pFont = layout.pFont;
+
+    // If the font has no glyphs, no text can exist:
+    if (pFont->glyphs.size() <= 0)
+    {
+        outX1 = outY1 = outX2 = outY2 = 0.0;
+        return;
+    }
+
     /*
         At start, set the bounding box minima to unrealistically high numbers
         and the maxima to unrealistically negative numbers. That way, we
@@ -1651,7 +2259,7 @@ void DimensionsOfText (const Font *pFont, const char *pUTF8,
     minX = minY = 1.0e+15f;
     maxX = maxY = -1.0e+15f;
 
-    ThroughText (pFont, pUTF8,
+    ThroughLayout (layout,
         [&] (const Glyph *pGlyph, const float x, const float y, const int string_pos)
         {
             // Calculate glyph bounding box:
@@ -1670,11 +2278,54 @@ void DimensionsOfText (const Font *pFont, const char *pUTF8,
             maxY = std::max (y2, maxY);
 
             return true;
-        },
-        align, maxWidth);
+        });
 
     outX1 = minX;
     outX2 = maxX;
     outY1 = minY;
     outY2 = maxY;
 }
+
+#define BENCHMARK_TEXTSIZE 100000 // bytes
+#define BENCHMARK_ROUNDS 20
+#define BENCHMARK_WIDTH 500.0f
+
+void BenchmarkTextLayout (const Font *pFont, FILE *out)
+{
+    const char *paragraph = "The quick brown fox jumps over the lazy dog, while Ren\xC3\xA9""e "
+                            "orders a cr\xC3\xA8me br\xC3\xBBl\xC3\xA9""e at the caf\xC3\xA9. "
+                            "Sphinx of black quartz, judge my vow!\n";
+    std::string text;
+    while (text.size () < BENCHMARK_TEXTSIZE)
+        text += paragraph;
+
+    const size_t nChars = strlen_utf8 (text.c_str ());
+
+    std::vector <TextLine> lines;
+    TextLayout layout;
+    float x1, y1, x2, y2;
+    int pos = 0;
+
+    const std::function <void (void)> ops [] = {
+        [&] () { LayoutText (pFont, text.c_str (), layout, TEXTALIGN_LEFT, BENCHMARK_WIDTH); },
+        [&] () { DimensionsOfText (pFont, text.c_str (), x1, y1, x2, y2, TEXTALIGN_LEFT, BENCHMARK_WIDTH); },
+        [&] () { lines.clear (); GetTextLines (pFont, text.c_str (), BENCHMARK_WIDTH, lines); },
+        [&] () { pos = WhichGlyphAt (pFont, text.c_str (), x2, y2, TEXTALIGN_LEFT, BENCHMARK_WIDTH); }
+    };
+    const char *names [] = {"LayoutText", "DimensionsOfText", "GetTextLines", "WhichGlyphAt"};
+
+    fprintf (out, "layout benchmark: %u characters, wrapped at %.0f\n", (unsigned int)nChars, BENCHMARK_WIDTH);
+    for (size_t i = 0; i < sizeof (names) / sizeof (names [0]); i++)
+    {
+        ops [i] (); // warm up
+
+        auto start = std::chrono::steady_clock::now ();
+        for (int r = 0; r < BENCHMARK_ROUNDS; r++)
+            ops [i] ();
+        auto end = std::chrono::steady_clock::now ();
+
+        const double ns = std::chrono::duration <double, std::nano> (end - start).count () / BENCHMARK_ROUNDS;
+        fprintf (out, "%-18s %8.3f ms per text, %6.1f ns per character\n", names [i], ns / 1e6, ns / nChars);
+    }
+    fprintf (out, "(%u lines, glyph %d at the bottom right)\n", (unsigned int)lines.size (), pos);
+}
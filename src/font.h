@@ -25,6 +25,9 @@
 #include <GL/gl.h>
 
 #include <map>
+#include <vector>
+#include <functional>
+#include <stdio.h>
 #include <libxml/tree.h>
 #include "str.h"
 
@@ -37,10 +40,13 @@ struct Glyph { /* these objects are mapped one-to-one with character codes */
     // (stored for convenience)
     unicode_char ch;
 
-    // Texture that contains the glyph's image
+    // Atlas texture that contains the glyph's image, and its pixel size
     GLuint tex;
     GLsizei tex_h, tex_w;
 
+    // Where the glyph's image is, on the atlas texture:
+    GLfloat tex_x1, tex_y1, tex_x2, tex_y2;
+
     /*
         horiz_origin_x, horiz_origin_y & horiz_adv_x may be negative,
         in which case they are ignored and the font's default is used:
@@ -54,21 +60,74 @@ struct BBox { /* all the font's glyphs should fit inside this */
     float left, bottom, right, top; // parse order
 };
 
+#define FONT_LATIN_CHARS 256 // ASCII and Latin-1
+
+struct KernEntry
+{
+    unicode_char prev_c, c; // prev_c is 0 in empty slots
+    float k;
+};
+
 struct Font {
 
+    // Unique for every parsed font, so that caches can tell fonts apart:
+    unsigned int id;
+
     float size, // ems per unit
           horiz_origin_x, horiz_origin_y,
           horiz_adv_x;
 
     BBox bbox;
 
+    /*
+        Distance field fonts have, for every atlas pixel, the distance to the glyph's outline instead of
+        its coverage. They stay sharp when magnified and can be scaled to other sizes, see ScaleFont.
+     */
+    bool distanceField;
+    float spread,     // atlas pixels, around the glyph images, that distances reach out to
+          imageScale; // atlas pixels per font unit
+
     // One glyph per character code:
     std::map <unicode_char, Glyph> glyphs;
 
+    // Textures, that the glyph images are packed on:
+    std::vector <GLuint> atlases;
+
     // One kern value per character pair:
     std::map <unicode_char, std::map<unicode_char, float> > hKernTable;
+
+    /*
+        Flat copies of the lookups above, made after parsing, because layout does
+        a glyph and kern lookup for every character. The pointers point into 'glyphs'.
+     */
+    const Glyph *latinGlyphs [FONT_LATIN_CHARS];
+    std::vector <std::pair <unicode_char, const Glyph *> > otherGlyphs; // sorted by character
+    const Glyph *pDefaultGlyph;
+
+    std::vector <KernEntry> hKernHash; // open addressing, size is a power of two
 };
 
+/**
+ * Fills in the font's flat glyph lookup tables. Must be called when the glyphs map changes.
+ */
+void CompileGlyphTables (Font *pFont);
+
+/**
+ * :returns: a unique id for a newly made font
+ */
+unsigned int NewFontID (void);
+
+/**
+ * Looks up the glyph for a character.
+ * :returns: NULL if the font doesn't have it
+ */
+const Glyph *FindGlyph (const Font *pFont, const unicode_char c);
+
+/**
+ * Times the layout functions on a long text and prints the results.
+ */
+void BenchmarkTextLayout (const Font *pFont, FILE *out);
+
 /**
  *  This takes the values from an svg document and creates a font with them:
  *
@@ -80,6 +139,23 @@ struct Font {
  */
 bool ParseSVGFont (const xmlDocPtr pDoc, const int size, Font *pFont);
 
+/**
+ * Like ParseSVGFont, but makes a distance field font.
+ * Glyph images are made at the given size, but the font can be drawn at any size with ScaleFont.
+ * glRenderText draws such fonts through a shader. Other users of the glyph quads must
+ * threshold the texture's alpha channel at 0.5 themselves.
+ */
+bool ParseSVGDistanceFont (const xmlDocPtr pDoc, const int size, Font *pFont);
+
+/**
+ * Makes a font of another size, that uses the glyph atlases of a distance field font.
+ * No glyphs are drawn, so this is cheap. The source font's atlases must outlive the scaled font.
+ *
+ * :param size: the desired ems per unit
+ * :returns: false if the source isn't a distance field font
+ */
+bool ScaleFont (const Font *pSource, const float size, Font *pFont);
+
 // This gives the distance between the bottoms of two successive lines of text:
 float GetLineSpacing (const Font *pFont);
 
@@ -101,6 +177,94 @@ float GetLineSpacing (const Font *pFont);
  */
 void glRenderText (const Font *pFont, const char *pUTF8, const int align = TEXTALIGN_LEFT, float maxWidth = -1.0f);
 
+/*
+    A glyph's textured quad, as glRenderText would render it.
+    (tx1, ty1) goes with (x1, y1) and (tx2, ty2) with (x2, y2).
+ */
+struct GlyphQuad
+{
+    GLuint tex;
+    GLfloat x1, y1, x2, y2,
+            tx1, ty1, tx2, ty2;
+};
+typedef std::function <void (const GlyphQuad &)> GlyphQuadFunc;
+
+/**
+ * Gives the quads of the text's glyphs to QuadFunc, instead of rendering them.
+ * This way, text can be rendered in one batch with other quads.
+ */
+void ThroughTextQuads (const Font *pFont, const char *pUTF8, GlyphQuadFunc QuadFunc,
+                       const int align = TEXTALIGN_LEFT, float maxWidth = -1.0f);
+
+/*
+    Byte offsets of a line in a text. Whitespace that glRenderText
+    leaves out at line breaks, is outside of start and end.
+ */
+struct TextLine
+{
+    size_t start, end;
+};
+
+/*
+    A glyph, placed by LayoutText.
+ */
+struct PlacedGlyph
+{
+    const Glyph *pGlyph; // NULL for the terminating null character
+    float x, y;          // where the glyph's origin goes, after alignment
+    int pos;             // character index in the text
+    size_t offset;       // byte offset in the text
+};
+
+struct LayoutLine : public TextLine
+{
+    size_t firstGlyph, endGlyph; // range in TextLayout::glyphs
+    float width;
+};
+
+/*
+    The result of one pass through a text. The text query functions can read from this,
+    instead of laying out the same text again. Doesn't keep a pointer to the text.
+ */
+struct TextLayout
+{
+    const Font *pFont;
+    int align;
+    float maxWidth;
+
+    // In text order, the last one is the terminating null character:
+    std::vector <PlacedGlyph> glyphs;
+
+    std::vector <LayoutLine> lines;
+
+    // Character index to index in glyphs, -1 for whitespace that was left out at a line break:
+    std::vector <int> glyphAtPos;
+};
+
+/**
+ * Places all the glyphs of the text and breaks it into lines, in one pass.
+ * Arguments are the same as glRenderText's.
+ */
+void LayoutText (const Font *pFont, const char *pUTF8, TextLayout &layout,
+                 const int align = TEXTALIGN_LEFT, float maxWidth = -1.0f);
+
+/**
+ * :returns: the index in layout.glyphs of the glyph at the given byte offset, -1 if there's none.
+ */
+int GlyphAtOffset (const TextLayout &layout, const size_t offset);
+
+/**
+ * Tells where glRenderText would break the text into lines, with the given maxWidth.
+ * Rendering each line separately, without maxWidth, gives the same result.
+ */
+void GetTextLines (const Font *pFont, const char *pUTF8, const float maxWidth, std::vector <TextLine> &lines);
+
+/*
+    The following functions also take a TextLayout, instead of a text.
+    That way, callers who ask several things about the same text only lay it out once.
+ */
+void ThroughTextQuads (const TextLayout &layout, GlyphQuadFunc QuadFunc);
+
 /**
  * glRenderTextAsRects is handy for text selections.
  *
@@ -108,6 +272,7 @@ void glRenderText (const Font *pFont, const char *pUTF8, const int align = TEXTA
  * :param to: character index where rendering stops
  */
 void glRenderTextAsRects (const Font *pFont, const char *pUTF8, const int from, const int to, const int align = TEXTALIGN_LEFT, float maxWidth = -1.0f);
+void glRenderTextAsRects (const TextLayout &layout, const int from, const int to);
 
 /**
  * Tells which glyph is at the requested point.
@@ -121,6 +286,7 @@ void glRenderTextAsRects (const Font *pFont, const char *pUTF8, const int from,
 int WhichGlyphAt (const Font *pFont, const char *pUTF8,
                   const float px, const float py,
                   const int align = TEXTALIGN_LEFT, float maxWidth = -1.0f);
+int WhichGlyphAt (const TextLayout &layout, const float px, const float py);
 
 /**
  * Tells coordinates of a glyph relative to origin point of text.
@@ -131,6 +297,7 @@ int WhichGlyphAt (const Font *pFont, const char *pUTF8,
 void CoordsOfGlyph (const Font *pFont, const char *pUTF8, const int pos,
                          float &outX, float &outY,
                          const int align = TEXTALIGN_LEFT, float maxWidth = -1.0f);
+void CoordsOfGlyph (const TextLayout &layout, const int pos, float &outX, float &outY);
 /**
  * Tells how big the text is, by giving back a bounding box.
  * Returned bounding box area is relative to the origin point of the text.
@@ -140,5 +307,6 @@ void CoordsOfGlyph (const Font *pFont, const char *pUTF8, const int pos,
 void DimensionsOfText (const Font *pFont, const char *pUTF8,
                        float &outX1, float &outY1, float &outX2, float &outY2,
                        const int align = TEXTALIGN_LEFT, float maxWidth = -1.0f);
+void DimensionsOfText (const TextLayout &layout, float &outX1, float &outY1, float &outX2, float &outY2);
 
 #endif // FONT_H
@@ -0,0 +1,380 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+
+#include <stdio.h>
+#include <cstring>
+#include <vector>
+
+#include "fontcache.h"
+#include "xml.h"
+#include "io.h"
+#include "err.h"
+
+/*
+    Cache file layout, all in native byte order:
+    header, glyphs, kern hash entries and then the pixels of each atlas.
+    The version must change, whenever something in this layout changes.
+
+    A checksum covers the header and tables, not the pixels. Damaged pixels
+    only look wrong, but a damaged kern hash could make lookups loop forever.
+ */
+#define FONTCACHE_MAGIC "FNTC"
+#define FONTCACHE_VERSION 3
+
+struct FontCacheHeader
+{
+    char magic [4];
+    Uint32 version;
+    Uint64 sourceHash, // of the svg data
+           checksum; // of the header, with zero here, glyphs and kern entries
+    Sint32 requestedSize;
+    Uint8 distanceField;
+
+    float size,
+          spread, imageScale,
+          horiz_origin_x, horiz_origin_y,
+          horiz_adv_x;
+    BBox bbox;
+
+    Uint32 nGlyphs,
+           nKernEntries,
+           nAtlases,
+           atlasSize; // width and height
+};
+
+struct FontCacheGlyph
+{
+    Uint32 ch;
+    Sint32 atlas; // -1 for no image
+    Sint32 tex_w, tex_h;
+    float tex_x1, tex_y1, tex_x2, tex_y2,
+          horiz_origin_x, horiz_origin_y,
+          horiz_adv_x;
+};
+
+#define FNV_OFFSET 14695981039346656037ULL
+
+/**
+ * FNV-1a, good enough to notice that data changed.
+ */
+Uint64 HashBytes (const Uint8 *data, const size_t length, Uint64 hash = FNV_OFFSET)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= data [i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+Uint64 HashSVGData (const std::string &data)
+{
+    return HashBytes ((const Uint8 *)data.data (), data.size ());
+}
+Uint64 FontCacheChecksum (FontCacheHeader header, const Uint8 *pTables)
+{
+    header.checksum = 0;
+
+    Uint64 hash = HashBytes ((const Uint8 *)&header, sizeof (header));
+    return HashBytes (pTables, header.nGlyphs * sizeof (FontCacheGlyph)
+                             + header.nKernEntries * sizeof (KernEntry), hash);
+}
+size_t FontCacheLength (const FontCacheHeader &header)
+{
+    return sizeof (FontCacheHeader)
+         + header.nGlyphs * sizeof (FontCacheGlyph)
+         + header.nKernEntries * sizeof (KernEntry)
+         + size_t (header.nAtlases) * header.atlasSize * header.atlasSize * 4;
+}
+/**
+ * Takes the font from cache data.
+ * :returns: false if the data is from a different svg, size or version.
+ */
+bool ReadFontCache (const Uint8 *data, const size_t length,
+                    const Uint64 sourceHash, const int requestedSize, const bool distanceField, Font *pFont)
+{
+    FontCacheHeader header;
+    if (length < sizeof (header))
+        return false;
+
+    memcpy (&header, data, sizeof (header));
+
+    if (strncmp (header.magic, FONTCACHE_MAGIC, 4) != 0 || header.version != FONTCACHE_VERSION ||
+        header.sourceHash != sourceHash || header.requestedSize != requestedSize ||
+        bool (header.distanceField) != distanceField ||
+        length != FontCacheLength (header))
+        return false;
+
+    const Uint8 *pGlyphData = data + sizeof (header),
+                *pKernData = pGlyphData + header.nGlyphs * sizeof (FontCacheGlyph),
+                *pPixelData = pKernData + header.nKernEntries * sizeof (KernEntry);
+
+    if (header.checksum != FontCacheChecksum (header, pGlyphData))
+        return false;
+
+    // Even with a matching checksum, don't trust what lookups depend on:
+    if (header.nKernEntries & (header.nKernEntries - 1))
+        return false;
+
+    bool kernSlotFree = header.nKernEntries == 0;
+    KernEntry entry;
+    for (Uint32 i = 0; i < header.nKernEntries && !kernSlotFree; i++)
+    {
+        memcpy (&entry, pKernData + i * sizeof (KernEntry), sizeof (KernEntry));
+        kernSlotFree = entry.prev_c == 0;
+    }
+    if (!kernSlotFree)
+        return false;
+
+    FontCacheGlyph record;
+    for (Uint32 i = 0; i < header.nGlyphs; i++)
+    {
+        memcpy (&record, pGlyphData + i * sizeof (FontCacheGlyph), sizeof (FontCacheGlyph));
+        if (record.atlas < -1 || record.atlas >= (Sint32)header.nAtlases)
+            return false;
+    }
+
+    pFont->size = header.size;
+    pFont->horiz_origin_x = header.horiz_origin_x;
+    pFont->horiz_origin_y = header.horiz_origin_y;
+    pFont->horiz_adv_x = header.horiz_adv_x;
+    pFont->bbox = header.bbox;
+    pFont->distanceField = header.distanceField;
+    pFont->spread = header.spread;
+    pFont->imageScale = header.imageScale;
+
+    // The pixels can go to GL straight from the mapped file:
+    pFont->atlases.resize (header.nAtlases);
+    glGenTextures (header.nAtlases, pFont->atlases.data ());
+    for (Uint32 i = 0; i < header.nAtlases; i++)
+    {
+        glBindTexture (GL_TEXTURE_2D, pFont->atlases [i]);
+
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+        glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8,
+                      (GLsizei)header.atlasSize, (GLsizei)header.atlasSize,
+                      0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                      pPixelData + size_t (i) * header.atlasSize * header.atlasSize * 4);
+    }
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    pFont->glyphs.clear ();
+    for (Uint32 i = 0; i < header.nGlyphs; i++)
+    {
+        memcpy (&record, pGlyphData + i * sizeof (FontCacheGlyph), sizeof (FontCacheGlyph));
+
+        Glyph &glyph = pFont->glyphs [record.ch];
+        glyph = Glyph ();
+        glyph.ch = record.ch;
+        glyph.tex = record.atlas >= 0 ? pFont->atlases [record.atlas] : 0;
+        glyph.tex_w = record.tex_w;
+        glyph.tex_h = record.tex_h;
+        glyph.tex_x1 = record.tex_x1;
+        glyph.tex_y1 = record.tex_y1;
+        glyph.tex_x2 = record.tex_x2;
+        glyph.tex_y2 = record.tex_y2;
+        glyph.horiz_origin_x = record.horiz_origin_x;
+        glyph.horiz_origin_y = record.horiz_origin_y;
+        glyph.horiz_adv_x = record.horiz_adv_x;
+    }
+
+    // The kern hash is stored as it is, the kern map isn't needed anymore after parsing.
+    pFont->hKernTable.clear ();
+    pFont->hKernHash.resize (header.nKernEntries);
+    if (header.nKernEntries > 0)
+        memcpy (pFont->hKernHash.data (), pKernData, header.nKernEntries * sizeof (KernEntry));
+
+    CompileGlyphTables (pFont);
+    pFont->id = NewFontID ();
+
+    return true;
+}
+/**
+ * Writes the font to a cache file. Atlas pixels are read back from GL.
+ * The file is written under a temporary name first, so that a crash doesn't leave half a cache file.
+ */
+bool WriteFontCache (const char *path, const Uint64 sourceHash, const int requestedSize, const Font *pFont)
+{
+    FontCacheHeader header;
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, FONTCACHE_MAGIC, 4);
+    header.version = FONTCACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.requestedSize = requestedSize;
+    header.size = pFont->size;
+    header.horiz_origin_x = pFont->horiz_origin_x;
+    header.horiz_origin_y = pFont->horiz_origin_y;
+    header.horiz_adv_x = pFont->horiz_adv_x;
+    header.bbox = pFont->bbox;
+    header.distanceField = pFont->distanceField;
+    header.spread = pFont->spread;
+    header.imageScale = pFont->imageScale;
+    header.nGlyphs = pFont->glyphs.size ();
+    header.nKernEntries = pFont->hKernHash.size ();
+    header.nAtlases = pFont->atlases.size ();
+    header.atlasSize = 0;
+
+    // All atlases of a font have the same size:
+    GLint w = 0, h = 0;
+    if (header.nAtlases > 0)
+    {
+        glBindTexture (GL_TEXTURE_2D, pFont->atlases [0]);
+        glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+        glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+        glBindTexture (GL_TEXTURE_2D, 0);
+
+        if (w != h || w <= 0)
+        {
+            SetError ("unexpected atlas size %dx%d", w, h);
+            return false;
+        }
+        header.atlasSize = w;
+    }
+
+    std::vector <FontCacheGlyph> records;
+    records.reserve (pFont->glyphs.size ());
+    for (const auto &pair : pFont->glyphs)
+    {
+        const Glyph &glyph = pair.second;
+
+        FontCacheGlyph record;
+        memset (&record, 0, sizeof (record));
+        record.ch = glyph.ch;
+        record.atlas = -1;
+        for (size_t i = 0; i < pFont->atlases.size (); i++)
+        {
+            if (glyph.tex && glyph.tex == pFont->atlases [i])
+                record.atlas = i;
+        }
+        record.tex_w = glyph.tex_w;
+        record.tex_h = glyph.tex_h;
+        record.tex_x1 = glyph.tex_x1;
+        record.tex_y1 = glyph.tex_y1;
+        record.tex_x2 = glyph.tex_x2;
+        record.tex_y2 = glyph.tex_y2;
+        record.horiz_origin_x = glyph.horiz_origin_x;
+        record.horiz_origin_y = glyph.horiz_origin_y;
+        record.horiz_adv_x = glyph.horiz_adv_x;
+
+        records.push_back (record);
+    }
+
+    std::vector <Uint8> tables (records.size () * sizeof (FontCacheGlyph) + pFont->hKernHash.size () * sizeof (KernEntry));
+    if (!records.empty ())
+        memcpy (tables.data (), records.data (), records.size () * sizeof (FontCacheGlyph));
+    if (!pFont->hKernHash.empty ())
+        memcpy (tables.data () + records.size () * sizeof (FontCacheGlyph), pFont->hKernHash.data (),
+                pFont->hKernHash.size () * sizeof (KernEntry));
+    header.checksum = FontCacheChecksum (header, tables.data ());
+
+    std::string tmpPath = std::string (path) + ".tmp";
+    FILE *f = fopen (tmpPath.c_str (), "wb");
+    if (!f)
+    {
+        SetError ("cannot write %s", tmpPath.c_str ());
+        return false;
+    }
+
+    bool success = fwrite (&header, sizeof (header), 1, f) == 1 &&
+                   fwrite (tables.data (), 1, tables.size (), f) == tables.size ();
+
+    std::vector <Uint8> pixels (size_t (header.atlasSize) * header.atlasSize * 4);
+    for (size_t i = 0; success && i < pFont->atlases.size (); i++)
+    {
+        glBindTexture (GL_TEXTURE_2D, pFont->atlases [i]);
+        glGetTexImage (GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, pixels.data ());
+
+        success = fwrite (pixels.data (), 1, pixels.size (), f) == pixels.size ();
+    }
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    if (fclose (f) != 0)
+        success = false;
+
+    if (!success)
+    {
+        SetError ("error writing %s", tmpPath.c_str ());
+        remove (tmpPath.c_str ());
+        return false;
+    }
+
+    remove (path); // rename doesn't overwrite on windows
+    if (rename (tmpPath.c_str (), path) != 0)
+    {
+        SetError ("cannot rename %s to %s", tmpPath.c_str (), path);
+        remove (tmpPath.c_str ());
+        return false;
+    }
+
+    return true;
+}
+bool LoadSVGFontCached (const std::string &svgData, const int size, const std::string &cachePath, Font *pFont,
+                        const bool distanceField)
+{
+    const Uint64 hash = HashSVGData (svgData);
+
+    if (!cachePath.empty ())
+    {
+        MappedFile mapped;
+        if (MapFile (cachePath.c_str (), mapped))
+        {
+            bool hit = ReadFontCache ((const Uint8 *)mapped.data, mapped.size, hash, size, distanceField, pFont);
+            UnmapFile (mapped);
+
+            if (hit)
+                return true;
+        }
+    }
+
+    // No cache, or stale. Parse the svg:
+    SDL_RWops *input = SDL_RWFromConstMem (svgData.c_str (), svgData.size ());
+    if (!input)
+    {
+        SetError (SDL_GetError ());
+        return false;
+    }
+
+    xmlDocPtr pDoc = ParseXML (input);
+    input->close (input);
+
+    if (!pDoc)
+        return false;
+
+    bool success;
+    if (distanceField)
+        success = ParseSVGDistanceFont (pDoc, size, pFont);
+    else
+        success = ParseSVGFont (pDoc, size, pFont);
+    xmlFreeDoc (pDoc);
+
+    if (!success)
+        return false;
+
+    // A cache that can't be written, only makes the next start slower:
+    if (!cachePath.empty () && !WriteFontCache (cachePath.c_str (), hash, size, pFont))
+        fprintf (stderr, "warning: font cache not written: %s\n", GetError ());
+
+    return true;
+}
@@ -0,0 +1,44 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef FONTCACHE_H
+#define FONTCACHE_H
+
+#include <string>
+
+#include "font.h"
+
+/**
+ * Like ParseSVGFont, but takes the svg file's contents and keeps the resulting font in a binary cache file.
+ * If the cache file was made from the same svg data and size, it's mapped into memory and loaded,
+ * without parsing or drawing anything. Otherwise, the svg is parsed and the cache file is made again.
+ *
+ * :param svgData: contents of the svg file
+ * :param size: the desired ems per unit
+ * :param cachePath: where to keep the cache file, empty for no caching
+ * :param pFont: font object to store data in
+ * :param distanceField: makes a distance field font, like ParseSVGDistanceFont
+ * :returns: true if successful, false on error
+ */
+bool LoadSVGFontCached (const std::string &svgData, const int size, const std::string &cachePath, Font *pFont,
+                        const bool distanceField = false);
+
+#endif // FONTCACHE_H
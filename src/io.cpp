@@ -23,6 +23,15 @@
 #include <stdio.h>
 #include <sstream>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 bool ReadAll (SDL_RWops *io, std::string &out)
 {
     const size_t bufsize = 256;
@@ -35,7 +44,7 @@ bool ReadAll (SDL_RWops *io, std::string &out)
         n = io->read(io, buf, 1, bufsize);
         if (n == 0)
         {
-            return true;
+            break;
         }
 
         str.write (buf, n);
@@ -142,3 +151,91 @@ SDL_RWops *SDL_RWFromZipArchive (const char *_archive, const char *_entry)
 
     return c;
 }
+
+#define PREFPATH_ORG "coosbaakman"
+
+std::string GetCachePath (const char *app, const char *filename)
+{
+    char *dir = SDL_GetPrefPath (PREFPATH_ORG, app);
+    if (!dir)
+        return "";
+
+    std::string path = std::string (dir) + filename;
+    SDL_free (dir);
+
+    return path;
+}
+#ifdef _WIN32
+bool MapFile (const char *path, MappedFile &mapped)
+{
+    mapped.file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapped.file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx ((HANDLE)mapped.file, &size) || size.QuadPart <= 0)
+    {
+        CloseHandle ((HANDLE)mapped.file);
+        return false;
+    }
+    mapped.size = size.QuadPart;
+
+    mapped.mapping = CreateFileMappingA ((HANDLE)mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapped.mapping)
+    {
+        CloseHandle ((HANDLE)mapped.file);
+        return false;
+    }
+
+    mapped.data = MapViewOfFile ((HANDLE)mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mapped.data)
+    {
+        CloseHandle ((HANDLE)mapped.mapping);
+        CloseHandle ((HANDLE)mapped.file);
+        return false;
+    }
+
+    return true;
+}
+void UnmapFile (MappedFile &mapped)
+{
+    UnmapViewOfFile (mapped.data);
+    CloseHandle ((HANDLE)mapped.mapping);
+    CloseHandle ((HANDLE)mapped.file);
+
+    mapped.data = NULL;
+    mapped.size = 0;
+}
+#else
+bool MapFile (const char *path, MappedFile &mapped)
+{
+    mapped.fd = open (path, O_RDONLY);
+    if (mapped.fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat (mapped.fd, &st) != 0 || st.st_size <= 0)
+    {
+        close (mapped.fd);
+        return false;
+    }
+    mapped.size = st.st_size;
+
+    mapped.data = mmap (NULL, mapped.size, PROT_READ, MAP_PRIVATE, mapped.fd, 0);
+    if (mapped.data == MAP_FAILED)
+    {
+        close (mapped.fd);
+        return false;
+    }
+
+    return true;
+}
+void UnmapFile (MappedFile &mapped)
+{
+    munmap ((void *)mapped.data, mapped.size);
+    close (mapped.fd);
+
+    mapped.data = NULL;
+    mapped.size = 0;
+}
+#endif
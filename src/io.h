@@ -37,4 +37,32 @@ SDL_RWops *SDL_RWFromZipArchive (const char *archive_path, const char *entry_pat
  */
 bool ReadAll (SDL_RWops *io, std::string &out);
 
+/*
+    A read only view of a file's contents, that the system pages in as needed.
+ */
+struct MappedFile
+{
+    const void *data;
+    size_t size;
+
+#ifdef _WIN32
+    void *file, *mapping; // HANDLEs
+#else
+    int fd;
+#endif
+};
+
+/**
+ * Maps a file into memory, must be unmapped afterwards.
+ * :returns: false if the file can't be opened or mapped
+ */
+bool MapFile (const char *path, MappedFile &mapped);
+void UnmapFile (MappedFile &mapped);
+
+/**
+ * Gives a path for a file, in the user's writable directory for the application.
+ * :returns: an empty string if there's no such directory
+ */
+std::string GetCachePath (const char *app, const char *filename);
+
 #endif // IO_H
@@ -0,0 +1,344 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+
+#include "import.h"
+#include "../account.h"
+#include "../thread.h"
+#include "../str.h"
+#include "../err.h"
+
+#define IMPORT_BATCHSIZE 65536 // accounts per write to the database
+#define HASH_CHUNKSIZE 256 // accounts per turn of a hashing thread
+
+#define SYNTHETIC_PREFIX "load"
+#define SYNTHETIC_LETTERS 6 // 26^6 names
+#define SYNTHETIC_MAXCOUNT 10000000 // makes a database of about 1.7 GB
+
+struct Credentials
+{
+    char username [USERNAME_MAXLENGTH],
+         password [PASSWORD_MAXLENGTH];
+};
+
+/*
+    Hashes batches of credentials on a fixed number of threads.
+    The threads take chunks of the current batch, until it's done.
+ */
+class HashPool
+{
+private:
+    std::vector <SDL_Thread *> threads;
+
+    SDL_mutex *pMutex;
+    SDL_cond *pWorkCond, *pDoneCond;
+
+    const Credentials *pInput;
+    AccountRecord *pOutput;
+    int nTotal, nTaken, nDone;
+    bool failed, quit;
+    std::string error; // the first error of the batch
+
+    int Work (void);
+public:
+    HashPool (const int nThreads);
+    ~HashPool ();
+
+    // Blocks until the whole batch is hashed.
+    bool Hash (const std::vector <Credentials> &, std::vector <AccountRecord> &);
+};
+HashPool::HashPool (const int nThreads)
+ : pInput (NULL), pOutput (NULL),
+   nTotal (0), nTaken (0), nDone (0),
+   failed (false), quit (false)
+{
+    pMutex = SDL_CreateMutex ();
+    pWorkCond = SDL_CreateCond ();
+    pDoneCond = SDL_CreateCond ();
+
+    for (int i = 0; i < nThreads; i++)
+        threads.push_back (MakeSDLThread ([this] { return this->Work (); }, "hash_thread"));
+}
+HashPool::~HashPool ()
+{
+    SDL_LockMutex (pMutex);
+    quit = true;
+    SDL_CondBroadcast (pWorkCond);
+    SDL_UnlockMutex (pMutex);
+
+    for (SDL_Thread *pThread : threads)
+        SDL_WaitThread (pThread, NULL);
+
+    SDL_DestroyCond (pWorkCond);
+    SDL_DestroyCond (pDoneCond);
+    SDL_DestroyMutex (pMutex);
+}
+int HashPool::Work (void)
+{
+    std::string threadError;
+    CaptureErrors (&threadError);
+
+    SDL_LockMutex (pMutex);
+    while (true)
+    {
+        while (!quit && nTaken >= nTotal)
+            SDL_CondWait (pWorkCond, pMutex);
+
+        if (quit)
+            break;
+
+        int start = nTaken,
+            end = std::min (nTotal, start + HASH_CHUNKSIZE);
+        nTaken = end;
+
+        SDL_UnlockMutex (pMutex);
+
+        bool success = true;
+        for (int i = start; i < end; i++)
+            success = MakeAccountRecord (pInput [i].username, pInput [i].password, &pOutput [i]) && success;
+
+        SDL_LockMutex (pMutex);
+
+        if (!success && !failed)
+            error = threadError;
+        failed = failed || !success;
+        nDone += end - start;
+        if (nDone >= nTotal)
+            SDL_CondSignal (pDoneCond);
+    }
+    SDL_UnlockMutex (pMutex);
+
+    return 0;
+}
+bool HashPool::Hash (const std::vector <Credentials> &credentials, std::vector <AccountRecord> &records)
+{
+    records.resize (credentials.size ());
+
+    SDL_LockMutex (pMutex);
+
+    pInput = credentials.data ();
+    pOutput = records.data ();
+    nTotal = credentials.size ();
+    nTaken = nDone = 0;
+    failed = false;
+
+    SDL_CondBroadcast (pWorkCond);
+
+    while (nDone < nTotal)
+        SDL_CondWait (pDoneCond, pMutex);
+
+    bool success = !failed;
+    if (!success)
+        SetError ("%s", error.c_str ());
+
+    SDL_UnlockMutex (pMutex);
+
+    return success;
+}
+
+/**
+ * Same rules as the interactive prompt: letters only.
+ */
+bool ValidUsername (const char *username)
+{
+    int i;
+    for (i = 0; username [i]; i++)
+    {
+        if (!isalpha ((unsigned char)username [i]))
+            return false;
+    }
+
+    return i > 0 && i < USERNAME_MAXLENGTH;
+}
+
+/**
+ * Reads up to maxCount "username password" lines, skips invalid ones.
+ */
+void ReadCredentials (FILE *pFile, const size_t maxCount, std::vector <Credentials> &out,
+                      int &lineNumber, int &nSkipped)
+{
+    char line [256],
+         username [256],
+         password [256];
+
+    out.clear ();
+    while (out.size () < maxCount && fgets (line, sizeof (line), pFile))
+    {
+        lineNumber ++;
+
+        if (emptyline (line) || line [0] == '#')
+            continue;
+
+        if (sscanf (line, "%255s %255s", username, password) != 2 ||
+                !ValidUsername (username) || strlen (password) >= PASSWORD_MAXLENGTH)
+        {
+            fprintf (stderr, "line %d: skipped, expecting a username of letters and a password\n", lineNumber);
+            nSkipped ++;
+            continue;
+        }
+
+        Credentials c;
+        strcpy (c.username, username);
+        strcpy (c.password, password);
+        out.push_back (c);
+    }
+}
+
+/**
+ * Synthetic accounts are named SYNTHETIC_PREFIX + letters, their password is their name.
+ */
+void GenerateCredentials (const int start, const int count, std::vector <Credentials> &out)
+{
+    out.resize (count);
+    for (int i = 0; i < count; i++)
+    {
+        Credentials &c = out [i];
+        int n = start + i,
+            prefixLength = strlen (SYNTHETIC_PREFIX);
+
+        strcpy (c.username, SYNTHETIC_PREFIX);
+        for (int j = SYNTHETIC_LETTERS - 1; j >= 0; j--)
+        {
+            c.username [prefixLength + j] = 'a' + n % 26;
+            n /= 26;
+        }
+        c.username [prefixLength + SYNTHETIC_LETTERS] = NULL;
+
+        strcpy (c.password, c.username);
+    }
+}
+void PrintImportUsage (const char *exe)
+{
+    fprintf (stderr, "Usage: %s import <file>   (use - for stdin, lines of: username password)\n"
+                     "       %s import --generate <count>\n", exe, exe);
+}
+int RunImport (int argc, char **argv, const char *accountsDir)
+{
+    std::vector <Credentials> credentials;
+    std::vector <AccountRecord> records;
+    FILE *pFile = NULL;
+    int nGenerate = -1,
+        nStored = 0,
+        nSkipped = 0,
+        lineNumber = 0;
+    bool success = true;
+
+    if (argc < 3)
+    {
+        PrintImportUsage (argv [0]);
+        return 1;
+    }
+
+    if (strcmp (argv [2], "--generate") == 0)
+    {
+        if (argc < 4)
+        {
+            PrintImportUsage (argv [0]);
+            return 1;
+        }
+
+        char *end;
+        errno = 0;
+        long n = strtol (argv [3], &end, 10);
+        if (end == argv [3] || *end || errno == ERANGE || n <= 0 || n > SYNTHETIC_MAXCOUNT)
+        {
+            fprintf (stderr, "count must be a number from 1 to %d, not %s\n", SYNTHETIC_MAXCOUNT, argv [3]);
+            return 1;
+        }
+        nGenerate = n;
+    }
+    else if (strcmp (argv [2], "-") == 0)
+        pFile = stdin;
+    else if (!(pFile = fopen (argv [2], "r")))
+    {
+        fprintf (stderr, "cannot open %s: %s\n", argv [2], strerror (errno));
+        return 1;
+    }
+
+    // Every batch goes into memory, the database is written once at the end.
+    AccountWriter *pWriter = OpenAccountWriter (accountsDir);
+    if (!pWriter)
+    {
+        fprintf (stderr, "cannot open accounts: %s\n", GetError ());
+        if (pFile && pFile != stdin)
+            fclose (pFile);
+        return 1;
+    }
+
+    int nThreads = std::max (1, SDL_GetCPUCount ());
+    HashPool pool (nThreads);
+
+    Uint64 startCounter = SDL_GetPerformanceCounter ();
+    double frequency = SDL_GetPerformanceFrequency ();
+
+    while (true)
+    {
+        if (nGenerate >= 0)
+            GenerateCredentials (nStored, std::min (nGenerate - nStored, IMPORT_BATCHSIZE), credentials);
+        else
+            ReadCredentials (pFile, IMPORT_BATCHSIZE, credentials, lineNumber, nSkipped);
+
+        if (credentials.empty ())
+            break;
+
+        if (!pool.Hash (credentials, records))
+        {
+            fprintf (stderr, "\nerror hashing: %s\n", GetError ());
+            success = false;
+            break;
+        }
+
+        WriteAccounts (pWriter, records.data (), records.size ());
+
+        nStored += records.size ();
+
+        double seconds = (SDL_GetPerformanceCounter () - startCounter) / frequency;
+        printf ("\r%d accounts added, %.0f per second", nStored, nStored / seconds);
+        fflush (stdout);
+    }
+
+    if (pFile && pFile != stdin)
+        fclose (pFile);
+
+    // Keep what was added before an error.
+    printf ("\nsaving...");
+    fflush (stdout);
+    if (!CloseAccountWriter (pWriter, nStored > 0))
+    {
+        fprintf (stderr, "\nerror storing accounts: %s\n", GetError ());
+        return 1;
+    }
+
+    double seconds = (SDL_GetPerformanceCounter () - startCounter) / frequency;
+    printf ("\nstored %d accounts in %.2f seconds on %d threads, skipped %d lines\n",
+            nStored, seconds, nThreads, nSkipped);
+
+    return success ? 0 : 1;
+}
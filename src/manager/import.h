@@ -0,0 +1,36 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef IMPORT_H
+#define IMPORT_H
+
+/**
+ * Non-interactive account provisioning:
+ *
+ *  import <file>              reads "username password" lines, '-' for stdin
+ *  import --generate <count>  makes synthetic accounts, for load testing
+ *
+ * Hashing runs on a thread pool, the accounts are stored in batches.
+ * :returns: the exit code
+ */
+int RunImport (int argc, char **argv, const char *accountsDir);
+
+#endif // IMPORT_H
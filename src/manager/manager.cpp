@@ -25,7 +25,8 @@
 
 #include "../ini.h"
 
-#include "../account.h" // MakeAccount
+#include "../account.h" // MakeAccount, delAccount, ImportAccountFiles
+#include "import.h"
 
 #include <string>
 #include <curses.h>
@@ -53,7 +54,7 @@ bool ArrangeDirectory (const char *path)
         //                drwxr-xr-x
         if (mkdir (path, 0b111101101) != 0)
         {
-            printw ("Cannot make directory %s: %s\n", path, std::strerror (errno));
+            SetError ("Cannot make directory %s: %s", path, std::strerror (errno));
             return false;
         }
 
@@ -68,7 +69,7 @@ bool ArrangeDirectory (const char *path)
     {
         if (!CreateDirectory (path, NULL))
         {
-            printw ("Cannot make directory %s: %s\n", path, WindowsErrorString (GetLastError ()).c_str ());
+            SetError ("Cannot make directory %s: %s", path, WindowsErrorString (GetLastError ()).c_str ());
             return false;
         }
     }
@@ -133,16 +134,12 @@ void PromptPassword (char *password, const int maxLength)
         }
     }
 }
-void OnMakeAccount (const std::string &exe_dir)
+/**
+ * Gets the accounts directory from the server's settings, and makes sure it exists.
+ */
+bool GetAccountsDir (const std::string &exe_dir, std::string &dirPath)
 {
-    char username [USERNAME_MAXLENGTH],
-         password [PASSWORD_MAXLENGTH];
-
-    std::string dirPath,
-                settingsPath;
-
-    bool usernameError;
-    int i;
+    std::string settingsPath;
 
 #ifdef CONFDIR
     settingsPath = std::string (CONFDIR) + PATH_SEPARATOR + "server.ini";
@@ -154,9 +151,23 @@ void OnMakeAccount (const std::string &exe_dir)
 
         dirPath = exe_dir + "accounts";
 
-    if (!ArrangeDirectory (dirPath.c_str ()))
+    return ArrangeDirectory (dirPath.c_str ());
+}
+void OnMakeAccount (const std::string &exe_dir)
+{
+    char username [USERNAME_MAXLENGTH],
+         password [PASSWORD_MAXLENGTH];
+
+    std::string dirPath;
+
+    bool usernameError;
+    int i;
 
+    if (!GetAccountsDir (exe_dir, dirPath))
+    {
+        printw ("%s\n", GetError ());
         return;
+    }
 
     do // keep asking for a user name until a correct input is recieved
     {
@@ -177,16 +188,60 @@ void OnMakeAccount (const std::string &exe_dir)
 
     PromptPassword (password, PASSWORD_MAXLENGTH);
 
-    // Create an account file for the server to read
+    // Add the account to the database, that the server reads
     if (MakeAccount (dirPath.c_str(), username, password))
     {
-        printw ("created file successfully\n");
+        printw ("created account successfully\n");
     }
     else
     {
         printw ("%s\n", GetError ());
     }
 }
+void OnDeleteAccount (const std::string &exe_dir)
+{
+    char username [USERNAME_MAXLENGTH];
+    std::string dirPath;
+
+    if (!GetAccountsDir (exe_dir, dirPath))
+    {
+        printw ("%s\n", GetError ());
+        return;
+    }
+
+    PromptUsername (username, USERNAME_MAXLENGTH);
+
+    if (delAccount (dirPath.c_str(), username))
+    {
+        printw ("deleted account successfully\n");
+    }
+    else
+    {
+        printw ("%s\n", GetError ());
+    }
+}
+void OnMigrateAccounts (const std::string &exe_dir)
+{
+    std::string dirPath;
+    int nImported, nSkipped;
+
+    if (!GetAccountsDir (exe_dir, dirPath))
+    {
+        printw ("%s\n", GetError ());
+        return;
+    }
+
+    nImported = ImportAccountFiles (dirPath.c_str(), &nSkipped);
+    if (nImported < 0)
+    {
+        printw ("%s\n", GetError ());
+        return;
+    }
+
+    printw ("imported %d account files, skipped %d\n", nImported, nSkipped);
+    if (nSkipped > 0)
+        printw ("last skipped: %s\n", GetError ());
+}
 bool OnCommand(const char* cmd, const std::string &exe_dir)
 {
     // Execute command 'cmd', given by user
@@ -200,13 +255,24 @@ bool OnCommand(const char* cmd, const std::string &exe_dir)
     {
         OnMakeAccount (exe_dir);
     }
+    else if (strcmp (cmd, "delete-account")==0)
+    {
+        OnDeleteAccount (exe_dir);
+    }
+    else if (strcmp (cmd, "migrate-accounts")==0)
+    {
+        OnMigrateAccounts (exe_dir);
+    }
     else if (emptyline (cmd) || strcmp (cmd, "help") == 0)
     {
         // If an empty line was entered, print help:
 
         printw ("quit: exit application\n");
-        printw ("make-account: create new account file\n");
+        printw ("make-account: create new account\n");
+        printw ("delete-account: remove an account\n");
+        printw ("migrate-accounts: import old style account files into the database\n");
         printw ("help: print this info\n");
+        printw ("\nfor batches, run from the shell: manager import <file>|- or manager import --generate <count>\n");
     }
     else
     {
@@ -216,13 +282,26 @@ bool OnCommand(const char* cmd, const std::string &exe_dir)
 }
 int main (int argc, char** argv)
 {
-    initscr (); // enable ncurses
-
     const char *x = strrchr (argv[0], PATH_SEPARATOR);
     std::string exe_dir = "." + PATH_SEPARATOR;
     if (x)
         exe_dir = std::string (argv[0], 1 + x - argv[0]);
 
+    // Batch mode, for scripts:
+    if (argc > 1 && strcmp (argv[1], "import") == 0)
+    {
+        std::string dirPath;
+        if (!GetAccountsDir (exe_dir, dirPath))
+        {
+            fprintf (stderr, "%s\n", GetError ());
+            return 1;
+        }
+
+        return RunImport (argc, argv, dirPath.c_str ());
+    }
+
+    initscr (); // enable ncurses
+
     const int cmdlen = 256;
     int n;
     char cmd [cmdlen];
@@ -0,0 +1,132 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#include "pacer.h"
+
+#define IDLE_DELAY 3000 // ticks, default
+#define SPIN_MARGIN 2.0f // ms, the last part of the wait is spun instead of slept
+
+FramePacer::FramePacer (void)
+ : deadline (0), lastFrame (0),
+   targetFPS (60.0f), idleFPS (10.0f),
+   vsync (false), idle (false),
+   lastActivityTicks (0), idleDelay (IDLE_DELAY)
+{
+    frequency = SDL_GetPerformanceFrequency ();
+
+    for (int i = 0; i < FRAMETIME_BUCKETS; i++)
+        histogram [i] = 0;
+}
+bool FramePacer::SetVSync (const bool on)
+{
+    if (on)
+        // -1 is adaptive vsync, not all drivers have it.
+        vsync = SDL_GL_SetSwapInterval (-1) == 0 || SDL_GL_SetSwapInterval (1) == 0;
+    else
+        vsync = SDL_GL_SetSwapInterval (0) == 0 ? false : vsync;
+
+    return vsync == on;
+}
+void FramePacer::OnActivity (void)
+{
+    lastActivityTicks = SDL_GetTicks ();
+}
+void FramePacer::Measure (const Uint64 now)
+{
+    if (lastFrame > 0)
+    {
+        float ms = 1000.0f * (now - lastFrame) / frequency;
+
+        int i = 0;
+        while (ms >= 2.0f && i < FRAMETIME_BUCKETS - 1)
+        {
+            ms /= 2;
+            i ++;
+        }
+        histogram [i] ++;
+    }
+
+    lastFrame = now;
+}
+void FramePacer::Wait (const bool focus)
+{
+    idle = !focus || (idleDelay > 0 && (SDL_GetTicks () - lastActivityTicks) > idleDelay);
+
+    const float fps = idle ? idleFPS : targetFPS;
+    Uint64 now = SDL_GetPerformanceCounter ();
+
+    // When vsync is on, swapping the buffers already waits for the display.
+    if (fps <= 0.0f || (vsync && !idle))
+    {
+        Measure (now);
+        deadline = now;
+        return;
+    }
+
+    const Uint64 period = Uint64 (frequency / fps);
+
+    deadline += period;
+    if (deadline < now || deadline > now + period)
+        deadline = now + period; // behind schedule or rate changed, don't try to catch up
+
+    const Uint64 margin = Uint64 (frequency * SPIN_MARGIN / 1000);
+    if (deadline > now + margin)
+    {
+        Uint32 ms = Uint32 (1000 * (deadline - now - margin) / frequency);
+
+        if (idle)
+        {
+            // Wake up for input, so that idle mode doesn't add latency.
+            if (SDL_WaitEventTimeout (NULL, ms))
+            {
+                OnActivity ();
+                deadline = SDL_GetPerformanceCounter ();
+            }
+        }
+        else
+            SDL_Delay (ms);
+    }
+
+    while ((now = SDL_GetPerformanceCounter ()) < deadline)
+        ; // spin
+
+    Measure (now);
+}
+void FramePacer::PrintHistogram (FILE *f) const
+{
+    Uint64 total = 0;
+    for (int i = 0; i < FRAMETIME_BUCKETS; i++)
+        total += histogram [i];
+
+    if (total <= 0)
+        return;
+
+    fprintf (f, "frame times:\n");
+    for (int i = 0; i < FRAMETIME_BUCKETS; i++)
+    {
+        if (i < FRAMETIME_BUCKETS - 1)
+            fprintf (f, "%5d - %5d ms: ", i > 0 ? 1 << i : 0, 1 << (i + 1));
+        else
+            fprintf (f, "%5d ms and up: ", 1 << i);
+
+        fprintf (f, "%6.2f %%\n", 100.0 * histogram [i] / total);
+    }
+}
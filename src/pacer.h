@@ -0,0 +1,92 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+
+#define FRAMETIME_BUCKETS 10 // the last one also holds everything above
+
+/*
+    Decides when the next frame may start, so that the main loop doesn't
+    render more frames than needed.
+
+    It has two rates: the target rate for normal use, and a low idle rate
+    for when the window is unfocused or nothing happened for a while.
+ */
+class FramePacer
+{
+private:
+    Uint64 frequency,
+           deadline, // performance counter value, when the next frame may start
+           lastFrame;
+
+    float targetFPS, idleFPS; // 0 for unlimited
+    bool vsync, idle;
+    Uint32 lastActivityTicks,
+           idleDelay; // ticks without activity, before going idle
+
+    /*
+        Frame times, from start to start.
+        Bucket i holds the frames that took [2^i, 2^(i+1)) ms,
+        bucket 0 also holds the ones under 1 ms.
+     */
+    Uint64 histogram [FRAMETIME_BUCKETS];
+
+    void Measure (const Uint64 now);
+public:
+    FramePacer (void);
+
+    void SetTargetFPS (const float fps) { targetFPS = fps; }
+    void SetIdleFPS (const float fps) { idleFPS = fps; }
+
+    // 0 means only go idle when the window is unfocused, for scenes that are always moving.
+    void SetIdleDelay (const Uint32 ticks) { idleDelay = ticks; }
+
+    /**
+     * Sets the swap interval of the current GL context. Prefers adaptive vsync.
+     * :returns: false if the driver doesn't allow it
+     */
+    bool SetVSync (const bool);
+
+    /**
+     * Tells the pacer that something happened, that must be shown soon.
+     */
+    void OnActivity (void);
+
+    /**
+     * Call this once per frame, after swapping the buffers.
+     * 'focus' tells whether the window has input focus.
+     *
+     * Sleeps until the next frame's deadline, and spins during the last part,
+     * because the system's sleep isn't precise enough.
+     * In idle mode, any new event ends the wait early.
+     */
+    void Wait (const bool focus);
+
+    bool IsIdle (void) const { return idle; }
+
+    void PrintHistogram (FILE *) const;
+};
+
+#endif // PACER_H
@@ -0,0 +1,221 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#include <cstring>
+#include <errno.h>
+
+#include "capture.h"
+#include "../err.h"
+
+#define CAPTURE_MAGIC_LENGTH 4
+
+/**
+ * Converts a performance counter difference to microseconds, without overflowing.
+ */
+Uint64 CounterToMicroseconds (const Uint64 counter)
+{
+    Uint64 frequency = SDL_GetPerformanceFrequency ();
+
+    return (counter / frequency) * 1000000 + ((counter % frequency) * 1000000) / frequency;
+}
+CaptureWriter::CaptureWriter ()
+ : pFile (NULL), startCounter (0)
+{
+    pMutex = SDL_CreateMutex ();
+}
+CaptureWriter::~CaptureWriter ()
+{
+    Close ();
+
+    SDL_DestroyMutex (pMutex);
+}
+bool CaptureWriter::Open (const char *path)
+{
+    Uint32 version = CAPTURE_VERSION;
+
+    if (SDL_LockMutex (pMutex) != 0)
+    {
+        SetError ("could not lock mutex: %s", SDL_GetError ());
+        return false;
+    }
+
+    if (pFile)
+        fclose (pFile);
+
+    pFile = fopen (path, "wb");
+    if (!pFile)
+    {
+        SetError ("cannot open %s for writing: %s", path, strerror (errno));
+        SDL_UnlockMutex (pMutex);
+        return false;
+    }
+
+    if (fwrite (CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH, 1, pFile) != 1 ||
+        fwrite (&version, sizeof (version), 1, pFile) != 1)
+    {
+        SetError ("cannot write to %s: %s", path, strerror (errno));
+
+        fclose (pFile);
+        pFile = NULL;
+        SDL_UnlockMutex (pMutex);
+        return false;
+    }
+
+    startCounter = SDL_GetPerformanceCounter ();
+
+    SDL_UnlockMutex (pMutex);
+    return true;
+}
+void CaptureWriter::Close (void)
+{
+    if (SDL_LockMutex (pMutex) != 0)
+        return;
+
+    if (pFile)
+    {
+        fclose (pFile);
+        pFile = NULL;
+    }
+
+    SDL_UnlockMutex (pMutex);
+}
+bool CaptureWriter::IsOpen (void) const
+{
+    // Open and Close may be called on another thread, during a reload.
+    if (SDL_LockMutex (pMutex) != 0)
+        return false;
+
+    bool open = pFile != NULL;
+
+    SDL_UnlockMutex (pMutex);
+    return open;
+}
+bool CaptureWriter::Write (const Uint8 type, const IPaddress &address, const void *data, const int len)
+{
+    Uint64 time;
+    Uint16 length = len;
+    bool success;
+
+    if (SDL_LockMutex (pMutex) != 0)
+    {
+        SetError ("could not lock mutex: %s", SDL_GetError ());
+        return false;
+    }
+
+    if (!pFile)
+    {
+        SDL_UnlockMutex (pMutex);
+        return true;
+    }
+
+    time = CounterToMicroseconds (SDL_GetPerformanceCounter () - startCounter);
+
+    success = fwrite (&type, sizeof (type), 1, pFile) == 1 &&
+              fwrite (&time, sizeof (time), 1, pFile) == 1 &&
+              fwrite (&address.host, sizeof (address.host), 1, pFile) == 1 &&
+              fwrite (&address.port, sizeof (address.port), 1, pFile) == 1 &&
+              fwrite (&length, sizeof (length), 1, pFile) == 1 &&
+              (length == 0 || fwrite (data, length, 1, pFile) == 1);
+
+    if (!success)
+        SetError ("error writing capture record: %s", strerror (errno));
+
+    SDL_UnlockMutex (pMutex);
+    return success;
+}
+CaptureReader::CaptureReader ()
+ : pFile (NULL), failed (false)
+{
+}
+CaptureReader::~CaptureReader ()
+{
+    Close ();
+}
+bool CaptureReader::Open (const char *path)
+{
+    char magic [CAPTURE_MAGIC_LENGTH];
+    Uint32 version;
+
+    Close ();
+    failed = false;
+
+    pFile = fopen (path, "rb");
+    if (!pFile)
+    {
+        SetError ("cannot open %s: %s", path, strerror (errno));
+        return false;
+    }
+
+    if (fread (magic, CAPTURE_MAGIC_LENGTH, 1, pFile) != 1 ||
+        strncmp (magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) != 0)
+    {
+        SetError ("%s is not a capture file", path);
+        Close ();
+        return false;
+    }
+
+    if (fread (&version, sizeof (version), 1, pFile) != 1 || version != CAPTURE_VERSION)
+    {
+        SetError ("%s has an unsupported capture version", path);
+        Close ();
+        return false;
+    }
+
+    return true;
+}
+void CaptureReader::Close (void)
+{
+    if (pFile)
+    {
+        fclose (pFile);
+        pFile = NULL;
+    }
+}
+bool CaptureReader::Next (CaptureRecord &record)
+{
+    Uint16 length;
+
+    if (!pFile)
+        return false;
+
+    if (fread (&record.type, sizeof (record.type), 1, pFile) != 1)
+        return false; // end of file
+
+    if (fread (&record.time, sizeof (record.time), 1, pFile) != 1 ||
+        fread (&record.address.host, sizeof (record.address.host), 1, pFile) != 1 ||
+        fread (&record.address.port, sizeof (record.address.port), 1, pFile) != 1 ||
+        fread (&length, sizeof (length), 1, pFile) != 1)
+    {
+        SetError ("truncated capture record");
+        failed = true;
+        return false;
+    }
+
+    record.data.resize (length);
+    if (length > 0 && fread (&record.data [0], length, 1, pFile) != 1)
+    {
+        SetError ("truncated capture record");
+        failed = true;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,96 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <SDL2/SDL_net.h>
+#include <stdio.h>
+#include <string>
+
+/*
+    A capture file records the server's network traffic, so that
+    it can be replayed later. It starts with CAPTURE_MAGIC and
+    the format version, followed by records of:
+
+        type (1 byte), time (8 bytes), host (4 bytes), port (2 bytes),
+        payload length (2 bytes) and payload.
+
+    Time is in microseconds since the start of the capture. Host and
+    port are in network byte order, like in IPaddress, the rest is in
+    the byte order of the recording machine.
+ */
+#define CAPTURE_MAGIC "GTCP"
+#define CAPTURE_VERSION 1
+
+enum CaptureRecordType
+{
+    CAPTURE_UDPIN = 1,  // datagram from a client
+    CAPTURE_LOGIN = 2,  // successful login, payload is a CaptureLogin
+    CAPTURE_UDPOUT = 3  // datagram to a client
+};
+
+struct CaptureRecord
+{
+    Uint8 type;
+    Uint64 time;
+    IPaddress address;
+    std::string data;
+};
+
+/**
+ * Can be used from any thread.
+ */
+class CaptureWriter
+{
+private:
+    FILE *pFile;
+    SDL_mutex *pMutex;
+    Uint64 startCounter;
+public:
+    CaptureWriter ();
+    ~CaptureWriter ();
+
+    bool Open (const char *path);
+    void Close (void);
+    bool IsOpen (void) const;
+
+    bool Write (const Uint8 type, const IPaddress &, const void *data, const int len);
+};
+
+class CaptureReader
+{
+private:
+    FILE *pFile;
+    bool failed;
+public:
+    CaptureReader ();
+    ~CaptureReader ();
+
+    bool Open (const char *path);
+    void Close (void);
+
+    // returns false at the end of the file, or on error
+    bool Next (CaptureRecord &);
+    bool Failed (void) const { return failed; }
+};
+
+#endif // CAPTURE_H
@@ -0,0 +1,267 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#include <stdio.h>
+#include <cstring>
+#include <errno.h>
+
+#ifdef __unix__
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#include "checkpoint.h"
+#include "../err.h"
+
+#define CHECKPOINT_MAGIC_LENGTH 4
+
+struct CheckpointHeader
+{
+    char magic [CHECKPOINT_MAGIC_LENGTH];
+    Uint32 version,
+           userSize, chatSize,
+           nUsers, nChats;
+    Uint64 savedTime; // seconds since the epoch
+};
+
+size_t CheckpointSize (const size_t nUsers, const size_t nChats)
+{
+    return sizeof (CheckpointHeader) + nUsers * sizeof (CheckpointUser)
+                                     + nChats * sizeof (CheckpointChat);
+}
+void FillCheckpoint (Uint8 *p, const Uint64 savedTime,
+                     const std::vector <CheckpointUser> &users,
+                     const std::vector <CheckpointChat> &chats)
+{
+    CheckpointHeader header;
+    memcpy (header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH);
+    header.version = CHECKPOINT_VERSION;
+    header.userSize = sizeof (CheckpointUser);
+    header.chatSize = sizeof (CheckpointChat);
+    header.nUsers = users.size ();
+    header.nChats = chats.size ();
+    header.savedTime = savedTime;
+
+    memcpy (p, &header, sizeof (header));
+    p += sizeof (header);
+
+    if (!users.empty ())
+        memcpy (p, users.data (), users.size () * sizeof (CheckpointUser));
+    p += users.size () * sizeof (CheckpointUser);
+
+    if (!chats.empty ())
+        memcpy (p, chats.data (), chats.size () * sizeof (CheckpointChat));
+}
+bool ParseCheckpoint (const Uint8 *p, const size_t size, Uint64 &savedTime,
+                      std::vector <CheckpointUser> &users,
+                      std::vector <CheckpointChat> &chats)
+{
+    CheckpointHeader header;
+
+    if (size < sizeof (header))
+    {
+        SetError ("checkpoint file is too small");
+        return false;
+    }
+    memcpy (&header, p, sizeof (header));
+
+    if (strncmp (header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH) != 0)
+    {
+        SetError ("not a checkpoint file");
+        return false;
+    }
+
+    if (header.version != CHECKPOINT_VERSION ||
+        header.userSize != sizeof (CheckpointUser) ||
+        header.chatSize != sizeof (CheckpointChat))
+    {
+        SetError ("checkpoint file has an unsupported version");
+        return false;
+    }
+
+    if (size != CheckpointSize (header.nUsers, header.nChats))
+    {
+        SetError ("checkpoint file has the wrong size");
+        return false;
+    }
+
+    savedTime = header.savedTime;
+    p += sizeof (header);
+
+    const CheckpointUser *pUsers = (const CheckpointUser *)p;
+    users.assign (pUsers, pUsers + header.nUsers);
+    p += header.nUsers * sizeof (CheckpointUser);
+
+    const CheckpointChat *pChats = (const CheckpointChat *)p;
+    chats.assign (pChats, pChats + header.nChats);
+
+    return true;
+}
+#ifdef __unix__
+bool WriteCheckpoint (const char *path, const Uint64 savedTime,
+                      const std::vector <CheckpointUser> &users,
+                      const std::vector <CheckpointChat> &chats)
+{
+    std::string tmpPath = std::string (path) + ".tmp";
+    size_t size = CheckpointSize (users.size (), chats.size ());
+    void *p;
+    int fd;
+
+    fd = open (tmpPath.c_str (), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        SetError ("cannot open %s: %s", tmpPath.c_str (), strerror (errno));
+        return false;
+    }
+
+    if (ftruncate (fd, size) != 0)
+    {
+        SetError ("cannot resize %s: %s", tmpPath.c_str (), strerror (errno));
+        close (fd);
+        return false;
+    }
+
+    p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        SetError ("cannot map %s: %s", tmpPath.c_str (), strerror (errno));
+        close (fd);
+        return false;
+    }
+
+    FillCheckpoint ((Uint8 *)p, savedTime, users, chats);
+
+    bool synced = msync (p, size, MS_SYNC) == 0;
+    munmap (p, size);
+    close (fd);
+
+    if (!synced)
+    {
+        SetError ("cannot write %s: %s", tmpPath.c_str (), strerror (errno));
+        return false;
+    }
+
+    // Atomic, so there's always a complete checkpoint:
+    if (rename (tmpPath.c_str (), path) != 0)
+    {
+        SetError ("cannot rename %s to %s: %s", tmpPath.c_str (), path, strerror (errno));
+        return false;
+    }
+
+    return true;
+}
+bool ReadCheckpoint (const char *path, Uint64 &savedTime,
+                     std::vector <CheckpointUser> &users,
+                     std::vector <CheckpointChat> &chats)
+{
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0)
+    {
+        SetError ("cannot open %s: %s", path, strerror (errno));
+        return false;
+    }
+
+    if (fstat (fd, &st) != 0 || st.st_size <= 0)
+    {
+        SetError ("cannot read %s", path);
+        close (fd);
+        return false;
+    }
+
+    p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (p == MAP_FAILED)
+    {
+        SetError ("cannot map %s: %s", path, strerror (errno));
+        return false;
+    }
+
+    bool success = ParseCheckpoint ((const Uint8 *)p, st.st_size, savedTime, users, chats);
+
+    munmap (p, st.st_size);
+
+    return success;
+}
+#else
+bool WriteCheckpoint (const char *path, const Uint64 savedTime,
+                      const std::vector <CheckpointUser> &users,
+                      const std::vector <CheckpointChat> &chats)
+{
+    std::string tmpPath = std::string (path) + ".tmp";
+    std::vector <Uint8> buffer (CheckpointSize (users.size (), chats.size ()));
+    FILE *pFile;
+
+    FillCheckpoint (buffer.data (), savedTime, users, chats);
+
+    pFile = fopen (tmpPath.c_str (), "wb");
+    if (!pFile)
+    {
+        SetError ("cannot open %s: %s", tmpPath.c_str (), strerror (errno));
+        return false;
+    }
+
+    bool written = fwrite (buffer.data (), buffer.size (), 1, pFile) == 1;
+    fclose (pFile);
+
+    if (!written)
+    {
+        SetError ("cannot write %s: %s", tmpPath.c_str (), strerror (errno));
+        return false;
+    }
+
+    remove (path); // rename doesn't replace on windows
+    if (rename (tmpPath.c_str (), path) != 0)
+    {
+        SetError ("cannot rename %s to %s: %s", tmpPath.c_str (), path, strerror (errno));
+        return false;
+    }
+
+    return true;
+}
+bool ReadCheckpoint (const char *path, Uint64 &savedTime,
+                     std::vector <CheckpointUser> &users,
+                     std::vector <CheckpointChat> &chats)
+{
+    std::vector <Uint8> buffer;
+    Uint8 chunk [4096];
+    size_t n;
+    FILE *pFile;
+
+    pFile = fopen (path, "rb");
+    if (!pFile)
+    {
+        SetError ("cannot open %s: %s", path, strerror (errno));
+        return false;
+    }
+
+    while ((n = fread (chunk, 1, sizeof (chunk), pFile)) > 0)
+        buffer.insert (buffer.end (), chunk, chunk + n);
+    fclose (pFile);
+
+    return ParseCheckpoint (buffer.data (), buffer.size (), savedTime, users, chats);
+}
+#endif
@@ -0,0 +1,51 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+
+#include "server.h"
+
+/*
+    A checkpoint file holds the sessions and chat of a server, so that
+    a restarted server can continue where the previous one stopped.
+
+    It starts with a header, followed by the user records and then
+    the chat records. The header holds the record sizes, so that files
+    of a different build are rejected.
+ */
+#define CHECKPOINT_MAGIC "GTCK"
+#define CHECKPOINT_VERSION 1
+
+/**
+ * Writes to a temporary file first, then renames it.
+ */
+bool WriteCheckpoint (const char *path, const Uint64 savedTime,
+                      const std::vector <CheckpointUser> &,
+                      const std::vector <CheckpointChat> &);
+
+bool ReadCheckpoint (const char *path, Uint64 &savedTime,
+                     std::vector <CheckpointUser> &,
+                     std::vector <CheckpointChat> &);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,158 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <SDL2/SDL.h>
+#include <deque>
+#include <algorithm>
+
+struct QueueStats
+{
+    size_t size, maxSize, capacity;
+    Uint64 nPushed, nRejected;
+    float meanWaitMS, maxWaitMS; // time between push and pop
+};
+
+/*
+    A fixed capacity queue between threads. Pushing never blocks,
+    it fails when the queue is full, so that the producer can tell
+    its client to try again later.
+ */
+template <typename T>
+class BoundedQueue
+{
+private:
+    struct Entry
+    {
+        T value;
+        Uint64 pushCounter;
+    };
+    std::deque <Entry> entries;
+    size_t capacity;
+
+    SDL_mutex *pMutex;
+    SDL_cond *pCond;
+
+    size_t maxSize;
+    Uint64 nPushed, nPopped, nRejected,
+           waitCounter, maxWaitCounter;
+
+    // must hold pMutex
+    void PopFront (T &value)
+    {
+        Uint64 wait = SDL_GetPerformanceCounter () - entries.front ().pushCounter;
+        waitCounter += wait;
+        maxWaitCounter = std::max (maxWaitCounter, wait);
+        nPopped ++;
+
+        value = entries.front ().value;
+        entries.pop_front ();
+    }
+public:
+    BoundedQueue (const size_t c)
+     : capacity (c), maxSize (0),
+       nPushed (0), nPopped (0), nRejected (0),
+       waitCounter (0), maxWaitCounter (0)
+    {
+        pMutex = SDL_CreateMutex ();
+        pCond = SDL_CreateCond ();
+    }
+    ~BoundedQueue ()
+    {
+        SDL_DestroyCond (pCond);
+        SDL_DestroyMutex (pMutex);
+    }
+
+    bool TryPush (const T &value)
+    {
+        if (SDL_LockMutex (pMutex) != 0)
+            return false;
+
+        if (entries.size () >= capacity)
+        {
+            nRejected ++;
+            SDL_UnlockMutex (pMutex);
+            return false;
+        }
+
+        Entry entry;
+        entry.value = value;
+        entry.pushCounter = SDL_GetPerformanceCounter ();
+        entries.push_back (entry);
+
+        nPushed ++;
+        maxSize = std::max (maxSize, entries.size ());
+
+        SDL_CondSignal (pCond);
+        SDL_UnlockMutex (pMutex);
+        return true;
+    }
+
+    // Waits at most 'timeout' ticks for a value, returns false if there is none.
+    bool Pop (T &value, const Uint32 timeout)
+    {
+        if (SDL_LockMutex (pMutex) != 0)
+            return false;
+
+        if (entries.empty () && timeout > 0)
+            SDL_CondWaitTimeout (pCond, pMutex, timeout);
+
+        bool popped = !entries.empty ();
+        if (popped)
+            PopFront (value);
+
+        SDL_UnlockMutex (pMutex);
+        return popped;
+    }
+
+    bool IsFull (void)
+    {
+        if (SDL_LockMutex (pMutex) != 0)
+            return true;
+
+        bool full = entries.size () >= capacity;
+
+        SDL_UnlockMutex (pMutex);
+        return full;
+    }
+
+    void GetStats (QueueStats &stats)
+    {
+        if (SDL_LockMutex (pMutex) != 0)
+            return;
+
+        double frequency = SDL_GetPerformanceFrequency ();
+
+        stats.size = entries.size ();
+        stats.maxSize = maxSize;
+        stats.capacity = capacity;
+        stats.nPushed = nPushed;
+        stats.nRejected = nRejected;
+        stats.meanWaitMS = nPopped > 0 ? 1000.0 * waitCounter / (nPopped * frequency) : 0.0f;
+        stats.maxWaitMS = 1000.0 * maxWaitCounter / frequency;
+
+        SDL_UnlockMutex (pMutex);
+    }
+};
+
+#endif // QUEUE_H
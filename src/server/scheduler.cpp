@@ -0,0 +1,196 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#include <algorithm>
+#include <vector>
+
+#include "scheduler.h"
+
+#define STATE_MAXAGE 1000 // ticks, older queued states are dropped
+#define EVENTS_MAXQUEUED 1024
+
+#define FARINTERVAL_MIN 100 // ticks
+#define FARINTERVAL_MAX 1000
+#define FARINTERVAL_PER_RTT 2
+
+#define CONGESTION_RTT_FACTOR 2
+#define CONGESTION_RTT_MARGIN 50 // ticks
+#define RATE_DECREASE 0.7f
+#define RATE_INCREASE 1024.0f // bytes per second, per rtt sample
+
+#define BURST_SECONDS 0.25f
+
+TokenBucket::TokenBucket (const float r, const float b)
+ : rate (r), burst (b), tokens (b), lastTicks (0)
+{
+}
+void TokenBucket::SetRate (const float r, const float b)
+{
+    rate = r;
+    burst = b;
+    tokens = std::min (tokens, burst);
+}
+void TokenBucket::Refill (const Uint32 ticks)
+{
+    tokens = std::min (burst, tokens + rate * (ticks - lastTicks) / 1000);
+    lastTicks = ticks;
+}
+bool TokenBucket::Take (const float n)
+{
+    if (tokens < n)
+        return false;
+
+    tokens -= n;
+    return true;
+}
+SendScheduler::SendScheduler (const float initialRate, const float _minRate, const float _maxRate)
+ : bandwidth (initialRate, initialRate * BURST_SECONDS),
+   minRate (_minRate), maxRate (_maxRate),
+   rtt (0), minRTT (0),
+   farInterval (FARINTERVAL_MIN), lastFarTicks (0),
+   nDropped (0), nMerged (0)
+{
+}
+void SendScheduler::QueueEvent (const Uint8 *data, const int len)
+{
+    if (events.size () >= EVENTS_MAXQUEUED)
+    {
+        // The client is not keeping up at all, it will time out anyway.
+        events.pop_front ();
+        nDropped ++;
+    }
+
+    events.push_back (std::string ((const char *)data, len));
+}
+void SendScheduler::QueueState (const char *about, const SendClass sendClass,
+                                const Uint8 *data, const int len, const Uint32 ticks)
+{
+    std::string key (about);
+    std::map <std::string, QueuedState> &states = (sendClass == SENDCLASS_NEARSTATE) ? nearStates : farStates,
+                                        &otherStates = (sendClass == SENDCLASS_NEARSTATE) ? farStates : nearStates;
+    std::map <std::string, QueuedState>::iterator it;
+
+    // A merged state keeps its place in the line, else it could wait forever.
+    Uint32 queuedTicks = ticks;
+
+    // The user might have moved from near to far or vice versa:
+    if ((it = otherStates.find (key)) != otherStates.end ())
+    {
+        queuedTicks = it->second.ticks;
+        otherStates.erase (it);
+        nMerged ++;
+    }
+    else if ((it = states.find (key)) != states.end ())
+    {
+        queuedTicks = it->second.ticks;
+        nMerged ++;
+    }
+
+    QueuedState &state = states [key];
+    state.data.assign ((const char *)data, len);
+    state.ticks = queuedTicks;
+}
+void SendScheduler::Forget (const char *about)
+{
+    std::string key (about);
+
+    nearStates.erase (key);
+    farStates.erase (key);
+}
+void SendScheduler::ForgetStates (void)
+{
+    nearStates.clear ();
+    farStates.clear ();
+}
+void SendScheduler::OnRTT (const Uint32 _rtt)
+{
+    rtt = _rtt;
+    if (minRTT <= 0 || rtt < minRTT)
+        minRTT = std::max ((Uint32)1, rtt);
+
+    // A round trip time, well above the minimum, means that queues are filling up.
+    float rate = bandwidth.GetRate ();
+    if (rtt > CONGESTION_RTT_FACTOR * minRTT + CONGESTION_RTT_MARGIN)
+        rate = std::max (minRate, rate * RATE_DECREASE);
+    else
+        rate = std::min (maxRate, rate + RATE_INCREASE);
+
+    bandwidth.SetRate (rate, rate * BURST_SECONDS);
+
+    farInterval = std::max ((Uint32)FARINTERVAL_MIN,
+                            std::min ((Uint32)FARINTERVAL_MAX, FARINTERVAL_PER_RTT * rtt));
+}
+void SendScheduler::FlushStates (const Uint32 ticks, std::map <std::string, QueuedState> &states,
+                                 const SendFunction &send)
+{
+    typedef std::map <std::string, QueuedState>::iterator StateIterator;
+
+    // Oldest first, so that every user gets a turn.
+    std::vector <StateIterator> order;
+    order.reserve (states.size ());
+    for (StateIterator it = states.begin (); it != states.end (); it++)
+        order.push_back (it);
+
+    std::stable_sort (order.begin (), order.end (),
+                      [ticks] (const StateIterator &a, const StateIterator &b)
+                      {
+                          return (ticks - a->second.ticks) > (ticks - b->second.ticks);
+                      });
+
+    for (const StateIterator &it : order)
+    {
+        const QueuedState &state = it->second;
+
+        if ((ticks - state.ticks) > STATE_MAXAGE)
+        {
+            states.erase (it);
+            nDropped ++;
+        }
+        else if (bandwidth.Take (state.data.size ()))
+        {
+            send ((const Uint8 *)state.data.c_str (), state.data.size ());
+            states.erase (it);
+        }
+        else // out of bandwidth, the rest waits for later
+            break;
+    }
+}
+void SendScheduler::Flush (const Uint32 ticks, const SendFunction &send)
+{
+    bandwidth.Refill (ticks);
+
+    while (!events.empty () && bandwidth.Take (events.front ().size ()))
+    {
+        send ((const Uint8 *)events.front ().c_str (), events.front ().size ());
+        events.pop_front ();
+    }
+
+    if (!events.empty ())
+        return;
+
+    FlushStates (ticks, nearStates, send);
+
+    if ((ticks - lastFarTicks) >= farInterval)
+    {
+        FlushStates (ticks, farStates, send);
+        lastFarTicks = ticks;
+    }
+}
@@ -0,0 +1,119 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <SDL2/SDL.h>
+#include <functional>
+#include <string>
+#include <list>
+#include <map>
+
+/*
+    A token bucket fills up at 'rate' tokens per second, until
+    it holds 'burst' tokens. Taking tokens fails if there aren't enough.
+    Time is passed in by the caller, so that it can be replayed.
+ */
+class TokenBucket
+{
+private:
+    float rate, burst, tokens;
+    Uint32 lastTicks;
+public:
+    TokenBucket (const float rate, const float burst);
+
+    void SetRate (const float rate, const float burst);
+    float GetRate (void) const { return rate; }
+
+    void Refill (const Uint32 ticks);
+    bool Take (const float n);
+};
+
+enum SendClass
+{
+    SENDCLASS_EVENT,     // logins, logouts, chat, only dropped when a client falls far behind
+    SENDCLASS_NEARSTATE, // states of users, near the receiving user
+    SENDCLASS_FARSTATE   // states of the other users
+};
+
+typedef std::function <void (const Uint8 *data, int len)> SendFunction;
+
+/*
+    Outgoing queue for one client connection.
+
+    Events go out first, then nearby states, then distant states,
+    as far as the bandwidth estimate allows. A queued state is replaced
+    when a newer state of the same user comes in, so under congestion
+    states get merged instead of piling up. States go out oldest first.
+    Distant states go out less often as the round trip time increases.
+ */
+class SendScheduler
+{
+private:
+    TokenBucket bandwidth;
+    float minRate, maxRate;
+
+    Uint32 rtt, minRTT,
+           farInterval,
+           lastFarTicks;
+
+    struct QueuedState
+    {
+        std::string data;
+        Uint32 ticks; // when first queued, merging keeps it
+    };
+
+    std::list <std::string> events;
+    std::map <std::string, QueuedState> nearStates, farStates;
+
+    Uint64 nDropped, nMerged;
+
+    void FlushStates (const Uint32 ticks, std::map <std::string, QueuedState> &states,
+                      const SendFunction &send);
+public:
+    // rates are in bytes per second
+    SendScheduler (const float initialRate, const float minRate, const float maxRate);
+
+    void QueueEvent (const Uint8 *data, const int len);
+
+    // 'about' is the name of the user whose state it is, 'ticks' is the current time.
+    void QueueState (const char *about, const SendClass, const Uint8 *data, const int len,
+                     const Uint32 ticks);
+
+    // Removes the queued states of user 'about'.
+    void Forget (const char *about);
+
+    // Removes all queued states, for when the receiving user moves to another room.
+    void ForgetStates (void);
+
+    // Updates the bandwidth estimate with a new round trip time, in ticks.
+    void OnRTT (const Uint32 rtt);
+
+    void Flush (const Uint32 ticks, const SendFunction &send);
+
+    Uint32 GetRTT (void) const { return rtt; }
+    float GetRate (void) const { return bandwidth.GetRate (); }
+    Uint64 GetDroppedCount (void) const { return nDropped; }
+    Uint64 GetMergedCount (void) const { return nMerged; }
+};
+
+#endif // SCHEDULER_H
@@ -24,10 +24,14 @@
 #include <string.h>
 #include <errno.h>
 #include <ctime>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
 
 #include <openssl/err.h>
 
 #include "server.h"
+#include "checkpoint.h"
 
 #include "../io.h"
 #include "../err.h"
@@ -40,46 +44,96 @@
 #define PORT_SETTING "port"
 #define MAXLOGIN_SETTING "max-login"
 #define ACCOUNTSDIR_SETTING "accounts-dir"
+#define CLIENTRATE_SETTING "client-rate"
+#define STATERATE_SETTING "state-rate"
+#define STATEBURST_SETTING "state-burst"
+#define CHATRATE_SETTING "chat-rate"
+#define CHATBURST_SETTING "chat-burst"
+#define CAPTURE_SETTING "capture-file"
+#define LOGFILE_SETTING "log-file"
+#define CHECKPOINTFILE_SETTING "checkpoint-file"
+#define CHECKPOINTINTERVAL_SETTING "checkpoint-interval"
 
 #define ACCOUNT_DIR "accounts"
 #define CONNECTION_PINGPERIOD 1000 // ticks
 
+// bytes per second, to each client:
+#define CLIENTRATE_DEFAULT 65536.0f
+#define CLIENTRATE_MIN 4096.0f
+#define CLIENTRATE_MAX 1048576.0f
+
+// per second, what each client may send us:
+#define STATERATE_DEFAULT 20
+#define STATEBURST_DEFAULT 10
+#define CHATRATE_DEFAULT 1
+#define CHATBURST_DEFAULT 5
+
+// pixels, states of users closer than this to a client are sent first
+#define NEARSTATE_DISTANCE 256.0f
+
 #define PROCESS_TAG "server"
 
 const int CONNECTION_TIMEOUT_TICKS = CONNECTION_TIMEOUT * 1000;
 
-Server::User::User (const IPaddress *pAddr, const char *_accountName, const UserParams *pParams)
+Server::User::User (const IPaddress *pAddr, const char *_accountName, const UserParams *pParams,
+                    const ClientRates *pRates)
+ : scheduler (pRates->sendBytes, CLIENTRATE_MIN, CLIENTRATE_MAX),
+   stateLimit (pRates->states, pRates->stateBurst),
+   chatLimit (pRates->chats, pRates->chatBurst),
+   hasPendingState (false),
+   nThrottledStates (0), nThrottledChats (0)
 {
     strcpy (accountName, _accountName);
     ticksSinceLastContact = 0;
+    ticksSincePing = 0;
+    pingTicks = 0;
+    pinging = false;
+    announced = false;
+    pRoom = NULL;
     memcpy (&address, pAddr, sizeof (IPaddress));
 
-    memcpy (&params, pParams, sizeof (UserParams));
+    SetParams (pParams);
     state.pos.x = -1000;
     state.pos.y = -1000;
+}
+void Server::User::SetParams (const UserParams *pParams)
+{
+    memcpy (&params, pParams, sizeof (UserParams));
 
-    ticksSinceLastContact = 0;
+    memset (descriptor, 0, USER_DESCRIPTOR_SIZE);
+    strncpy ((char *)descriptor, accountName, USERNAME_MAXLENGTH);
+    memcpy (descriptor + USERNAME_MAXLENGTH, &params, sizeof (UserParams));
 }
 
+/**
+ * Room names may only contain letters, digits, '-' and '_'.
+ */
+bool ValidRoomName (const char *name)
+{
+    int i;
+    for (i = 0; name [i]; i++)
+    {
+        if (i >= (ROOMNAME_MAXLENGTH - 1))
+            return false;
+
+        if (!(isalnum ((unsigned char)name [i]) || name [i] == '-' || name [i] == '_'))
+            return false;
+    }
+
+    return i > 0;
+}
 #define RSA_ERRBUF_SIZE 256
 
-int RecieveEncrypted (TCPsocket clientSocket,
-                      void *decrypted_data, const int decrypted_maxlen)
+/**
+ * Makes a key pair for one login. Used on the auth threads, because it takes long.
+ * :returns: NULL on failure
+ */
+RSA *GenerateKeyPair (void)
 {
-    int n_sent,
-        n_recieved,
-        keySize, keyPackageSize,
-        decryptedSize,
-        maxflen;
-    unsigned char *public_key_package, *public_key,
-                  encrypted [PACKET_MAXSIZE];
     char errbuf [RSA_ERRBUF_SIZE];
-
-    RSA* keyPair;
+    RSA *keyPair;
     BIGNUM *bn;
     bool success;
-    Uint8 signal;
-
 
     bn = BN_new ();
     BN_set_word (bn, 65537);
@@ -95,15 +149,190 @@ int RecieveEncrypted (TCPsocket clientSocket,
         SetError ("RSA key generation failed: %s", errbuf);
 
         RSA_free (keyPair);
+        return NULL;
+    }
+
+    return keyPair;
+}
+
+/**
+ * Like SDLNet_TCP_Recv, but gives up after 'timeout' ticks,
+ * so that slow clients can't hold a handshake thread forever.
+ */
+int RecieveWithTimeout (TCPsocket clientSocket, void *data, const int maxlen, const Uint32 timeout)
+{
+    SDLNet_SocketSet set = SDLNet_AllocSocketSet (1);
+    if (!set)
+    {
+        SetError ("SDLNet_AllocSocketSet: %s", SDLNet_GetError ());
+        return -1;
+    }
+
+    SDLNet_TCP_AddSocket (set, clientSocket);
+    int ready = SDLNet_CheckSockets (set, timeout);
+    SDLNet_FreeSocketSet (set);
+
+    if (ready <= 0)
+    {
+        SetError ("no data recieved within %u ms", timeout);
+        return -1;
+    }
+
+    int n = SDLNet_TCP_Recv (clientSocket, data, maxlen);
+    if (n < 0)
+        SetError ("%s", SDLNet_GetError ());
+    else if (n == 0)
+        SetError ("connection closed by peer");
+
+    return n;
+}
+void Server::SendSignal (TCPsocket clientSocket, const Uint8 signal)
+{
+    if (SDLNet_TCP_Send (clientSocket, &signal, 1) != 1)
+    {
+        Message (SERVER_MSG_ERROR, "WARNING, could not send signal 0x%x to user: %s",
+                 signal, SDLNet_GetError ());
+    }
+}
+
+/*
+    Logins go through stages, connected by bounded queues:
+
+    1. main loop: accepts the tcp connection
+    2. handshake threads: send a public key, recieve the encrypted login
+    3. auth threads: decrypt and check the password, make new keys when idle
+    4. main loop: add the user to the list and reply
+
+    When a queue is full, the client gets NETSIG_SERVERFULL right away.
+    The auth threads run at low priority, so that they don't slow down the main loop.
+ */
+#define HANDSHAKE_THREADS 4
+#define HANDSHAKE_TIMEOUT 5000 // ticks, per recieve
+#define LOGINQUEUE_CAPACITY 64
+#define KEYSTOCK_CAPACITY 8
+#define KEYSTOCK_WAIT 1000 // ticks, that a handshake waits for a key
+#define LOGINTHREAD_POLLTIMEOUT 100 // ticks
+
+void Server::StartLoginThreads (void)
+{
+    loginThreadsStop = false;
+
+    for (int i = 0; i < HANDSHAKE_THREADS; i++)
+    {
+        loginThreads.push_back (MakeSDLThread (
+            [this] { return this->HandshakeThread (); },
+            (std::string (PROCESS_TAG) + "_handshake_thread").c_str ()));
+    }
+
+    // Leave one cpu for the main loop:
+    int nAuthThreads = std::max (1, SDL_GetCPUCount () - 1);
+    for (int i = 0; i < nAuthThreads; i++)
+    {
+        loginThreads.push_back (MakeSDLThread (
+            [this] { return this->AuthThread (); },
+            (std::string (PROCESS_TAG) + "_auth_thread").c_str ()));
+    }
+}
+void Server::StopLoginThreads (void)
+{
+    TCPsocket clientSocket;
+    LoginJob *pJob;
+    RSA *keyPair;
+
+    loginThreadsStop = true;
+    for (SDL_Thread *pThread : loginThreads)
+        SDL_WaitThread (pThread, NULL);
+    loginThreads.clear ();
 
-        signal = NETSIG_INTERNALERROR;
-        if (SDLNet_TCP_Send (clientSocket, &signal, 1) != 1)
+    // Whatever is left in the queues, is dropped:
+    while (handshakeQueue.Pop (clientSocket, 0))
+        SDLNet_TCP_Close (clientSocket);
+
+    while (authQueue.Pop (pJob, 0) || commitQueue.Pop (pJob, 0))
+    {
+        if (pJob->keyPair)
+            RSA_free (pJob->keyPair);
+        SDLNet_TCP_Close (pJob->clientSocket);
+        delete pJob;
+    }
+
+    while (keyStock.Pop (keyPair, 0))
+        RSA_free (keyPair);
+}
+int Server::HandshakeThread (void)
+{
+    TCPsocket clientSocket;
+
+    while (!loginThreadsStop)
+    {
+        if (handshakeQueue.Pop (clientSocket, LOGINTHREAD_POLLTIMEOUT))
+            OnTCPConnection (clientSocket);
+    }
+
+    return 0;
+}
+int Server::AuthThread (void)
+{
+    LoginJob *pJob;
+    RSA *keyPair;
+
+    SDL_SetThreadPriority (SDL_THREAD_PRIORITY_LOW);
+
+    while (!loginThreadsStop)
+    {
+        // Logins go first, when there's nothing to do, stock up on keys.
+        if (authQueue.Pop (pJob, keyStock.IsFull () ? LOGINTHREAD_POLLTIMEOUT : 0))
         {
-            fprintf (stderr, "Could not send internal error to user: %s",
-                     SDLNet_GetError ());
+            Authenticate (pJob);
+
+            if (!commitQueue.TryPush (pJob))
+            {
+                SendSignal (pJob->clientSocket, NETSIG_SERVERFULL);
+                SDLNet_TCP_Close (pJob->clientSocket);
+                delete pJob;
+            }
         }
+        else if (!keyStock.IsFull ())
+        {
+            if (!(keyPair = GenerateKeyPair ()))
+            {
+                std::string reason = GetError ();
+                Message (SERVER_MSG_ERROR, "%s", reason.c_str ());
+                SDL_Delay (LOGINTHREAD_POLLTIMEOUT);
+            }
+            else if (!keyStock.TryPush (keyPair))
+                RSA_free (keyPair);
+        }
+    }
 
-        return -1;
+    return 0;
+}
+
+/**
+ * Runs on a handshake thread.
+ * :returns: true if the socket was passed on to the auth threads
+ */
+bool Server::OnLoginRequest (TCPsocket clientSocket, const IPaddress *pClientIP)
+{
+    int n_sent, n_recieved,
+        keySize, keyPackageSize;
+    unsigned char *public_key_package, *public_key;
+    char ip [100];
+    RSA *keyPair;
+
+    // If the server is full at this point, don't bother.
+    if (IsServerFull ())
+    {
+        SendSignal (clientSocket, NETSIG_SERVERFULL);
+        return false;
+    }
+
+    // The auth threads make the keys, if they're not keeping up, we're too busy.
+    if (!keyStock.Pop (keyPair, KEYSTOCK_WAIT))
+    {
+        Message (SERVER_MSG_ERROR, "WARNING, no key ready, refusing login");
+        SendSignal (clientSocket, NETSIG_SERVERFULL);
+        return false;
     }
 
     // Copy public key to byte array and send to user:
@@ -119,181 +348,198 @@ int RecieveEncrypted (TCPsocket clientSocket,
 
     if (n_sent != keyPackageSize)
     {
-        SetError ("Error sending key: %s", SDLNet_GetError());
+        Message (SERVER_MSG_ERROR, "Error sending key: %s", SDLNet_GetError());
         RSA_free (keyPair);
-        return -1;
+        return false;
     }
 
+    LoginJob *pJob = new LoginJob;
+    pJob->clientSocket = clientSocket;
+    pJob->clientIP = *pClientIP;
+    pJob->keyPair = keyPair;
+
     // Receive encrypted data from user:
-    n_recieved = SDLNet_TCP_Recv (clientSocket, encrypted, PACKET_MAXSIZE);
+    n_recieved = RecieveWithTimeout (clientSocket, pJob->encrypted, PACKET_MAXSIZE, HANDSHAKE_TIMEOUT);
     if (n_recieved <= 0)
     {
-        if (n_recieved < 0)
-
-            SetError ("Error recieving encrypted login: %s", SDLNet_GetError ());
-        else
-            SetError ("Connection unexpectedly closed while recieving encrypted login");
+        std::string reason = GetError ();
+        ip2String (*pClientIP, ip);
+        Message (SERVER_MSG_ERROR, "Error recieving encrypted login from %s: %s", ip, reason.c_str ());
 
         RSA_free (keyPair);
-        return -1;
+        delete pJob;
+        return false;
     }
+    pJob->encryptedSize = n_recieved;
 
-    // Decrypt login parameters:
-    maxflen = maxFLEN (keyPair);
-    if (maxflen > decrypted_maxlen)
+    if (!authQueue.TryPush (pJob))
     {
-        SetError ("Allocated decryption buffer is too small");
-        return -1;
-    }
-
-    decryptedSize = RSA_private_decrypt (n_recieved, encrypted,
-                                         (unsigned char *)decrypted_data,
-                                         keyPair, SERVER_RSA_PADDING);
-    RSA_free (keyPair);
+        SendSignal (clientSocket, NETSIG_SERVERFULL);
 
-    if (decryptedSize < 0)
-    {
-        ERR_error_string_n (ERR_get_error (), errbuf, RSA_ERRBUF_SIZE);
-        SetError ("Error decrypting: %s", errbuf);
+        RSA_free (keyPair);
+        delete pJob;
+        return false;
     }
 
-    return decryptedSize;
+    return true;
 }
 
 /**
- * This runs in a temporary thread.
+ * Runs on an auth thread, sets the job's result.
  */
-void Server::OnLogin (TCPsocket clientSocket, const IPaddress *pClientIP)
+void Server::Authenticate (LoginJob *pJob)
 {
-    int decryptedSize, n_sent, len;
     unsigned char decrypted [PACKET_MAXSIZE];
-    Uint8 signal, *data;
+    char errbuf [RSA_ERRBUF_SIZE];
 
-    // If the server is full at this point, don't bother.
-    if (IsServerFull ())
-    {
-        signal = NETSIG_SERVERFULL;
-        if (SDLNet_TCP_Send (clientSocket, &signal, 1) != 1)
-        {
-            Message (SERVER_MSG_ERROR, "WARNING, could not send server full error to user: %s",
-                     SDLNet_GetError ());
-        }
-        return;
-    }
+    pJob->result = NETSIG_AUTHENTICATIONERROR;
 
-    decryptedSize = RecieveEncrypted (clientSocket, decrypted, PACKET_MAXSIZE);
-    if (decryptedSize <= 0)
-    {
-        char ip [100];
-        ip2String (*pClientIP, ip);
+    // Decrypt login parameters:
+    int decryptedSize = -1;
+    if (maxFLEN (pJob->keyPair) <= PACKET_MAXSIZE)
+        decryptedSize = RSA_private_decrypt (pJob->encryptedSize, pJob->encrypted, decrypted,
+                                             pJob->keyPair, SERVER_RSA_PADDING);
+    RSA_free (pJob->keyPair);
+    pJob->keyPair = NULL;
 
-        Message (SERVER_MSG_ERROR,
-                 "Error recieving encrypted login from %s: %s",
-                 ip, GetError ());
+    if (decryptedSize < 0)
+    {
+        ERR_error_string_n (ERR_get_error (), errbuf, RSA_ERRBUF_SIZE);
+        Message (SERVER_MSG_ERROR, "Error decrypting login: %s", errbuf);
         return;
     }
     else if (decryptedSize != sizeof (LoginParams))
     {
         Message (SERVER_MSG_ERROR,
                  "error recieving login parameters, wrong data size recieved");
-
-        signal = NETSIG_AUTHENTICATIONERROR;
-        if (SDLNet_TCP_Send (clientSocket, &signal, 1) != 1)
-        {
-            Message (SERVER_MSG_ERROR,
-                     "WARNING, could not send authentication error to user: %s",
-                     SDLNet_GetError ());
-        }
-
         return;
     }
 
     // Get decrypted username, password, etc.
-    const LoginParams *pParams = (const LoginParams *)decrypted;
+    LoginParams *pParams = (LoginParams *)decrypted;
+    pParams->username [USERNAME_MAXLENGTH - 1] = '\0';
+    pParams->password [PASSWORD_MAXLENGTH - 1] = '\0';
+    pParams->room [ROOMNAME_MAXLENGTH - 1] = '\0';
 
     if (GetUser (pParams->username)) // this user is already logged in
+
+        pJob->result = NETSIG_ALREADYLOGGEDIN;
+
+    else if (authenticate (GetAccountsPath ().c_str(), pParams->username, pParams->password))
     {
-        Uint8 signal = NETSIG_ALREADYLOGGEDIN;
-        if (SDLNet_TCP_Send (clientSocket, &signal, 1) != 1)
-        {
-            Message (SERVER_MSG_ERROR,
-                     "WARNING, could not send already logged in error to user: %s", SDLNet_GetError ());
-        }
+        pJob->result = NETSIG_LOGINSUCCESS;
+
+        strcpy (pJob->username, pParams->username);
+        strcpy (pJob->room, pParams->room);
+
+        pJob->clientAddress.host = pJob->clientIP.host;
+        pJob->clientAddress.port = pParams->udp_port;
+
+        pJob->userParams.hue = GetNextRand () % 360; // give the user a random color
     }
-    else if (authenticate (accountsPath.c_str(), pParams->username, pParams->password))
-    {
-        // To keep it thread safe, we must copy these values before the user enters the list..
-        IPaddress clientAddress;
-        clientAddress.host = pClientIP->host;
-        clientAddress.port = pParams->udp_port;
 
-        UserParams userParams;
-        userParams.hue = GetNextRand () % 360; // give the user a random color
+    // Don't keep the password around:
+    memset (decrypted, 0, PACKET_MAXSIZE);
+}
 
-        UserP pUser = new User (&clientAddress, pParams->username, &userParams);
+/**
+ * Runs on the main loop, adds the authenticated users and replies to all.
+ */
+void Server::CommitLogins (void)
+{
+    LoginJob *pJob;
+    UserState startState;
+    Uint8 data [1 + sizeof (UserParams) + sizeof (UserState)];
 
-        UserState startState = pUser->state;
+    while (commitQueue.Pop (pJob, 0))
+    {
+        if (pJob->result == NETSIG_LOGINSUCCESS)
+        {
+            // Could have logged in through another connection in the meantime:
+            if (GetUser (pJob->username))
+                pJob->result = NETSIG_ALREADYLOGGEDIN;
+
+            else if (!CommitLogin (&pJob->clientAddress, pJob->username, pJob->room,
+                                   &pJob->userParams, &startState))
+                pJob->result = NETSIG_SERVERFULL;
+        }
 
-        // Try to add user to the list:
-        if (AddUser (pUser))
+        if (pJob->result == NETSIG_LOGINSUCCESS)
         {
             // Send client the message that login succeeded,
             // along with the user's first state and parameters:
-            len = 1 + sizeof (UserParams) + sizeof (UserState);
-            data = new Uint8 [len];
             data [0] = NETSIG_LOGINSUCCESS;
-            memcpy (data + 1, &userParams, sizeof (UserParams));
+            memcpy (data + 1, &pJob->userParams, sizeof (UserParams));
             memcpy (data + 1 + sizeof (UserParams), &startState, sizeof (UserState));
-            n_sent = SDLNet_TCP_Send (clientSocket, data, len);
-            delete data;
 
-            if (n_sent != len)
+            if (SDLNet_TCP_Send (pJob->clientSocket, data, sizeof (data)) != sizeof (data))
             {
                 Message (SERVER_MSG_ERROR, "WARNING, could not send login conformation to user: %s",
                          SDLNet_GetError ());
             }
 
-            Message (SERVER_MSG_INFO, "%s just logged in", pUser->accountName);
+            // The roster exchange with the other users happens at the next Update.
+        }
+        else
+            SendSignal (pJob->clientSocket, pJob->result);
 
-            // Tell other users about this new user:
-            if (SDL_LockMutex (pUsersMutex) == 0)
-            {
-                for (const UserP pOtherUser : users)
-                {
-                    if(pOtherUser != pUser)
-                    {
-                        TellUserAboutUser (pOtherUser, pUser);
-                        TellUserAboutUser (pUser, pOtherUser);
-                    }
-                }
+        SDLNet_TCP_Close (pJob->clientSocket);
+        delete pJob;
+    }
+}
+/**
+ * Puts an authenticated user in the list, also used when replaying a capture.
+ * Can be used from any thread.
+ * :returns: false if the server is full
+ */
+bool Server::CommitLogin (const IPaddress *pAddress, const char *username, const char *requestedRoom,
+                          const UserParams *pParams, UserState *pStartState)
+{
+    ClientRates rates;
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error reading client rates, could not lock mutex: %s",
+                 SDL_GetError ());
+        return false;
+    }
+    rates = clientRates;
+    SDL_UnlockMutex (pUsersMutex);
 
-                SDL_UnlockMutex (pUsersMutex);
-            }
-            else
-                Message (SERVER_MSG_ERROR, "Error telling users about new user, could not lock mutex: %s",
-                         SDL_GetError ());
-        }
-        else // AddUser failed, server full
-        {
-            signal = NETSIG_SERVERFULL;
-            if (SDLNet_TCP_Send (clientSocket, &signal, 1) != 1)
-            {
-                Message (SERVER_MSG_ERROR, "WARNING, could not send server full error to user: %s",
-                         SDLNet_GetError ());
-            }
-        }
+    UserP pUser = new User (pAddress, username, pParams, &rates);
+
+    // To keep it thread safe, we must copy these values before the user enters the list..
+    *pStartState = pUser->state;
+
+    // Users that don't ask for a valid room go to the default room.
+    char roomName [ROOMNAME_MAXLENGTH];
+    strncpy (roomName, requestedRoom, ROOMNAME_MAXLENGTH);
+    roomName [ROOMNAME_MAXLENGTH - 1] = NULL;
+    if (!ValidRoomName (roomName))
+        strcpy (roomName, DEFAULT_ROOM);
+
+    // Try to add user to the list:
+    if (!AddUser (pUser, roomName))
+    {
+        delete pUser;
+        return false;
     }
-    else // authentication failure
+
+    if (capture.IsOpen ())
     {
-        signal = NETSIG_AUTHENTICATIONERROR;
-        if (SDLNet_TCP_Send (clientSocket, &signal, 1) != 1)
-        {
-            Message (SERVER_MSG_ERROR, "WARNING, could not send authentication error to user: %s",
-                     SDLNet_GetError ());
-        }
+        CaptureLogin login;
+        memset (&login, 0, sizeof (login));
+        strncpy (login.username, username, USERNAME_MAXLENGTH - 1);
+        strcpy (login.room, roomName);
+        login.params = *pParams;
+
+        if (!capture.Write (CAPTURE_LOGIN, *pAddress, &login, sizeof (login)))
+            Message (SERVER_MSG_ERROR, "WARNING, could not capture login: %s", GetError ());
     }
-}
 
+    Message (SERVER_MSG_INFO, "%s just logged in to room %s", username, roomName);
+
+    return true;
+}
 void STDAppender::Message (MessageType type, const char *format, va_list args)
 {
     FILE *stream;
@@ -312,12 +558,13 @@ void STDAppender::Message (MessageType type, const char *format, va_list args)
     fprintf (stream, "\n");
 }
 FileLogAppender::FileLogAppender (const char *log_path)
+ : path (log_path)
 {
-    strcpy (path, log_path);
-
-    // Empty the log file, before appending:
-    FILE *pFile = fopen (path, "w");
-    fclose (pFile);
+    // Only appends, a restart or reload must not wipe the earlier messages.
+    FILE *pFile = fopen (path.c_str (), "a");
+    writable = pFile != NULL;
+    if (pFile)
+        fclose (pFile);
 }
 FileLogAppender::FileLogAppender (const std::string &log_path)
     : FileLogAppender (log_path.c_str ()) {}
@@ -328,7 +575,9 @@ void FileLogAppender::Message (MessageType type, const char *format, va_list arg
     char timebuf [100];
 
     // Append to log file
-    FILE *pFile = fopen (path, "a");
+    FILE *pFile = fopen (path.c_str (), "a");
+    if (!pFile)
+        return;
 
     time (&rawtime);
     timeinfo = localtime (&rawtime);
@@ -382,6 +631,14 @@ void Server::Message (MessageType type, const char *format, ...)
 }
 Server::Server() :
     pMessageAppender(new STDAppender),
+    replaying(false), replayTicks(0),
+    reloadRequested(false),
+    handshakeQueue(LOGINQUEUE_CAPACITY),
+    authQueue(LOGINQUEUE_CAPACITY),
+    commitQueue(LOGINQUEUE_CAPACITY),
+    keyStock(KEYSTOCK_CAPACITY),
+    loginThreadsStop(false),
+    checkpointInterval(0),
     pUsersMutex(NULL),
     maxUsers(0),
     in(NULL), out(NULL),
@@ -390,10 +647,32 @@ Server::Server() :
 {
     pUsersMutex = SDL_CreateMutex ();
     pRandMutex = SDL_CreateMutex ();
-    pChatMutex = SDL_CreateMutex ();
     pMessageMutex = SDL_CreateMutex ();
 
     rseed = time (NULL);
+
+    clientRates.sendBytes = CLIENTRATE_DEFAULT;
+    clientRates.states = STATERATE_DEFAULT;
+    clientRates.stateBurst = STATEBURST_DEFAULT;
+    clientRates.chats = CHATRATE_DEFAULT;
+    clientRates.chatBurst = CHATBURST_DEFAULT;
+}
+/**
+ * Loads an optional positive setting, like 0.5 or 20, returns the default if it's not there
+ * or if it's not a positive number.
+ */
+float LoadPositiveSetting (const std::string &settingsPath, const char *setting, const float _default)
+{
+    std::string s;
+    if (!LoadSettingString (settingsPath, setting, s))
+        return _default;
+
+    char *end;
+    float value = strtof (s.c_str (), &end);
+    if (end == s.c_str () || !(value > 0.0f) || !std::isfinite (value))
+        return _default;
+
+    return value;
 }
 Server::~Server()
 {
@@ -404,7 +683,6 @@ Server::~Server()
     // These must be destroyed last!
     SDL_DestroyMutex (pUsersMutex);
     SDL_DestroyMutex (pRandMutex);
-    SDL_DestroyMutex (pChatMutex);
     SDL_DestroyMutex (pMessageMutex);
 
     delete pMessageAppender;
@@ -417,29 +695,87 @@ bool Server::Configure (void)
     settingsPath = std::string (SDL_GetBasePath ()) + "settings.ini";
 #endif
 
-    if (!LoadSettingString (settingsPath, ACCOUNTSDIR_SETTING, accountsPath))
-        accountsPath = std::string (SDL_GetBasePath ()) + ACCOUNT_DIR;
-
     #ifdef IMPL_UNIX_DEAMON
         pidPath = "/var/run/server.pid";
     #endif
 
+    return LoadSettings ();
+}
+/**
+ * Reads the settings file. If a required setting is missing, nothing changes.
+ * Doesn't (re)open sockets, capture or log, see HotReload.
+ */
+bool Server::LoadSettings (void)
+{
+    std::string accounts, newCapturePath, newLogPath, newCheckpointPath;
+    ClientRates rates;
+
+    if (!LoadSettingString (settingsPath, ACCOUNTSDIR_SETTING, accounts))
+        accounts = std::string (SDL_GetBasePath ()) + ACCOUNT_DIR;
+
     // load the maxUsers setting from the config
-    maxUsers = LoadSetting (settingsPath.c_str(), MAXLOGIN_SETTING);
-    if (maxUsers <= 0)
+    int newMaxUsers = LoadSetting (settingsPath.c_str(), MAXLOGIN_SETTING);
+    if (newMaxUsers <= 0)
     {
         Message (SERVER_MSG_ERROR, "Max Login not found in %s", settingsPath.c_str());
         return false;
     }
 
+    // Optional rate settings, per client per second:
+    rates.sendBytes = LoadPositiveSetting (settingsPath, CLIENTRATE_SETTING, CLIENTRATE_DEFAULT);
+    rates.states = LoadPositiveSetting (settingsPath, STATERATE_SETTING, STATERATE_DEFAULT);
+    rates.stateBurst = LoadPositiveSetting (settingsPath, STATEBURST_SETTING, STATEBURST_DEFAULT);
+    rates.chats = LoadPositiveSetting (settingsPath, CHATRATE_SETTING, CHATRATE_DEFAULT);
+    rates.chatBurst = LoadPositiveSetting (settingsPath, CHATBURST_SETTING, CHATBURST_DEFAULT);
+
     // Load the port number from config
-    port = LoadSetting (settingsPath.c_str(), PORT_SETTING);
-    if (port <= 0)
+    int newPort = LoadSetting (settingsPath.c_str(), PORT_SETTING);
+    if (newPort <= 0)
     {
         Message (SERVER_MSG_ERROR, "Port not set in %s", settingsPath.c_str());
         return false;
     }
 
+    // Optional, records all traffic for replaying:
+    if (!LoadSettingString (settingsPath, CAPTURE_SETTING, newCapturePath))
+        newCapturePath = "";
+
+    // Optional, instead of the system log:
+    if (!LoadSettingString (settingsPath, LOGFILE_SETTING, newLogPath))
+        newLogPath = "";
+
+    // Optional, sessions are saved at shutdown and restored at startup:
+    if (!LoadSettingString (settingsPath, CHECKPOINTFILE_SETTING, newCheckpointPath))
+        newCheckpointPath = "";
+    int newCheckpointInterval = 1000 * std::max (0, LoadSetting (settingsPath.c_str (), CHECKPOINTINTERVAL_SETTING));
+
+    // Login threads read these:
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error loading settings, could not lock mutex: %s",
+                 SDL_GetError ());
+        return false;
+    }
+
+    accountsPath = accounts;
+    maxUsers = newMaxUsers;
+    clientRates = rates;
+
+    port = newPort;
+    capturePath = newCapturePath;
+    logPath = newLogPath;
+    checkpointPath = newCheckpointPath;
+    checkpointInterval = newCheckpointInterval;
+
+    // Users that are already logged in, get the new limits too:
+    for (UserP pUser : users)
+    {
+        pUser->stateLimit.SetRate (rates.states, rates.stateBurst);
+        pUser->chatLimit.SetRate (rates.chats, rates.chatBurst);
+    }
+
+    SDL_UnlockMutex (pUsersMutex);
+
     return true;
 }
 bool Server::NetInit (void)
@@ -450,6 +786,26 @@ bool Server::NetInit (void)
         return false;
     }
 
+    if (!OpenSockets ())
+        return false;
+
+    // Allocate packets of the size we need, one for incoming, one for outgoing
+    if (!(udpPackets = SDLNet_AllocPacketV (2, PACKET_MAXSIZE)))
+    {
+        Message (SERVER_MSG_ERROR, "SDLNet_AllocPacketV: %s", SDLNet_GetError());
+        return false;
+    }
+    in = udpPackets [0];
+    out = udpPackets [1];
+
+    OpenCapture ();
+
+    RestoreCheckpoint ();
+
+    return true;
+}
+bool Server::OpenSockets (void)
+{
     // Open a socket and listen at the configured port:
     if (!(udp_socket = SDLNet_UDP_Open (port)))
     {
@@ -470,16 +826,256 @@ bool Server::NetInit (void)
         return false;
     }
 
-    // Allocate packets of the size we need, one for incoming, one for outgoing
-    if (!(udpPackets = SDLNet_AllocPacketV (2, PACKET_MAXSIZE)))
+    return true;
+}
+void Server::CloseSockets (void)
+{
+    if(udp_socket)
     {
-        Message (SERVER_MSG_ERROR, "SDLNet_AllocPacketV: %s", SDLNet_GetError());
-        return false;
+        SDLNet_UDP_Close (udp_socket);
+        udp_socket = NULL;
     }
-    in = udpPackets [0];
-    out = udpPackets [1];
+    if (tcp_socket)
+    {
+        SDLNet_TCP_Close (tcp_socket);
+        tcp_socket = NULL;
+    }
+}
+void Server::OpenCapture (void)
+{
+    capture.Close ();
 
-    return true;
+    if (!capturePath.empty ())
+    {
+        if (capture.Open (capturePath.c_str ()))
+            Message (SERVER_MSG_INFO, "capturing traffic to %s", capturePath.c_str ());
+        else
+            Message (SERVER_MSG_ERROR, "WARNING, not capturing: %s", GetError ());
+    }
+}
+/**
+ * Saves the sessions and chat, if a checkpoint file is set.
+ */
+void Server::SaveCheckpoint (void)
+{
+    std::vector <CheckpointUser> checkpointUsers;
+    std::vector <CheckpointChat> checkpointChats;
+
+    if (checkpointPath.empty ())
+        return;
+
+    Uint64 counter = SDL_GetPerformanceCounter ();
+
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error saving checkpoint, could not lock mutex: %s",
+                 SDL_GetError ());
+        return;
+    }
+
+    checkpointUsers.resize (users.size ());
+    size_t i = 0;
+    for (UserP pUser : users)
+    {
+        CheckpointUser &u = checkpointUsers [i++]; // zeroed by resize
+
+        u.address = pUser->address;
+        strcpy (u.accountName, pUser->accountName);
+        strcpy (u.room, pUser->pRoom->name);
+        u.params = pUser->params;
+        u.state = pUser->state;
+        u.ticksSinceLastContact = pUser->ticksSinceLastContact;
+    }
+
+    for (const auto &pair : rooms)
+    {
+        for (const ChatEntry &entry : pair.second->chat)
+        {
+            CheckpointChat c;
+            memset (&c, 0, sizeof (c));
+            strcpy (c.room, pair.second->name);
+            c.entry = entry;
+
+            checkpointChats.push_back (c);
+        }
+    }
+
+    SDL_UnlockMutex (pUsersMutex);
+
+    if (!WriteCheckpoint (checkpointPath.c_str (), time (NULL), checkpointUsers, checkpointChats))
+    {
+        Message (SERVER_MSG_ERROR, "Error saving checkpoint: %s", GetError ());
+        return;
+    }
+
+    Message (SERVER_MSG_DEBUG, "checkpoint of %u users saved in %.0f microseconds",
+             (unsigned int)checkpointUsers.size (),
+             1.0e6 * (SDL_GetPerformanceCounter () - counter) / SDL_GetPerformanceFrequency ());
+}
+/**
+ * Adopts the sessions of the previous server, that haven't timed out yet.
+ * Their clients can continue without logging in again.
+ */
+void Server::RestoreCheckpoint (void)
+{
+    std::vector <CheckpointUser> checkpointUsers;
+    std::vector <CheckpointChat> checkpointChats;
+    Uint64 savedTime, now = time (NULL);
+    UserState startState;
+    int nRestored = 0;
+
+    if (checkpointPath.empty ())
+        return;
+
+    if (!ReadCheckpoint (checkpointPath.c_str (), savedTime, checkpointUsers, checkpointChats))
+    {
+        Message (SERVER_MSG_INFO, "no sessions restored: %s", GetError ());
+        return;
+    }
+
+    Uint64 downTicks = (now > savedTime) ? 1000 * (now - savedTime) : 0;
+
+    for (CheckpointUser &u : checkpointUsers)
+    {
+        Uint64 silentTicks = downTicks + u.ticksSinceLastContact;
+        if (silentTicks > CONNECTION_TIMEOUT_TICKS)
+            continue;
+
+        u.accountName [USERNAME_MAXLENGTH - 1] = NULL;
+        u.room [ROOMNAME_MAXLENGTH - 1] = NULL;
+        if (GetUser (u.accountName))
+            continue;
+
+        // The room gets a fresh roster, so its users have an up to date view after the restart.
+        if (!CommitLogin (&u.address, u.accountName, u.room, &u.params, &startState))
+            break; // server full
+
+        UserP pUser = GetUser (u.accountName);
+        if (SDL_LockMutex (pUsersMutex) == 0)
+        {
+            pUser->state.pos = u.state.pos;
+            pUser->state.ticks = GetTicks ();
+            pUser->ticksSinceLastContact = silentTicks;
+
+            SDL_UnlockMutex (pUsersMutex);
+        }
+
+        nRestored ++;
+    }
+
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error restoring chat, could not lock mutex: %s",
+                 SDL_GetError ());
+        return;
+    }
+
+    // Only rooms with users in them exist.
+    for (CheckpointChat &c : checkpointChats)
+    {
+        c.room [ROOMNAME_MAXLENGTH - 1] = NULL;
+        c.entry.username [USERNAME_MAXLENGTH - 1] = NULL;
+        c.entry.message [MAX_CHAT_LENGTH - 1] = NULL;
+
+        std::map <std::string, Room *>::iterator it = rooms.find (c.room);
+        if (it == rooms.end ())
+            continue;
+
+        std::deque <ChatEntry> &chat = it->second->chat;
+        chat.push_back (c.entry);
+        while (chat.size () > CHAT_HISTORY_LENGTH)
+            chat.pop_front ();
+    }
+
+    SDL_UnlockMutex (pUsersMutex);
+
+    Message (SERVER_MSG_INFO, "restored %d of %u sessions from %s", nRestored,
+             (unsigned int)checkpointUsers.size (), checkpointPath.c_str ());
+}
+/**
+ * Applies the settings file again, while users stay logged in.
+ * Runs on the main loop, when a reload was requested.
+ */
+void Server::HotReload (void)
+{
+    Uint64 counter = SDL_GetPerformanceCounter ();
+
+    int oldPort = port;
+    std::string oldCapturePath = capturePath,
+                oldLogPath = logPath;
+
+    if (!LoadSettings ())
+    {
+        Message (SERVER_MSG_ERROR, "settings were not reloaded, keeping the old ones");
+        return;
+    }
+
+    #ifdef IMPL_UNIX_DEAMON
+        if (logPath != oldLogPath)
+        {
+            if (logPath.empty ())
+                SetMessageAppender (new SyslogAppender);
+            else
+            {
+                FileLogAppender *pAppender = new FileLogAppender (logPath);
+                if (pAppender->IsWritable ())
+                    SetMessageAppender (pAppender);
+                else
+                {
+                    Message (SERVER_MSG_ERROR, "cannot write to log file %s, keeping the old log",
+                             logPath.c_str ());
+                    delete pAppender;
+                    logPath = oldLogPath;
+                }
+            }
+        }
+    #endif
+
+    if (capturePath != oldCapturePath)
+        OpenCapture ();
+
+    // Only a port change affects connections, users on the old port will time out.
+    if (port != oldPort)
+    {
+        CloseSockets ();
+        if (!OpenSockets ())
+        {
+            Message (SERVER_MSG_ERROR, "cannot listen at port %d, staying at %d", port, oldPort);
+
+            CloseSockets ();
+            port = oldPort;
+            if (!OpenSockets ())
+                Message (SERVER_MSG_ERROR, "cannot listen at port %d anymore", port);
+        }
+    }
+
+    Message (SERVER_MSG_INFO, "reloaded settings in %.0f microseconds",
+             1.0e6 * (SDL_GetPerformanceCounter () - counter) / SDL_GetPerformanceFrequency ());
+}
+/**
+ * Takes ownership of the appender. Can be used from any thread.
+ */
+void Server::SetMessageAppender (MessageAppender *pAppender)
+{
+    if (SDL_LockMutex (pMessageMutex) != 0)
+    {
+        fprintf (stderr, "Cannot change appender, unable to lock mutex: %s",
+                 SDL_GetError ());
+        delete pAppender;
+        return;
+    }
+
+    delete pMessageAppender;
+    pMessageAppender = pAppender;
+
+    SDL_UnlockMutex (pMessageMutex);
+}
+Uint32 Server::GetTicks (void)
+{
+    if (replaying)
+        return replayTicks;
+
+    return SDL_GetTicks ();
 }
 
 /**
@@ -511,25 +1107,22 @@ void Server::NetCleanUp()
         udpPackets = NULL;
         in = out = NULL;
     }
-    if(udp_socket)
-    {
-        SDLNet_UDP_Close (udp_socket);
-        udp_socket = NULL;
-    }
-    if (tcp_socket)
-    {
-        SDLNet_TCP_Close (tcp_socket);
-        tcp_socket = NULL;
-    }
+    CloseSockets ();
 
     SDLNet_Quit();
 
+    capture.Close ();
+
     if (SDL_LockMutex (pUsersMutex) == 0)
     {
         for (UserP pUser : users)
             delete pUser;
         users.clear ();
 
+        for (auto &pair : rooms)
+            delete pair.second;
+        rooms.clear ();
+
         SDL_UnlockMutex (pUsersMutex);
     }
     else
@@ -580,6 +1173,24 @@ bool Server::ResourceInit (void)
 void Server::ResourceCleanUp (void)
 {
 }
+/**
+ * Can be used from any thread.
+ */
+std::string Server::GetAccountsPath (void)
+{
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error reading accounts path, could not lock mutex: %s",
+                 SDL_GetError ());
+        return "";
+    }
+
+    std::string path = accountsPath;
+
+    SDL_UnlockMutex (pUsersMutex);
+
+    return path;
+}
 bool Server::IsServerFull (void)
 {
     if (SDL_LockMutex (pUsersMutex) != 0)
@@ -595,24 +1206,90 @@ bool Server::IsServerFull (void)
 
     return b;
 }
-bool Server::AddUser (UserP pUser)
+bool Server::AddUser (UserP pUser, const char *roomName)
 {
-    if (users.size() < maxUsers)
+    if (SDL_LockMutex (pUsersMutex) != 0)
     {
-        if (SDL_LockMutex (pUsersMutex) != 0)
-        {
-            Message (SERVER_MSG_ERROR, "Error adding user, could not lock mutex: %s",
-                     SDL_GetError ());
-            return false;
-        }
-
-        users.push_back (pUser);
+        Message (SERVER_MSG_ERROR, "Error adding user, could not lock mutex: %s",
+                 SDL_GetError ());
+        return false;
+    }
 
+    if (users.size() >= maxUsers)
+    {
         SDL_UnlockMutex (pUsersMutex);
-        return true;
+        return false;
+    }
+
+    users.push_back (pUser);
+    JoinRoom (pUser, roomName);
+
+    SDL_UnlockMutex (pUsersMutex);
+    return true;
+}
+/**
+ * Must hold pUsersMutex when calling this.
+ */
+Server::Room *Server::GetRoom (const char *name)
+{
+    std::map <std::string, Room *>::iterator it = rooms.find (name);
+    if (it != rooms.end ())
+        return it->second;
+
+    Room *pRoom = new Room;
+    strcpy (pRoom->name, name);
+    rooms [name] = pRoom;
+
+    return pRoom;
+}
+/**
+ * Moves the user to the room, the users in it are told at the next Update.
+ * Must hold pUsersMutex when calling this.
+ */
+void Server::JoinRoom (UserP pUser, const char *roomName)
+{
+    if (pUser->pRoom)
+    {
+        TellRoomAboutRemoval (pUser);
+        LeaveRoom (pUser);
     }
 
-    return false;
+    // States of the previous room's users must not reach the client after the confirmation.
+    pUser->scheduler.ForgetStates ();
+
+    pUser->pRoom = GetRoom (roomName);
+    pUser->pRoom->users.push_back (pUser);
+
+    pUser->announced = false;
+    pUser->pRoom->joinedUsers.push_back (pUser);
+
+    // Confirm, so that the client can forget about the previous room.
+    Uint8 data [1 + ROOMNAME_MAXLENGTH];
+    data [0] = NETSIG_JOINROOM;
+    memcpy (data + 1, pUser->pRoom->name, ROOMNAME_MAXLENGTH);
+    pUser->scheduler.QueueEvent (data, 1 + ROOMNAME_MAXLENGTH);
+}
+/**
+ * Empty rooms are removed.
+ * Must hold pUsersMutex when calling this.
+ */
+void Server::LeaveRoom (UserP pUser)
+{
+    Room *pRoom = pUser->pRoom;
+    if (!pRoom)
+        return;
+
+    pRoom->users.remove (pUser);
+    if (!pUser->announced)
+        pRoom->joinedUsers.remove (pUser);
+
+    pUser->pRoom = NULL;
+
+    if (pRoom->users.empty ())
+    {
+        rooms.erase (pRoom->name);
+        delete pRoom;
+    }
 }
 Server::UserP Server::GetUser (const IPaddress *pAddress)
 {
@@ -657,31 +1334,37 @@ Server::UserP Server::GetUser (const char* accountName)
     SDL_UnlockMutex (pUsersMutex);
     return NULL;
 }
-void Server::OnPlayerRemove (Server::UserP pUser)
+/**
+ * Tells the other users in the room that this user is gone.
+ * Must hold pUsersMutex when calling this.
+ */
+void Server::TellRoomAboutRemoval (const UserP pUser)
 {
-    // Tell other players about this one's removal:
     int len = USERNAME_MAXLENGTH + 1;
-    Uint8*data = new Uint8 [USERNAME_MAXLENGTH + 1];
+    Uint8 data [USERNAME_MAXLENGTH + 1];
     data [0] = NETSIG_DELPLAYER;
     memcpy (data + 1, pUser->accountName, USERNAME_MAXLENGTH);
 
-    if (SDL_LockMutex (pUsersMutex) == 0)
+    for (UserP pOtherUser : pUser->pRoom->users)
     {
-        // Send the message to all clients:
-        for (UserP pOtherUser : users)
+        if(pOtherUser != pUser)
         {
-            if(pOtherUser != pUser)
-            {
-                SendToClient (pOtherUser->address, data, len);
-            }
+            pOtherUser->scheduler.Forget (pUser->accountName);
+            pOtherUser->scheduler.QueueEvent (data, len);
         }
+    }
+}
+void Server::OnPlayerRemove (Server::UserP pUser)
+{
+    // Tell other players about this one's removal:
+    if (SDL_LockMutex (pUsersMutex) == 0)
+    {
+        TellRoomAboutRemoval (pUser);
 
         SDL_UnlockMutex (pUsersMutex);
     }
     else
         Message (SERVER_MSG_ERROR, "OnPlayerRemove, error locking mutex: %s", SDL_GetError ());
-
-    delete[] data;
 }
 void Server::TellAboutLogout (UserP to, const char* loggedOutUsername)
 {
@@ -693,27 +1376,91 @@ void Server::TellAboutLogout (UserP to, const char* loggedOutUsername)
     memcpy (data + 1, loggedOutUsername, USERNAME_MAXLENGTH);
 
     // Send data package to client about logged out user
-    SendToClient (to->address, data, len);
+    to->scheduler.QueueEvent (data, len);
     delete[] data;
 }
 void Server::TellUserAboutUser (UserP to, const UserP about)
 {
     // user 'about' has been added and user 'to' must know
 
-    int len = 1 + USERNAME_MAXLENGTH + sizeof(UserParams) + sizeof(UserState);
+    int len = 1 + USER_DESCRIPTOR_SIZE + sizeof(UserState);
     Uint8* data = new Uint8[len];
     data [0] = NETSIG_ADDPLAYER;
     memcpy (data + 1,
-           about->accountName,USERNAME_MAXLENGTH);
-    memcpy (data + 1 + USERNAME_MAXLENGTH,
-           &about->params, sizeof(UserParams));
-    memcpy (data + 1 + USERNAME_MAXLENGTH + sizeof(UserParams),
+           about->descriptor, USER_DESCRIPTOR_SIZE);
+    memcpy (data + 1 + USER_DESCRIPTOR_SIZE,
            &about->state, sizeof(UserState));
 
     // Send data package to client about  user
-    SendToClient (to->address, data, len);
+    to->scheduler.QueueEvent (data, len);
     delete [] data;
 }
+/**
+ * Tells every user in 'to' about every user in 'about', packing as many
+ * users per package as will fit. Must hold pUsersMutex when calling this.
+ */
+void Server::SendRoster (const std::list <UserP> &about, const std::list <UserP> &to)
+{
+    Uint8 data [PACKET_MAXSIZE];
+    int len, n;
+
+    std::list <UserP>::const_iterator it = about.begin ();
+    while (it != about.end ())
+    {
+        // Fill one package:
+        data [0] = NETSIG_ROSTER;
+        len = ROSTER_HEADER_SIZE;
+        for (n = 0; n < ROSTER_MAXENTRIES && it != about.end (); n++, it++)
+        {
+            const UserP pAbout = *it;
+
+            memcpy (data + len, pAbout->descriptor, USER_DESCRIPTOR_SIZE);
+            memcpy (data + len + USER_DESCRIPTOR_SIZE, &pAbout->state, sizeof (UserState));
+            len += ROSTER_ENTRY_SIZE;
+        }
+        data [1] = n;
+
+        for (const UserP pTo : to)
+            pTo->scheduler.QueueEvent (data, len);
+    }
+}
+/**
+ * Users that joined a room since the last call get the room's full roster,
+ * the rest of the room only hears about the new ones. This way a login storm
+ * costs a few packages per user, instead of one per pair of users.
+ */
+void Server::AnnounceJoinedUsers (void)
+{
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error telling users about new users, could not lock mutex: %s",
+                 SDL_GetError ());
+        return;
+    }
+
+    for (auto &pair : rooms)
+    {
+        Room *pRoom = pair.second;
+        if (pRoom->joinedUsers.empty ())
+            continue;
+
+        std::list <UserP> announcedUsers;
+        for (UserP pUser : pRoom->users)
+        {
+            if (pUser->announced)
+                announcedUsers.push_back (pUser);
+        }
+
+        SendRoster (pRoom->users, pRoom->joinedUsers);
+        SendRoster (pRoom->joinedUsers, announcedUsers);
+
+        for (UserP pUser : pRoom->joinedUsers)
+            pUser->announced = true;
+        pRoom->joinedUsers.clear ();
+    }
+
+    SDL_UnlockMutex (pUsersMutex);
+}
 void Server::DelUser (Server::UserP pUser)
 {
     if (SDL_LockMutex (pUsersMutex) != 0)
@@ -723,6 +1470,7 @@ void Server::DelUser (Server::UserP pUser)
         return;
     }
 
+    LeaveRoom (pUser);
     users.remove (pUser);
     delete pUser;
 
@@ -730,6 +1478,9 @@ void Server::DelUser (Server::UserP pUser)
 }
 void Server::Update (Uint32 ticks)
 {
+    AnnounceJoinedUsers ();
+    ApplyThrottledStates ();
+
     if (SDL_LockMutex (pUsersMutex) != 0)
     {
         Message (SERVER_MSG_ERROR, "Error updating users, could not lock mutex: %s",
@@ -740,14 +1491,20 @@ void Server::Update (Uint32 ticks)
     std::list<UserP> toRemove;
     for (UserP pUser : users)
     {
-        // periodically send pings to every user
-
+        /*
+            Periodically send pings to every user. Not only to silent users,
+            because the round trip times also drive the send scheduler.
+            A ping that got no answer within the period counts as lost.
+         */
         pUser->ticksSinceLastContact += ticks;
-        if(!(pUser->pinging) && pUser->ticksSinceLastContact > CONNECTION_PINGPERIOD)
+        pUser->ticksSincePing += ticks;
+        if (pUser->ticksSincePing > CONNECTION_PINGPERIOD)
         {
             Uint8 ping = NETSIG_PINGSERVER;
             SendToClient (pUser->address, &ping, 1);
             pUser->pinging = true;
+            pUser->pingTicks = GetTicks ();
+            pUser->ticksSincePing = 0;
         }
         if (pUser->ticksSinceLastContact > CONNECTION_TIMEOUT_TICKS )
         {
@@ -763,6 +1520,32 @@ void Server::Update (Uint32 ticks)
         OnPlayerRemove (pUser);
         DelUser (pUser);
     }
+
+    FlushSendQueues ();
+}
+/**
+ * Sends as much of the queued data as each client's bandwidth allows.
+ */
+void Server::FlushSendQueues (void)
+{
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error flushing send queues, could not lock mutex: %s",
+                 SDL_GetError ());
+        return;
+    }
+
+    Uint32 ticks = GetTicks ();
+    for (UserP pUser : users)
+    {
+        pUser->scheduler.Flush (ticks,
+            [this, pUser] (const Uint8 *data, int len)
+            {
+                SendToClient (pUser->address, data, len);
+            });
+    }
+
+    SDL_UnlockMutex (pUsersMutex);
 }
 void Server::OnStateSet (UserP user, const UserState* state)
 {
@@ -773,7 +1556,7 @@ void Server::OnStateSet (UserP user, const UserState* state)
         {
             if (pUser == user)
             {
-                user->state.ticks = SDL_GetTicks(); // Update to current time
+                user->state.ticks = GetTicks (); // Update to current time
                 user->state.pos = state->pos;
             }
         }
@@ -784,7 +1567,41 @@ void Server::OnStateSet (UserP user, const UserState* state)
         Message (SERVER_MSG_ERROR, "Error setting user state, could not lock mutex: %s",
                  SDL_GetError ());
 
-    SendUserStateToAll (user);
+    SendUserStateToRoom (user);
+}
+/**
+ * Applies the states that were held back by the rate limit,
+ * as soon as the user's limit allows it again.
+ */
+void Server::ApplyThrottledStates (void)
+{
+    std::list <UserP> toApply;
+    Uint32 ticks = GetTicks ();
+
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error applying throttled states, could not lock mutex: %s",
+                 SDL_GetError ());
+        return;
+    }
+
+    for (UserP pUser : users)
+    {
+        if (!pUser->hasPendingState)
+            continue;
+
+        pUser->stateLimit.Refill (ticks);
+        if (pUser->stateLimit.Take (1))
+            toApply.push_back (pUser);
+    }
+
+    SDL_UnlockMutex (pUsersMutex);
+
+    for (UserP pUser : toApply)
+    {
+        pUser->hasPendingState = false;
+        OnStateSet (pUser, &pUser->pendingState);
+    }
 }
 void Server::OnChatMessage (const UserP pUser, const char *msg)
 {
@@ -792,30 +1609,55 @@ void Server::OnChatMessage (const UserP pUser, const char *msg)
     strcpy (e.username, pUser->accountName);
     strcpy (e.message, msg);
 
-    if (SDL_LockMutex (pChatMutex) == 0)
+    if (SDL_LockMutex (pUsersMutex) == 0)
     {
-        chat_history.push_back (e);
+        std::deque <ChatEntry> &chat = pUser->pRoom->chat;
 
-        SDL_UnlockMutex (pChatMutex);
+        chat.push_back (e);
+        while (chat.size () > CHAT_HISTORY_LENGTH)
+            chat.pop_front ();
+
+        SDL_UnlockMutex (pUsersMutex);
     }
     else
         Message (SERVER_MSG_ERROR, "Error adding chat message, could not lock mutex: %s",
                  SDL_GetError ());
 
-    Message (SERVER_MSG_INFO, "%s said: %s", pUser->accountName, msg);
+    Message (SERVER_MSG_INFO, "%s said in %s: %s", pUser->accountName, pUser->pRoom->name, msg);
 
-    // Tell everybody about this chat message:
+    // Tell everybody in the room about this chat message:
 
     int len = sizeof (e) + 1;
     Uint8* data = new Uint8[len];
     data [0] = NETSIG_CHATMESSAGE;
     memcpy (data + 1, &e, sizeof (e));
 
-    SendToAll (data, len);
+    SendToRoom (pUser, data, len);
 
     delete [] data;
 }
-void Server::SendUserStateToAll (const UserP pUser)
+void Server::OnJoinRoomRequest (UserP pUser, const char *roomName)
+{
+    if (!ValidRoomName (roomName))
+        return;
+
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Error joining room, could not lock mutex: %s",
+                 SDL_GetError ());
+        return;
+    }
+
+    if (strcmp (pUser->pRoom->name, roomName) != 0)
+    {
+        JoinRoom (pUser, roomName);
+
+        Message (SERVER_MSG_INFO, "%s joined room %s", pUser->accountName, roomName);
+    }
+
+    SDL_UnlockMutex (pUsersMutex);
+}
+void Server::SendUserStateToRoom (const UserP pUser)
 {
     int len = 1 + USERNAME_MAXLENGTH + sizeof(UserState);
     Uint8* data = new Uint8 [len];
@@ -823,24 +1665,42 @@ void Server::SendUserStateToAll (const UserP pUser)
     memcpy (data + 1, &pUser->accountName, USERNAME_MAXLENGTH);
     memcpy (data + 1 + USERNAME_MAXLENGTH, &(pUser->state), sizeof (UserState));
 
-    SendToAll (data, len);
+    Uint32 ticks = GetTicks ();
+
+    if (SDL_LockMutex (pUsersMutex) == 0)
+    {
+        // Nearby users get this state first:
+        for (UserP pOtherUser : pUser->pRoom->users)
+        {
+            vec2 d = pOtherUser->state.pos - pUser->state.pos;
+            SendClass sendClass = d.Length2 () < NEARSTATE_DISTANCE * NEARSTATE_DISTANCE ?
+                                    SENDCLASS_NEARSTATE : SENDCLASS_FARSTATE;
+
+            pOtherUser->scheduler.QueueState (pUser->accountName, sendClass, data, len, ticks);
+        }
+
+        SDL_UnlockMutex (pUsersMutex);
+    }
+    else
+        Message (SERVER_MSG_ERROR, "WARNING, failed to lock mutex while sending a user state: %s",
+                 SDL_GetError ());
 
     delete [] data;
 }
-void Server::SendToAll (const Uint8 *data, const int len)
+void Server::SendToRoom (const UserP pFrom, const Uint8 *data, const int len)
 {
     if (SDL_LockMutex (pUsersMutex) == 0)
     {
-        // Sends data package to all users in the list
-        for (UserP pUser : users)
+        // Sends data package to all users in the room
+        for (UserP pUser : pFrom->pRoom->users)
         {
-            SendToClient (pUser->address, data, len);
+            pUser->scheduler.QueueEvent (data, len);
         }
 
         SDL_UnlockMutex (pUsersMutex);
     }
     else
-        Message (SERVER_MSG_ERROR, "WARNING, failed to lock mutex while sending a message to all: %s",
+        Message (SERVER_MSG_ERROR, "WARNING, failed to lock mutex while sending a message to a room: %s",
                  SDL_GetError ());
 }
 void Server::OnLogout (Server::User* user)
@@ -854,6 +1714,9 @@ void Server::OnLogout (Server::User* user)
 }
 void Server::OnUDPPackage (const IPaddress& clientAddress, Uint8 *data, int len)
 {
+    if (capture.IsOpen () && !capture.Write (CAPTURE_UDPIN, clientAddress, data, len))
+        Message (SERVER_MSG_ERROR, "WARNING, could not capture package: %s", GetError ());
+
     const UserP user = GetUser (&clientAddress);
     if (user)
     {
@@ -866,6 +1729,8 @@ void Server::OnUDPPackage (const IPaddress& clientAddress, Uint8 *data, int len)
     Uint8 signature = data [0];
     data++; len--;
 
+    Uint32 ticks = GetTicks ();
+
     // What we do now depends on the signature (first byte)
     switch (signature)
     {
@@ -876,17 +1741,39 @@ void Server::OnUDPPackage (const IPaddress& clientAddress, Uint8 *data, int len)
         SendToClient(clientAddress,&signature,1);
     break;
     case NETSIG_PINGSERVER:
+        if (user->pinging)
+            user->scheduler.OnRTT (GetTicks () - user->pingTicks);
         user->pinging=false;
     break;
     case NETSIG_USERSTATE:
         if (len == sizeof(UserState))
         {
             UserState* state=(UserState*)data;
-            OnStateSet(user, state);
+
+            // Every state is forwarded to all users, so limit the rate:
+            user->stateLimit.Refill (ticks);
+            if (user->stateLimit.Take (1))
+            {
+                user->hasPendingState = false;
+                OnStateSet(user, state);
+            }
+            else // keep only the latest, it's applied in Update
+            {
+                user->pendingState = *state;
+                user->hasPendingState = true;
+                user->nThrottledStates ++;
+            }
         }
     break;
     case NETSIG_CHATMESSAGE:
     {
+        user->chatLimit.Refill (ticks);
+        if (!user->chatLimit.Take (1))
+        {
+            user->nThrottledChats ++;
+            break;
+        }
+
         // make sure it's null terminated and not too long:
         char *msg = (char *)data;
         int i = 0;
@@ -899,11 +1786,27 @@ void Server::OnUDPPackage (const IPaddress& clientAddress, Uint8 *data, int len)
         OnChatMessage (user, msg);
     }
     break;
+    case NETSIG_JOINROOM:
+    {
+        // Joining means sending the whole room's roster, so limit it like chat.
+        user->chatLimit.Refill (ticks);
+        if (len < 1 || !user->chatLimit.Take (1))
+            break;
+
+        char roomName [ROOMNAME_MAXLENGTH];
+        len = std::min (len, ROOMNAME_MAXLENGTH - 1);
+        memcpy (roomName, data, len);
+        roomName [len] = NULL;
+
+        OnJoinRoomRequest (user, roomName);
+    }
+    break;
     case NETSIG_REQUESTPLAYERINFO:
         if (len == USERNAME_MAXLENGTH)
         {
+            // Users in other rooms are hidden.
             User* other = GetUser ((const char *)data);
-            if (other)
+            if (other && other->pRoom == user->pRoom)
             {
                 TellUserAboutUser (user, other);
             }
@@ -917,6 +1820,9 @@ void Server::OnUDPPackage (const IPaddress& clientAddress, Uint8 *data, int len)
     }
 }
 #define MAX_RECV 1024
+/**
+ * Runs on a handshake thread, takes care of closing the socket.
+ */
 void Server::OnTCPConnection (TCPsocket clientSocket)
 {
     if (!clientSocket)
@@ -927,6 +1833,7 @@ void Server::OnTCPConnection (TCPsocket clientSocket)
     {
         Message (SERVER_MSG_ERROR, "SDLNet_TCP_GetPeerAddress: %s",
                  SDLNet_GetError ());
+        SDLNet_TCP_Close (clientSocket);
         return;
     }
     char ipString [100];
@@ -937,41 +1844,35 @@ void Server::OnTCPConnection (TCPsocket clientSocket)
              clientSocket, ipString);
 
     Uint8 signal;
-    int nrecv;
-    if ((nrecv = SDLNet_TCP_Recv (clientSocket, &signal, 1)) == 1)
+    if (RecieveWithTimeout (clientSocket, &signal, 1, HANDSHAKE_TIMEOUT) == 1)
     {
         if (signal == NETSIG_LOGINREQUEST)
-
-            OnLogin (clientSocket, pClientIP);
-
+        {
+            // The auth threads close it, if they get it.
+            if (OnLoginRequest (clientSocket, pClientIP))
+                return;
+        }
         else if (signal == 'G') // is it GET ?
         {
             // Collect the rest of the bytes..
             char data [MAX_RECV];
             data [0] = signal;
-            int len = SDLNet_TCP_Recv (clientSocket, data + 1, MAX_RECV - 1);
+            int len = RecieveWithTimeout (clientSocket, data + 1, MAX_RECV - 1, HANDSHAKE_TIMEOUT);
 
             std::string method,
                         path,
                         host;
 
-            if (ParseHttpRequest (data, len, method, path, host)
+            if (len > 0 && ParseHttpRequest (data, len, method, path, host)
                 && method == "GET")
 
                 OnHttpGet (clientSocket, host, path);
         }
     }
-    else if (nrecv == 0)
-
-        Message (SERVER_MSG_ERROR,
-                 "Newly opened tcp socket %u at %s was unexpectedly closed by the peer",
-                 clientSocket, ipString);
-
     else
-
         Message (SERVER_MSG_ERROR,
                  "Recieved no data from newly opened tcp socket %u at %s: %s",
-                 clientSocket, ipString, SDLNet_GetError ());
+                 clientSocket, ipString, GetError ());
 
     SDLNet_TCP_Close (clientSocket);
 }
@@ -1023,10 +1924,56 @@ void Server::OnHttpGet (TCPsocket clientSocket, const std::string &host, const s
     else if (path == "/chat/")
     {
         std::string json;
-        ChatHistoryJSON (json);
+        ChatHistoryJSON (json, DEFAULT_ROOM);
+
+        response = HTTPResponseOK (json.c_str (), json.size (), "text/json; charset=UTF-8");
+    }
+    else if (path == "/logins")
+
+        response = HTTPResponseFound ((url + "/").c_str ());
+
+    else if (path == "/logins/")
+    {
+        std::string json;
+        LoginStatsJSON (json);
+
+        response = HTTPResponseOK (json.c_str (), json.size (), "text/json; charset=UTF-8");
+    }
+    else if (path == "/rooms")
+
+        response = HTTPResponseFound ((url + "/").c_str ());
+
+    else if (path == "/rooms/")
+    {
+        std::string json;
+        RoomListJSON (json);
 
         response = HTTPResponseOK (json.c_str (), json.size (), "text/json; charset=UTF-8");
     }
+    else if (path.compare (0, 7, "/rooms/") == 0)
+    {
+        // /rooms/<name>/users/ or /rooms/<name>/chat/
+        std::string roomName = path.substr (7),
+                    what = "";
+        size_t slash = roomName.find ('/');
+        if (slash != std::string::npos)
+        {
+            what = roomName.substr (slash);
+            roomName = roomName.substr (0, slash);
+        }
+
+        std::string json;
+        if (what == "/users/")
+        {
+            UserListJSON (json, roomName.c_str ());
+            response = HTTPResponseOK (json.c_str (), json.size (), "text/json; charset=UTF-8");
+        }
+        else if (what == "/chat/" && ChatHistoryJSON (json, roomName.c_str ()))
+
+            response = HTTPResponseOK (json.c_str (), json.size (), "text/json; charset=UTF-8");
+        else
+            response = HTTPResponseNotFound ();
+    }
     else
         response = HTTPResponseNotFound ();
 
@@ -1037,6 +1984,17 @@ void Server::OnHttpGet (TCPsocket clientSocket, const std::string &host, const s
 }
 bool Server::SendToClient (const IPaddress& clientAddress, const Uint8*data, int len)
 {
+    if (replaying)
+    {
+        TrafficCount &count = replayedTraffic [data [0]];
+        count.packages ++;
+        count.bytes += len;
+        return true;
+    }
+
+    if (capture.IsOpen () && !capture.Write (CAPTURE_UDPOUT, clientAddress, data, len))
+        Message (SERVER_MSG_ERROR, "WARNING, could not capture package: %s", GetError ());
+
     out->address.host = clientAddress.host;
     out->address.port = clientAddress.port;
 
@@ -1054,24 +2012,36 @@ bool Server::SendToClient (const IPaddress& clientAddress, const Uint8*data, int
 
     return true;
 }
-void Server::ChatHistoryJSON (std::string &json)
+/**
+ * :returns: false if the room doesn't exist
+ */
+bool Server::ChatHistoryJSON (std::string &json, const char *roomName)
 {
-    char s [100];
+    char s [256];
     bool comma = false;
 
-    json = "";
+    json = "[]";
 
-    if (SDL_LockMutex (pChatMutex) != 0)
+    if (SDL_LockMutex (pUsersMutex) != 0)
     {
         Message (SERVER_MSG_ERROR,
                  "Cannot output chat history, error locking mutex: %s",
                  SDL_GetError ());
-        return;
+        return true;
     }
 
-    json += "[";
+    std::map <std::string, Room *>::const_iterator it = rooms.find (roomName);
+    if (it == rooms.end ())
+    {
+        SDL_UnlockMutex (pUsersMutex);
+
+        // The default room is only missing when it's empty.
+        return strcmp (roomName, DEFAULT_ROOM) == 0;
+    }
+
+    json = "[";
 
-    for (const ChatEntry &entry : chat_history)
+    for (const ChatEntry &entry : it->second->chat)
     {
         if (comma)
             json += ",";
@@ -1088,13 +2058,86 @@ void Server::ChatHistoryJSON (std::string &json)
 
     json += "]";
 
-    SDL_UnlockMutex (pChatMutex);
+    SDL_UnlockMutex (pUsersMutex);
+
+    return true;
+}
+void QueueStatsJSON (std::string &json, const char *name, const QueueStats &stats)
+{
+    char s [256];
+
+    sprintf (s, "\"%s\":{\"size\":%u, \"max-size\":%u, \"capacity\":%u, \"pushed\":%llu, \"rejected\":%llu, "
+                "\"mean-wait-ms\":%.2f, \"max-wait-ms\":%.2f}",
+             name, (unsigned int)stats.size, (unsigned int)stats.maxSize, (unsigned int)stats.capacity,
+             (unsigned long long)stats.nPushed, (unsigned long long)stats.nRejected,
+             stats.meanWaitMS, stats.maxWaitMS);
+
+    json += s;
+}
+/**
+ * Tells how busy each stage of the login pipeline is.
+ */
+void Server::LoginStatsJSON (std::string &json)
+{
+    QueueStats stats;
+
+    json = "{";
+
+    handshakeQueue.GetStats (stats);
+    QueueStatsJSON (json, "handshake", stats);
+    json += ",";
+
+    authQueue.GetStats (stats);
+    QueueStatsJSON (json, "auth", stats);
+    json += ",";
+
+    commitQueue.GetStats (stats);
+    QueueStatsJSON (json, "commit", stats);
+    json += ",";
+
+    keyStock.GetStats (stats);
+    QueueStatsJSON (json, "keys", stats);
+
+    json += "}";
+}
+void Server::RoomListJSON (std::string &json)
+{
+    bool comma = false;
+    char s [100];
+
+    json = "";
+
+    if (SDL_LockMutex (pUsersMutex) != 0)
+    {
+        Message (SERVER_MSG_ERROR, "Cannot output rooms, couldn't lock mutex: %s",
+                 SDL_GetError ());
+
+        return;
+    }
+
+    json += "[";
+
+    for (const auto &pair : rooms)
+    {
+        if (comma)
+            json += ",";
+        comma = true;
+
+        sprintf (s, "{\"name\":\"%s\", \"users\":%u}",
+                 pair.second->name, (unsigned int)pair.second->users.size ());
+
+        json += s;
+    }
+
+    json += "]";
+
+    SDL_UnlockMutex (pUsersMutex);
 }
-void Server::UserListJSON (std::string &json)
+void Server::UserListJSON (std::string &json, const char *roomName)
 {
     bool comma = false;
     char ipStr [IP_STRINGLENGTH],
-         s [100];
+         s [256];
 
     json = "";
 
@@ -1110,13 +2153,20 @@ void Server::UserListJSON (std::string &json)
 
     for (UserP pUser : users)
     {
+        if (roomName && strcmp (pUser->pRoom->name, roomName) != 0)
+            continue;
+
         if (comma)
             json += ",";
         comma = true;
 
         ip2String (pUser->address, ipStr);
-        sprintf (s, "{\"ip\":\"%s\", \"name\":\"%s\", \"contact\":%u}",
-                 ipStr, pUser->accountName, pUser->ticksSinceLastContact);
+        sprintf (s, "{\"ip\":\"%s\", \"name\":\"%s\", \"room\":\"%s\", \"contact\":%u, \"rtt\":%u, \"rate\":%.0f, "
+                    "\"throttled-states\":%llu, \"throttled-chats\":%llu}",
+                 ipStr, pUser->accountName, pUser->pRoom->name, pUser->ticksSinceLastContact,
+                 pUser->scheduler.GetRTT (), pUser->scheduler.GetRate (),
+                 (unsigned long long)pUser->nThrottledStates,
+                 (unsigned long long)pUser->nThrottledChats);
 
         json += s;
     }
@@ -1129,42 +2179,192 @@ int Server::MainLoop (void)
 {
     // This function continually runs in a separate thread to handle client requests
 
-    Uint32 ticks0 = SDL_GetTicks(), ticks;
+    Uint32 ticks0 = GetTicks (), ticks,
+           checkpointTicks = ticks0;
     TCPsocket clientSocket;
 
+    // Threads don't survive Deamonize's fork, so they're started here.
+    StartLoginThreads ();
+
     while (!StopCondition ())
     {
-        // Poll for incoming tcp connections:
-        while ((clientSocket = SDLNet_TCP_Accept (tcp_socket)) != NULL)
+        if (reloadRequested)
         {
-            SDL_Thread *pThread = MakeSDLThread (
-            [this, clientSocket]
-            {
-                this->OnTCPConnection (clientSocket);
-                return 0;
-            },
-            (std::string (PROCESS_TAG) + "_tcp_thread").c_str ());
+            reloadRequested = false;
+            HotReload ();
+        }
 
-            // Don't wait for completion:
-            SDL_DetachThread (pThread);
+        // Poll for incoming tcp connections, the handshake threads take them:
+        while (tcp_socket && (clientSocket = SDLNet_TCP_Accept (tcp_socket)) != NULL)
+        {
+            if (!handshakeQueue.TryPush (clientSocket))
+            {
+                SendSignal (clientSocket, NETSIG_SERVERFULL);
+                SDLNet_TCP_Close (clientSocket);
+            }
         }
 
+        CommitLogins ();
+
         // Poll for incoming packets:
-        while (SDLNet_UDP_Recv (udp_socket, in))
+        while (udp_socket && SDLNet_UDP_Recv (udp_socket, in) > 0)
         {
             OnUDPPackage (in->address, in->data, in->len);
         }
 
         // Get time passed since last iteration:
-        ticks = SDL_GetTicks();
+        ticks = GetTicks ();
         Update (ticks - ticks0);
         ticks0 = ticks;
 
+        if (checkpointInterval > 0 && (ticks - checkpointTicks) >= checkpointInterval)
+        {
+            SaveCheckpoint ();
+            checkpointTicks = ticks;
+        }
+
         SDL_Delay (100); // sleep to allow the other thread to run
     }
 
+    StopLoginThreads ();
+
+    SaveCheckpoint ();
+
     return 0;
 }
+#define REPLAY_UPDATEPERIOD 100 // ticks, like the main loop's delay
+
+struct ReplayTiming
+{
+    Uint64 count, counter, maxCounter; // performance counter
+};
+/**
+ * Feeds the recorded logins and packages to the server, while the recorded time
+ * drives the clock, so that every replay of a capture goes the same way.
+ * 'fast' doesn't wait for the recorded time to pass.
+ *
+ * Reports handling time per netsig and compares the outgoing traffic to the recording.
+ * Logins are listed under NETSIG_LOGINREQUEST.
+ */
+bool Server::Replay (const char *path, const bool fast)
+{
+    CaptureReader reader;
+    CaptureRecord record;
+    std::map <Uint8, ReplayTiming> timings;
+    std::map <Uint8, TrafficCount> recordedTraffic;
+    Uint32 updateTicks = 0,
+           startTicks = SDL_GetTicks ();
+    Uint64 startCounter = SDL_GetPerformanceCounter (),
+           counter, nRecords = 0;
+    Uint8 signature;
+    UserState startState;
+
+    if (!reader.Open (path))
+    {
+        Message (SERVER_MSG_ERROR, "cannot replay: %s", GetError ());
+        return false;
+    }
+
+    replaying = true;
+    replayTicks = 0;
+    replayedTraffic.clear ();
+
+    auto SetReplayTicks = [&] (const Uint32 ticks)
+    {
+        replayTicks = ticks;
+
+        Uint32 elapsed = SDL_GetTicks () - startTicks;
+        if (!fast && ticks > elapsed)
+            SDL_Delay (ticks - elapsed);
+    };
+
+    while (reader.Next (record))
+    {
+        nRecords ++;
+
+        Uint32 recordTicks = record.time / 1000;
+
+        // Run the updates, that the main loop ran in between:
+        while ((recordTicks - updateTicks) >= REPLAY_UPDATEPERIOD)
+        {
+            updateTicks += REPLAY_UPDATEPERIOD;
+            SetReplayTicks (updateTicks);
+            Update (REPLAY_UPDATEPERIOD);
+        }
+        SetReplayTicks (recordTicks);
+
+        if (record.data.empty ())
+            continue;
+
+        counter = SDL_GetPerformanceCounter ();
+
+        if (record.type == CAPTURE_UDPIN)
+        {
+            signature = record.data [0];
+            OnUDPPackage (record.address, (Uint8 *)&record.data [0], record.data.size ());
+        }
+        else if (record.type == CAPTURE_LOGIN && record.data.size () == sizeof (CaptureLogin))
+        {
+            signature = NETSIG_LOGINREQUEST;
+
+            const CaptureLogin *pLogin = (const CaptureLogin *)record.data.c_str ();
+            CommitLogin (&record.address, pLogin->username, pLogin->room, &pLogin->params, &startState);
+        }
+        else if (record.type == CAPTURE_UDPOUT)
+        {
+            TrafficCount &count = recordedTraffic [record.data [0]];
+            count.packages ++;
+            count.bytes += record.data.size ();
+            continue;
+        }
+        else
+            continue;
+
+        counter = SDL_GetPerformanceCounter () - counter;
+
+        ReplayTiming &timing = timings [signature];
+        timing.count ++;
+        timing.counter += counter;
+        timing.maxCounter = std::max (timing.maxCounter, counter);
+    }
+
+    replaying = false;
+
+    if (reader.Failed ())
+        Message (SERVER_MSG_ERROR, "replay stopped early: %s", GetError ());
+
+    double frequency = SDL_GetPerformanceFrequency ();
+
+    Message (SERVER_MSG_INFO, "replayed %llu records, %.1f seconds of traffic in %.3f seconds",
+             (unsigned long long)nRecords, replayTicks / 1000.0,
+             (SDL_GetPerformanceCounter () - startCounter) / frequency);
+
+    Message (SERVER_MSG_INFO, "netsig    handled  mean (us)   max (us)");
+    for (const auto &pair : timings)
+    {
+        Message (SERVER_MSG_INFO, "0x%02x  %10llu %10.1f %10.1f", pair.first,
+                 (unsigned long long)pair.second.count,
+                 1.0e6 * pair.second.counter / (pair.second.count * frequency),
+                 1.0e6 * pair.second.maxCounter / frequency);
+    }
+
+    // Union of both, so that missing and extra traffic shows up:
+    for (const auto &pair : replayedTraffic)
+        recordedTraffic [pair.first];
+
+    Message (SERVER_MSG_INFO, "netsig   recorded (packages/bytes)   replayed (packages/bytes)");
+    for (const auto &pair : recordedTraffic)
+    {
+        const TrafficCount &replayed = replayedTraffic [pair.first];
+
+        Message (SERVER_MSG_INFO, "0x%02x  %10llu %12llu  %10llu %12llu%s", pair.first,
+                 (unsigned long long)pair.second.packages, (unsigned long long)pair.second.bytes,
+                 (unsigned long long)replayed.packages, (unsigned long long)replayed.bytes,
+                 (pair.second.bytes != replayed.bytes) ? "  <- differs" : "");
+    }
+
+    return !reader.Failed ();
+}
 
 Server server;
 
@@ -1274,9 +2474,8 @@ void Server::DeamonStopCallBack (int param)
 }
 void Server::DeamonKickCallBack (int param)
 {
-    server.NetCleanUp ();
-    server.Configure ();
-    server.NetInit ();
+    // Not safe to do from here, the main loop does it.
+    server.reloadRequested = true;
 }
 pid_t Server::GetDeamonPID (void)
 {
@@ -1362,7 +2561,22 @@ bool Server::Deamonize (void)
     done = false;
 
     pOldAppender = pMessageAppender;
-    pMessageAppender = new SyslogAppender;
+    pMessageAppender = NULL;
+    if (!logPath.empty ())
+    {
+        FileLogAppender *pAppender = new FileLogAppender (logPath);
+        if (pAppender->IsWritable ())
+            pMessageAppender = pAppender;
+        else
+            delete pAppender;
+    }
+    if (!pMessageAppender)
+    {
+        pMessageAppender = new SyslogAppender;
+        if (!logPath.empty ())
+            Message (SERVER_MSG_ERROR, "cannot write to log file %s, using the system log",
+                     logPath.c_str ());
+    }
 
     MainLoop ();
 
@@ -1406,6 +2620,11 @@ int main (int argc, char** argv)
             if (!server.Reload ())
                 return 1;
         }
+        else if (0 == strcmp (argv [1], "replay") && argc > 2)
+        {
+            if (!server.Replay (argv [2], argc > 3 && 0 == strcmp (argv [3], "fast")))
+                return 1;
+        }
         else
         {
             printf ("unknown command: %s\n", argv [1]);
@@ -1413,7 +2632,7 @@ int main (int argc, char** argv)
         }
     }
     else
-        printf ("Usage: %s (start|stop|status|reload)\n", argv [0]);
+        printf ("Usage: %s (start|stop|status|reload|replay <capture file> [fast])\n", argv [0]);
 
     return 0;
 }
@@ -1632,6 +2851,9 @@ int main (int argc, char** argv)
     if (!server.Configure ())
         return 1;
 
+    if (argc > 2 && 0 == strcmp (argv [1], "replay"))
+        return server.Replay (argv [2], argc > 3 && 0 == strcmp (argv [3], "fast")) ? 0 : 1;
+
     return server.ConsoleRun ();
 }
 #endif
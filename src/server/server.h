@@ -37,14 +37,26 @@
 #include <openssl/rsa.h>
 #include <string>
 #include <list>
+#include <deque>
+#include <map>
+#include <vector>
 #include <cstdarg>
+#include <atomic>
+#include <csignal>
 
 #include "../vec.h"
 #include "../account.h"
 #include "../xml.h"
+#include "scheduler.h"
+#include "capture.h"
+#include "queue.h"
 
 #define PACKET_MAXSIZE 512
 #define MAX_CHAT_LENGTH 100 // must fit inside PACKET_MAXSIZE
+#define CHAT_HISTORY_LENGTH 100 // chat entries kept per room
+
+#define ROOMNAME_MAXLENGTH 16
+#define DEFAULT_ROOM "lobby"
 
 /*
     A netsig byte is usually placed at the beginning
@@ -72,6 +84,8 @@
 #define NETSIG_ADDPLAYER            0x21
 #define NETSIG_USERSTATE            0x20
 #define NETSIG_CHATMESSAGE          0x21
+#define NETSIG_ROSTER               0x24
+#define NETSIG_JOINROOM             0x25
 
 #define COMMAND_MAXLENGTH 256
 
@@ -83,7 +97,8 @@ inline int maxFLEN (RSA* rsa) { return (RSA_size(rsa) - 11); }
 struct LoginParams // must fit inside PACKET_MAXSIZE
 {
     char username [USERNAME_MAXLENGTH],
-         password [PASSWORD_MAXLENGTH];
+         password [PASSWORD_MAXLENGTH],
+         room [ROOMNAME_MAXLENGTH]; // to join after login
     int udp_port;
 };
 struct UserParams
@@ -95,16 +110,54 @@ struct UserState
     vec2 pos;
     Uint32 ticks;
 };
+struct CaptureLogin // what a replay needs to know about a login
+{
+    char username [USERNAME_MAXLENGTH],
+         room [ROOMNAME_MAXLENGTH];
+    UserParams params;
+};
+/*
+    A user descriptor is the part of a NETSIG_ADDPLAYER or NETSIG_ROSTER entry
+    that only changes with the user's params: username, followed by UserParams.
+    The server keeps it pre-serialized per user.
+
+    A NETSIG_ROSTER package holds: netsig, number of entries and then
+    that many entries of descriptor + UserState. Large rosters are
+    split over multiple packages.
+ */
+#define USER_DESCRIPTOR_SIZE (USERNAME_MAXLENGTH + sizeof (UserParams))
+#define ROSTER_ENTRY_SIZE (USER_DESCRIPTOR_SIZE + sizeof (UserState))
+#define ROSTER_HEADER_SIZE 2
+#define ROSTER_MAXENTRIES ((PACKET_MAXSIZE - ROSTER_HEADER_SIZE) / ROSTER_ENTRY_SIZE)
+
 struct ChatEntry // must fit inside PACKET_MAXSIZE
 {
     char username [USERNAME_MAXLENGTH], // who said it?
          message [MAX_CHAT_LENGTH]; // what was said?
 };
 
+// What a checkpoint keeps of a session, to continue it after a restart.
+struct CheckpointUser
+{
+    IPaddress address;
+    char accountName [USERNAME_MAXLENGTH],
+         room [ROOMNAME_MAXLENGTH];
+    UserParams params;
+    UserState state;
+    Uint32 ticksSinceLastContact;
+};
+struct CheckpointChat
+{
+    char room [ROOMNAME_MAXLENGTH];
+    ChatEntry entry;
+};
+
 enum MessageType {SERVER_MSG_DEBUG, SERVER_MSG_INFO, SERVER_MSG_ERROR};
 class MessageAppender
 {
 public:
+    virtual ~MessageAppender () {}
+
     virtual void Message (MessageType, const char *format, va_list args) = 0;
 };
 
@@ -117,11 +170,15 @@ public:
 class FileLogAppender : public MessageAppender
 {
 private:
-    char path [FILENAME_MAX];
+    std::string path;
+    bool writable;
 public:
     FileLogAppender (const char *log_path);
     FileLogAppender (const std::string &log_path);
 
+    // False when the file couldn't be opened, messages are lost then.
+    bool IsWritable (void) const { return writable; }
+
     void Message (MessageType, const char *format, va_list args);
 };
 
@@ -149,9 +206,36 @@ private:
     SDL_mutex *pMessageMutex;
     MessageAppender *pMessageAppender;
 
+    /*
+        While replaying, time comes from the capture file
+        and outgoing packages are counted instead of sent.
+     */
+    bool replaying;
+    Uint32 replayTicks;
+    struct TrafficCount
+    {
+        Uint64 packages, bytes;
+    };
+    std::map <Uint8, TrafficCount> replayedTraffic; // per netsig
+
+    Uint32 GetTicks (void);
+
+    CaptureWriter capture;
+
+    struct ClientRates // per second
+    {
+        float sendBytes,
+              states, stateBurst,
+              chats, chatBurst;
+    } clientRates;
+
+    struct Room;
+
     struct User // created after login, identified by IP-adress
     {
-        Uint32 ticksSinceLastContact;
+        Uint32 ticksSinceLastContact,
+               ticksSincePing, // pings go out periodically, even when the client is active
+               pingTicks; // when the last ping was sent
         bool pinging;
 
         IPaddress address;
@@ -160,23 +244,63 @@ private:
         UserState state;
         UserParams params;
 
-        User (const IPaddress *, const char *accountName, const UserParams *);
+        Room *pRoom;
+
+        // false until the other users in the room have been told about this one
+        bool announced;
+
+        // accountName + params, rebuilt when the params change
+        Uint8 descriptor [USER_DESCRIPTOR_SIZE];
+        void SetParams (const UserParams *);
+
+        // everything sent to this user, except pings, goes through here
+        SendScheduler scheduler;
+
+        /*
+            Limits what this user may send us, only used from the main loop.
+            Excess states are coalesced into pendingState, excess chat is dropped.
+         */
+        TokenBucket stateLimit, chatLimit;
+        bool hasPendingState;
+        UserState pendingState;
+        Uint64 nThrottledStates, nThrottledChats;
+
+        User (const IPaddress *, const char *accountName, const UserParams *, const ClientRates *);
     };
 
-    SDL_mutex *pUsersMutex; // must lock when accessing user list
+    SDL_mutex *pUsersMutex; // must lock when accessing user list, rooms or settings that login threads use
     typedef User* UserP;
     std::list <UserP> users;
     Uint64 maxUsers;
 
+    /*
+        Users only see the cursors and chat of the users in the same room,
+        so everything is broadcast within a room. A room holds all the state
+        that its broadcasts need.
+     */
+    struct Room
+    {
+        char name [ROOMNAME_MAXLENGTH];
+
+        std::list <UserP> users,
+                          joinedUsers; // since the last Update, they're announced in bulk
+
+        std::deque <ChatEntry> chat; // the last CHAT_HISTORY_LENGTH entries
+    };
+    std::map <std::string, Room *> rooms;
+
+    Room *GetRoom (const char *name); // creates it if needed
+    void JoinRoom (UserP user, const char *roomName);
+    void LeaveRoom (UserP user);
+    void TellRoomAboutRemoval (const UserP user);
+
+    std::string GetAccountsPath (void);
     bool IsServerFull (void);
-    bool AddUser (UserP user);
+    bool AddUser (UserP user, const char *roomName);
     UserP GetUser (const IPaddress *address);
     UserP GetUser (const char* accountName);
     void DelUser (UserP user);
 
-    SDL_mutex *pChatMutex;
-    std::list <ChatEntry> chat_history;
-
     std::string settingsPath,
 
             #ifdef IMPL_UNIX_DEAMON
@@ -184,7 +308,12 @@ private:
                 pidPath,
 
             #endif
-                accountsPath;
+                accountsPath,
+                capturePath, // empty if not capturing
+                logPath, // empty for the default log
+                checkpointPath; // empty if not checkpointing
+
+    Uint32 checkpointInterval; // ticks, 0 for only at shutdown
 
     char command [COMMAND_MAXLENGTH];
 
@@ -206,31 +335,88 @@ private:
         bool done;
     #endif
 
+    // Set from a signal handler, handled on the main loop:
+    volatile sig_atomic_t reloadRequested;
+
+    bool LoadSettings (void);
+    void HotReload (void);
+    void SetMessageAppender (MessageAppender *);
+
+    bool OpenSockets (void);
+    void CloseSockets (void);
+    void OpenCapture (void);
+
+    void SaveCheckpoint (void);
+    void RestoreCheckpoint (void);
+
     int MainLoop (void);
 
     void Update (Uint32 ticks);
 
-    void UserListJSON (std::string &json);
-    void ChatHistoryJSON (std::string &json);
+    void UserListJSON (std::string &json, const char *roomName = NULL); // NULL for all rooms
+    bool ChatHistoryJSON (std::string &json, const char *roomName);
+    void RoomListJSON (std::string &json);
+    void LoginStatsJSON (std::string &json);
 
     void TellAboutLogout (UserP to, const char *loggedOutUsername);
 
     void OnUDPPackage (const IPaddress& clientAddress, Uint8*data, int len);
     void OnTCPConnection (TCPsocket clientSocket);
-    void OnLogin (TCPsocket, const IPaddress *pClientIP);
+
+    // A login, on its way through the stages:
+    struct LoginJob
+    {
+        TCPsocket clientSocket;
+        IPaddress clientIP;
+
+        RSA *keyPair; // NULL after decryption
+        Uint8 encrypted [PACKET_MAXSIZE];
+        int encryptedSize;
+
+        Uint8 result; // a netsig, set by Authenticate
+
+        // Only set if authenticated:
+        char username [USERNAME_MAXLENGTH],
+             room [ROOMNAME_MAXLENGTH];
+        IPaddress clientAddress;
+        UserParams userParams;
+    };
+    BoundedQueue <TCPsocket> handshakeQueue;
+    BoundedQueue <LoginJob *> authQueue, commitQueue;
+    BoundedQueue <RSA *> keyStock; // made in advance by the auth threads
+
+    std::vector <SDL_Thread *> loginThreads;
+    std::atomic <bool> loginThreadsStop;
+
+    void StartLoginThreads (void);
+    void StopLoginThreads (void);
+    int HandshakeThread (void);
+    int AuthThread (void);
+
+    void SendSignal (TCPsocket, const Uint8 signal);
+    bool OnLoginRequest (TCPsocket, const IPaddress *pClientIP);
+    void Authenticate (LoginJob *);
+    void CommitLogins (void);
+    bool CommitLogin (const IPaddress *, const char *username, const char *roomName,
+                      const UserParams *, UserState *pStartState);
     void OnLogout (User* user);
 
     bool SendToClient (const IPaddress& clientAddress, const Uint8 *data, int len);
+    void FlushSendQueues (void);
 
     void OnPlayerRemove (UserP user);
 
     void TellUserAboutUser (UserP to, const UserP about);
+    void SendRoster (const std::list <UserP> &about, const std::list <UserP> &to);
+    void AnnounceJoinedUsers (void);
 
     void OnChatMessage (const UserP, const char *);
+    void OnJoinRoomRequest (UserP, const char *roomName);
     void OnStateSet (UserP user, const UserState *newState);
-    void SendUserStateToAll (const UserP user);
+    void ApplyThrottledStates (void);
+    void SendUserStateToRoom (const UserP user);
 
-    void SendToAll (const Uint8 *, const int len);
+    void SendToRoom (const UserP from, const Uint8 *, const int len); // queued as event
 
     bool StopCondition (void);
 
@@ -254,6 +440,9 @@ public:
     bool NetInit (void);
     void NetCleanUp (void);
 
+    // Feeds a capture file to the server, without networking. Needs Configure.
+    bool Replay (const char *capturePath, const bool fast);
+
 #ifdef IMPL_UNIX_DEAMON
 
     bool Start (void);
@@ -24,6 +24,29 @@
 #include <cstring>
 #include <math.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+/*
+    The SSE2 scan reads whole aligned blocks, also past the end of the string.
+    Builds for memory checkers can turn that off, by defining STR_NO_OVERREAD.
+ */
+#if defined __has_feature
+    #if __has_feature (address_sanitizer)
+        #define STR_NO_OVERREAD
+    #endif
+#endif
+#ifdef __SANITIZE_ADDRESS__
+    #define STR_NO_OVERREAD
+#endif
+
+#if defined __SSE2__ && !defined STR_NO_OVERREAD
+    #include <emmintrin.h>
+
+    #define STR_ALIGNED_SCAN
+#endif
 
 #ifdef _WIN32
 
@@ -137,30 +160,170 @@ const char *prev_from_utf8 (const char *pBytes, unicode_char *out)
 
     return pBytes - n_bytes;
 }
+std::size_t ascii_prefix_length (const char *pBytes, const std::size_t max)
+{
+    std::size_t n = 0;
+
+#ifdef STR_ALIGNED_SCAN
+    /*
+        Only aligned blocks of 16 or 64 bytes are read. Pages are aligned to
+        a multiple of that, so a block never crosses into the next page, and
+        the bytes after the terminating null or the max'th byte in it can be
+        read without faulting. The result ignores them. As signed chars,
+        non-ASCII bytes and the null byte are the ones below 1.
+     */
+    if (max == 0)
+        return 0;
+
+    const __m128i one = _mm_set1_epi8 (1);
+
+    // The first block may start before pBytes, drop the bits of those bytes:
+    const std::size_t head = uintptr_t (pBytes) & 15;
+    int mask = _mm_movemask_epi8 (_mm_cmplt_epi8 (_mm_load_si128 ((const __m128i *)(pBytes - head)), one)) >> head;
+    if (mask != 0)
+        return std::min (max, std::size_t (__builtin_ctz (mask)));
+
+    n = 16 - head;
+    while (n < max)
+    {
+        const char *p = pBytes + n; // aligned to 16 bytes
+
+        if ((uintptr_t (p) & 63) == 0 && max - n >= 64)
+        {
+            // Long runs of ASCII are common, so first try 64 bytes at once:
+            const __m128i stops = _mm_or_si128 (_mm_or_si128 (_mm_cmplt_epi8 (_mm_load_si128 ((const __m128i *)p), one),
+                                                              _mm_cmplt_epi8 (_mm_load_si128 ((const __m128i *)(p + 16)), one)),
+                                                _mm_or_si128 (_mm_cmplt_epi8 (_mm_load_si128 ((const __m128i *)(p + 32)), one),
+                                                              _mm_cmplt_epi8 (_mm_load_si128 ((const __m128i *)(p + 48)), one)));
+            if (_mm_movemask_epi8 (stops) == 0)
+            {
+                n += 64;
+                continue;
+            }
+        }
+
+        mask = _mm_movemask_epi8 (_mm_cmplt_epi8 (_mm_load_si128 ((const __m128i *)p), one));
+        if (mask != 0)
+            return std::min (max, n + __builtin_ctz (mask));
+
+        n += 16;
+    }
+    return max;
+#else
+    while (n < max)
+    {
+        const unsigned char byte = pBytes [n];
+        if (byte == 0 || byte >= 0x80)
+            break;
+        n ++;
+    }
+    return n;
+#endif
+}
 const char *pos_utf8 (const char *pBytes, const std::size_t n)
 {
-    std::size_t i = 0;
+    std::size_t i = 0, run;
     unicode_char ch;
     while (i < n)
     {
-        pBytes = next_from_utf8 (pBytes, &ch);
-        i ++;
+        // ASCII characters are one byte each:
+        run = ascii_prefix_length (pBytes, n - i);
+        pBytes += run;
+        i += run;
+
+        if (run == 0)
+        {
+            pBytes = next_from_utf8 (pBytes, &ch);
+            i ++;
+        }
     }
     return pBytes;
 }
 std::size_t strlen_utf8 (const char *pBytes, const char *end)
 {
-    std::size_t n = 0;
+    std::size_t n = 0, run;
     unicode_char ch;
     while (*pBytes)
     {
-        pBytes = next_from_utf8 (pBytes, &ch);
-        n ++;
-        if (end and pBytes >= end)
-            return n;
+        // The first character is always counted, even when it's past the end:
+        if (end && pBytes >= end)
+            return n + 1;
+
+        run = ascii_prefix_length (pBytes, end ? std::size_t (end - pBytes) : (std::size_t)-1);
+        pBytes += run;
+        n += run;
+
+        if (run > 0)
+        {
+            if (end && pBytes >= end)
+                return n;
+        }
+        else
+        {
+            pBytes = next_from_utf8 (pBytes, &ch);
+            n ++;
+            if (end && pBytes >= end)
+                return n;
+        }
     }
     return n;
 }
+void decode_utf8 (const char *pBytes, std::u32string &out, std::vector <std::size_t> *pOffsets)
+{
+    const char *pBegin = pBytes;
+    std::size_t run, i, n = 0;
+    unicode_char ch;
+
+    // There are never more characters than bytes, so make room for all of them first:
+    const std::size_t nBytes = strlen (pBytes);
+    out.resize (nBytes);
+    if (pOffsets)
+        pOffsets->resize (nBytes + 1);
+
+    while (*pBytes)
+    {
+        run = ascii_prefix_length (pBytes);
+        if (run > 0)
+        {
+            for (i = 0; i < run; i++)
+                out [n + i] = (unsigned char)pBytes [i];
+
+            if (pOffsets)
+            {
+                for (i = 0; i < run; i++)
+                    (*pOffsets) [n + i] = pBytes - pBegin + i;
+            }
+
+            n += run;
+            pBytes += run;
+        }
+        else
+        {
+            const std::size_t offset = pBytes - pBegin;
+            pBytes = next_from_utf8 (pBytes, &ch);
+
+            // A broken character might have jumped over the terminating null:
+            if (n >= out.size ())
+            {
+                out.resize (n + 1);
+                if (pOffsets)
+                    pOffsets->resize (n + 2);
+            }
+
+            out [n] = ch;
+            if (pOffsets)
+                (*pOffsets) [n] = offset;
+            n ++;
+        }
+    }
+
+    out.resize (n);
+    if (pOffsets)
+    {
+        pOffsets->resize (n + 1);
+        (*pOffsets) [n] = pBytes - pBegin;
+    }
+}
 const char *ParseFloat(const char *in, float *out)
 {
     float f = 10.0f;
@@ -352,3 +515,103 @@ std::string bitstr (const char *str)
     }
     return s;
 }
+
+#define BENCHMARK_TEXTSIZE 100000 // bytes
+#define BENCHMARK_ROUNDS 20
+
+/*
+    The utf-8 functions as they were, before ASCII was skipped in bulk.
+    Only here to compare with.
+ */
+const char *bytewise_pos_utf8 (const char *pBytes, const std::size_t n)
+{
+    unicode_char ch;
+    for (std::size_t i = 0; i < n; i++)
+        pBytes = next_from_utf8 (pBytes, &ch);
+    return pBytes;
+}
+std::size_t bytewise_strlen_utf8 (const char *pBytes)
+{
+    std::size_t n = 0;
+    unicode_char ch;
+    while (*pBytes)
+    {
+        pBytes = next_from_utf8 (pBytes, &ch);
+        n ++;
+    }
+    return n;
+}
+void bytewise_decode_utf8 (const char *pBytes, std::u32string &out)
+{
+    unicode_char ch;
+    out.clear ();
+    while (*pBytes)
+    {
+        pBytes = next_from_utf8 (pBytes, &ch);
+        out.push_back (ch);
+    }
+}
+void BenchmarkUTF8 (FILE *out)
+{
+    // Mostly ASCII, like chat text:
+    const char *line = "<anna> anyone up for a game tonight?\n"
+                       "<bram> sure, after dinner. I\'ll bring the snacks\n"
+                       "<anna> great, see you at the caf\xC3\xA9 \xE2\x98\x95\n";
+    std::string text;
+    while (text.size () < BENCHMARK_TEXTSIZE)
+        text += line;
+
+    const std::size_t nChars = bytewise_strlen_utf8 (text.c_str ());
+    std::size_t n1 = 0, n2 = 0;
+    const char *p1 = NULL, *p2 = NULL;
+    std::u32string s1, s2;
+
+    struct Comparison
+    {
+        const char *name;
+        std::function <void (void)> before, after;
+    };
+    const Comparison comparisons [] = {
+        {"strlen_utf8",
+         [&] () { n1 = bytewise_strlen_utf8 (text.c_str ()); },
+         [&] () { n2 = strlen_utf8 (text.c_str ()); }},
+        {"pos_utf8",
+         [&] () { p1 = bytewise_pos_utf8 (text.c_str (), nChars); },
+         [&] () { p2 = pos_utf8 (text.c_str (), nChars); }},
+        {"decode_utf8",
+         [&] () { bytewise_decode_utf8 (text.c_str (), s1); },
+         [&] () { decode_utf8 (text.c_str (), s2); }}
+    };
+
+    fprintf (out, "utf-8 benchmark: %u characters, %u bytes\n", (unsigned int)nChars, (unsigned int)text.size ());
+    for (const Comparison &comparison : comparisons)
+    {
+        double ns [2];
+        const std::function <void (void)> *ops [2] = {&comparison.before, &comparison.after};
+        for (int i = 0; i < 2; i++)
+        {
+            (*ops [i]) (); // warm up
+
+            auto start = std::chrono::steady_clock::now ();
+            for (int r = 0; r < BENCHMARK_ROUNDS; r++)
+                (*ops [i]) ();
+            auto end = std::chrono::steady_clock::now ();
+
+            ns [i] = std::chrono::duration <double, std::nano> (end - start).count () / BENCHMARK_ROUNDS;
+        }
+        fprintf (out, "%-12s byte by byte %8.3f ms, now %8.3f ms (%.1fx)\n",
+                 comparison.name, ns [0] / 1e6, ns [1] / 1e6, ns [0] / ns [1]);
+    }
+
+    // memchr scans the same bytes, without decoding anything:
+    std::size_t nScanned = 0;
+    auto start = std::chrono::steady_clock::now ();
+    for (int r = 0; r < BENCHMARK_ROUNDS; r++)
+        nScanned += (const char *)memchr (text.c_str () + r % 2, 0, text.size () + 1 - r % 2) - text.c_str ();
+    auto end = std::chrono::steady_clock::now ();
+    fprintf (out, "%-12s %8.3f ms\n", "memchr",
+             std::chrono::duration <double, std::milli> (end - start).count () / BENCHMARK_ROUNDS);
+
+    if (n1 != n2 || p1 != p2 || s1 != s2 || nScanned != BENCHMARK_ROUNDS * text.size ())
+        fprintf (out, "error: results differ from the byte by byte functions\n");
+}
@@ -23,7 +23,9 @@
 
 #include <string>
 #include <list>
+#include <vector>
 #include <cstddef>
+#include <cstdio>
 
 /*
     Here, the PATH_SEPARATOR macro is used
@@ -71,6 +73,26 @@ std::size_t strlen_utf8 (const char *pBytes, const char *end = 0);
  */
 const char *pos_utf8 (const char *pBytes, const std::size_t n);
 
+/**
+ * Tells how many bytes at the start of the byte array are ASCII, stopping
+ * at the terminating null or after max bytes. Checks 16 bytes at a time where possible,
+ * in aligned blocks that may extend past the string, unless STR_NO_OVERREAD is defined.
+ */
+std::size_t ascii_prefix_length (const char *pBytes, const std::size_t max = (std::size_t)-1);
+
+/**
+ * Decodes a whole utf-8 string at once, with the same results as repeated next_from_utf8 calls.
+ *
+ * :param out: one code per character, not including the terminating null
+ * :param pOffsets: optional, gets the byte offset of every character, followed by that of the terminating null
+ */
+void decode_utf8 (const char *pBytes, std::u32string &out, std::vector <std::size_t> *pOffsets = NULL);
+
+/**
+ * Times the utf-8 functions against simple byte by byte versions of them and prints the results.
+ */
+void BenchmarkUTF8 (FILE *out);
+
 bool isnewline (const int c);
 bool emptyline (const char *line);
 
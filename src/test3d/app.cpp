@@ -28,6 +28,7 @@
 #include "../load.h"
 #include "../random.h"
 #include "../err.h"
+#include "../textmesh.h"
 
 #include "../ini.h"
 
@@ -46,7 +47,7 @@ const std::string zipPath = std::string (SDL_GetBasePath ()) + "test3d.zip";
 #endif
 
 // Constructor
-App::App (void) : pScene(0), done(false), fullscreen (false)
+App::App (void) : pScene(0), done(false), fullscreen (false), layoutBenchmark (false)
 {
 #ifdef _WIN32
     icon = NULL;
@@ -163,6 +164,10 @@ int ProgressLoop (SDL_Window *pWindow, Progress *pProgress, bool &error)
 #define FULLSCREEN_SETTING "fullscreen"
 #define SCREENWIDTH_SETTING "screenwidth"
 #define SCREENHEIGHT_SETTING "screenheight"
+#define MAXFPS_SETTING "max-fps"
+#define IDLEFPS_SETTING "idle-fps"
+#define VSYNC_SETTING "vsync"
+#define LAYOUTBENCH_SETTING "layout-benchmark"
 bool App::InitApp (void)
 {
 #ifdef CONFDIR
@@ -192,6 +197,21 @@ bool App::InitApp (void)
     if (!InitializeGL())
         return false;
 
+    // The scene is always moving, so only go idle when unfocused:
+    pacer.SetIdleDelay (0);
+
+    char value [100];
+    if (LoadSettingString (settings_path, MAXFPS_SETTING, value))
+        pacer.SetTargetFPS (atof (value));
+    if (LoadSettingString (settings_path, IDLEFPS_SETTING, value))
+        pacer.SetIdleFPS (atof (value));
+
+    bool vsync = !LoadSettingString (settings_path, VSYNC_SETTING, value) || atoi (value) > 0;
+    if (!pacer.SetVSync (vsync))
+        fprintf (stderr, "warning: cannot set vsync to %d: %s\n", vsync, SDL_GetError ());
+
+    layoutBenchmark = LoadSettingString (settings_path, LAYOUTBENCH_SETTING, value) && atoi (value) > 0;
+
     pScene = new HubScene (this);
 
     RandomSeed ();
@@ -360,6 +380,7 @@ void App::Cleanup(void)
     delete pScene;
     pScene = NULL;
 
+    ClearTextMeshCache ();
     SDL_GL_DeleteContext (mainGLContext);
     SDL_DestroyWindow (mainWindow);
     SDL_Quit ();
@@ -417,7 +438,13 @@ void App::MainLoop (void)
 
         SDL_GL_SwapWindow (mainWindow);
 
+        pacer.Wait ((SDL_GetWindowFlags (mainWindow) & SDL_WINDOW_INPUT_FOCUS) != 0);
+
     }   // End while
+
+#ifdef DEBUG
+    pacer.PrintHistogram (stderr);
+#endif
 }
 
 void App :: Scene :: OnEvent (const SDL_Event *event)
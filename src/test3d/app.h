@@ -31,6 +31,7 @@
 #include <string>
 
 #include "../load.h"
+#include "../pacer.h"
 
 extern const std::string zipPath;
 
@@ -81,6 +82,8 @@ public:
     bool SetFullScreen (const bool fullscreen);
     bool SetResolution (const int w, const int h);
 
+    bool GetLayoutBenchmark (void) const { return layoutBenchmark; }
+
 #ifdef _WIN32
     HICON icon; // icon to use for the main window
 #endif
@@ -88,12 +91,15 @@ public:
 private:
     char settings_path [FILENAME_MAX];
 
-    bool fullscreen;
+    bool fullscreen,
+         layoutBenchmark; // print text layout timings after loading
 
     SDL_Window *mainWindow;
     SDL_GLContext mainGLContext;
     bool done;
 
+    FramePacer pacer;
+
     // Current scene to show
     Scene *pScene;
 
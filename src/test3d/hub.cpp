@@ -21,6 +21,7 @@
 #include "hub.h"
 #include "../util.h"
 #include "../font.h"
+#include "../fontcache.h"
 #include "../xml.h"
 #include "../err.h"
 #include "../io.h"
@@ -105,26 +106,32 @@ void HubScene::AddAll (Loader *pLoader)
                 return false;
             }
 
-            // Parse the svg as xml document:
-            xmlDocPtr pDoc = ParseXML (fontInput);
+            std::string svgData;
+            bool success = ReadAll (fontInput, svgData);
             fontInput->close (fontInput);
 
-            if (!pDoc)
+            if (!success)
             {
-                SetError ("error parsing Lumean.svg: %s", GetError ());
+                SetError ("error reading Lumean.svg: %s", SDL_GetError ());
                 return false;
             }
 
-            // Convert xml to font object:
-            bool success = ParseSVGFont (pDoc, 16, &font);
-            xmlFreeDoc (pDoc);
-
-            if (!success)
+            // Convert svg to font object, or take it from the cache:
+            if (!LoadSVGFontCached (svgData, 32, GetCachePath ("test3d", "Lumean-32-field.fontcache"), &fieldFont, true))
             {
                 SetError ("error parsing Lumean.svg: %s", GetError ());
                 return false;
             }
 
+            if (!ScaleFont (&fieldFont, 16, &font))
+                return false;
+
+            if (pApp->GetLayoutBenchmark ())
+            {
+                BenchmarkUTF8 (stdout);
+                BenchmarkTextLayout (&font, stdout);
+            }
+
             return true;
         }
     );
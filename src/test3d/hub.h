@@ -47,8 +47,11 @@ private:
     // Currently rendered scene:
     Scene *pCurrent;
 
-    // Font for the help text shown:
-    Font font;
+    /*
+        Font for the help text shown. It's scaled from a distance field font,
+        so that it also stays sharp in the zoomed in 3D scenes.
+     */
+    Font fieldFont, font;
 
     // text alpha value
     GLfloat alphaH, alphaBlurInfo;
@@ -0,0 +1,293 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+
+#include <stdio.h>
+#include <algorithm>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+
+#include "textmesh.h"
+#include "shader.h"
+#include "err.h"
+
+#define TEXTMESH_CACHE_SIZE 128
+
+/*
+    Puts the glyph's edge where the distance field is 0.5 and smooths it over
+    about one screen pixel, however big the text is drawn.
+ */
+const char distance_field_vsh [] = R"shader(
+    #version 110
+
+    void main ()
+    {
+        gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+        gl_TexCoord [0] = gl_MultiTexCoord0;
+        gl_FrontColor = gl_Color;
+    }
+)shader",
+           distance_field_fsh [] = R"shader(
+    #version 110
+
+    uniform sampler2D tex;
+
+    void main ()
+    {
+        float d = texture2D (tex, gl_TexCoord [0].st).a,
+              w = fwidth (d);
+
+        gl_FragColor = vec4 (gl_Color.rgb, gl_Color.a * smoothstep (0.5 - w, 0.5 + w, d));
+    }
+)shader";
+
+static GLuint distanceFieldProgram = 0;
+static bool distanceFieldProgramFailed = false;
+
+GLuint GetDistanceFieldProgram (void)
+{
+    if (!distanceFieldProgram && !distanceFieldProgramFailed)
+    {
+        distanceFieldProgram = CreateShaderProgram (GL_VERTEX_SHADER, distance_field_vsh,
+                                                    GL_FRAGMENT_SHADER, distance_field_fsh);
+        if (!distanceFieldProgram)
+        {
+            fprintf (stderr, "warning: no distance field shader, using alpha test: %s\n", GetError ());
+            distanceFieldProgramFailed = true;
+        }
+    }
+
+    return distanceFieldProgram;
+}
+
+struct TextMeshVertex
+{
+    GLfloat x, y,
+            tx, ty;
+};
+
+TextMesh::TextMesh (void)
+ : pFont (NULL), fontID (0), align (TEXTALIGN_LEFT), maxWidth (-1.0f), distanceField (false), vbo (0), ibo (0)
+{
+}
+TextMesh::~TextMesh (void)
+{
+    if (vbo)
+        glDeleteBuffers (1, &vbo);
+    if (ibo)
+        glDeleteBuffers (1, &ibo);
+}
+bool TextMesh::Matches (const Font *_pFont, const char *pUTF8, const int _align, const float _maxWidth) const
+{
+    // A new font might have been parsed at the same address, so also compare the id:
+    return pFont == _pFont && fontID == _pFont->id &&
+           align == _align && maxWidth == _maxWidth && text == pUTF8;
+}
+void TextMesh::Set (const Font *_pFont, const char *pUTF8, const int _align, const float _maxWidth)
+{
+    if (Matches (_pFont, pUTF8, _align, _maxWidth))
+        return;
+
+    pFont = _pFont;
+    fontID = _pFont->id;
+    text = pUTF8;
+    align = _align;
+    maxWidth = _maxWidth;
+    distanceField = _pFont->distanceField;
+
+    Build ();
+}
+void TextMesh::Build (void)
+{
+    std::vector <GlyphQuad> quads;
+    ThroughTextQuads (pFont, text.c_str (), [&quads] (const GlyphQuad &quad) { quads.push_back (quad); },
+                      align, maxWidth);
+
+    // Group the quads per atlas, so that each texture needs only one draw call:
+    std::stable_sort (quads.begin (), quads.end (),
+                      [] (const GlyphQuad &q1, const GlyphQuad &q2) { return q1.tex < q2.tex; });
+
+    std::vector <TextMeshVertex> vertices;
+    std::vector <GLuint> indices;
+    vertices.reserve (4 * quads.size ());
+    indices.reserve (6 * quads.size ());
+
+    ranges.clear ();
+    for (const GlyphQuad &quad : quads)
+    {
+        if (ranges.empty () || ranges.back ().tex != quad.tex)
+            ranges.push_back ({quad.tex, GLsizei (indices.size ()), 0});
+
+        const GLuint i = vertices.size ();
+
+        // Clockwise, the front face for text:
+        vertices.push_back ({quad.x1, quad.y1, quad.tx1, quad.ty1});
+        vertices.push_back ({quad.x2, quad.y1, quad.tx2, quad.ty1});
+        vertices.push_back ({quad.x2, quad.y2, quad.tx2, quad.ty2});
+        vertices.push_back ({quad.x1, quad.y2, quad.tx1, quad.ty2});
+
+        const GLuint quadIndices [6] = {i, i + 1, i + 2, i, i + 2, i + 3};
+        indices.insert (indices.end (), quadIndices, quadIndices + 6);
+
+        ranges.back ().count += 6;
+    }
+
+    if (quads.empty ())
+        return;
+
+    if (!vbo)
+        glGenBuffers (1, &vbo);
+    if (!ibo)
+        glGenBuffers (1, &ibo);
+
+    glBindBuffer (GL_ARRAY_BUFFER, vbo);
+    glBufferData (GL_ARRAY_BUFFER, sizeof (TextMeshVertex) * vertices.size (), vertices.data (), GL_STATIC_DRAW);
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof (GLuint) * indices.size (), indices.data (), GL_STATIC_DRAW);
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+void TextMesh::Render (void) const
+{
+    if (ranges.empty ())
+        return;
+
+    glFrontFace (GL_CW);
+    glActiveTexture (GL_TEXTURE0);
+    glEnable (GL_TEXTURE_2D);
+
+    glBindBuffer (GL_ARRAY_BUFFER, vbo);
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, ibo);
+
+    glEnableClientState (GL_VERTEX_ARRAY);
+    glVertexPointer (2, GL_FLOAT, sizeof (TextMeshVertex), 0);
+
+    glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer (2, GL_FLOAT, sizeof (TextMeshVertex), (const GLvoid *)(2 * sizeof (GLfloat)));
+
+    GLint prevProgram = 0;
+    GLuint program = 0;
+    if (distanceField)
+    {
+        glGetIntegerv (GL_CURRENT_PROGRAM, &prevProgram);
+        program = GetDistanceFieldProgram ();
+
+        if (program)
+            glUseProgram (program);
+        else
+        {
+            // Hard edges, but still the right shape:
+            glPushAttrib (GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT);
+            glEnable (GL_ALPHA_TEST);
+            glAlphaFunc (GL_GEQUAL, 0.5f);
+        }
+    }
+
+    for (const TexRange &range : ranges)
+    {
+        glBindTexture (GL_TEXTURE_2D, range.tex);
+        glDrawElements (GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (const GLvoid *)(range.first * sizeof (GLuint)));
+    }
+
+    if (distanceField)
+    {
+        if (program)
+            glUseProgram (prevProgram);
+        else
+            glPopAttrib ();
+    }
+
+    glDisableClientState (GL_VERTEX_ARRAY);
+    glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+/*
+    Most recently used meshes are at the front of the list.
+    The map finds them by text, the mesh itself checks the other inputs.
+ */
+typedef std::list <TextMesh *> TextMeshList;
+static TextMeshList cacheList;
+static std::unordered_multimap <std::string, TextMeshList::iterator> cacheMap;
+
+const TextMesh *GetCachedTextMesh (const Font *pFont, const char *pUTF8, const int align, const float maxWidth)
+{
+    std::string key (pUTF8);
+
+    auto range = cacheMap.equal_range (key);
+    for (auto it = range.first; it != range.second; it++)
+    {
+        TextMeshList::iterator listIt = it->second;
+        if ((*listIt)->Matches (pFont, pUTF8, align, maxWidth))
+        {
+            // Move it to the front:
+            cacheList.splice (cacheList.begin (), cacheList, listIt);
+            return *listIt;
+        }
+    }
+
+    TextMesh *pMesh;
+    if (cacheList.size () < TEXTMESH_CACHE_SIZE)
+        pMesh = new TextMesh;
+    else
+    {
+        // Reuse the least recently used mesh and its buffers:
+        TextMeshList::iterator last = std::prev (cacheList.end ());
+        pMesh = *last;
+
+        auto range = cacheMap.equal_range (pMesh->GetText ());
+        for (auto it = range.first; it != range.second; it++)
+        {
+            if (it->second == last)
+            {
+                cacheMap.erase (it);
+                break;
+            }
+        }
+
+        cacheList.erase (last);
+    }
+
+    pMesh->Set (pFont, pUTF8, align, maxWidth);
+
+    cacheList.push_front (pMesh);
+    cacheMap.insert (std::make_pair (key, cacheList.begin ()));
+
+    return pMesh;
+}
+void ClearTextMeshCache (void)
+{
+    for (TextMesh *pMesh : cacheList)
+        delete pMesh;
+
+    cacheList.clear ();
+    cacheMap.clear ();
+
+    if (distanceFieldProgram)
+        glDeleteProgram (distanceFieldProgram);
+
+    distanceFieldProgram = 0;
+    distanceFieldProgramFailed = false;
+}
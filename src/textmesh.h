@@ -0,0 +1,100 @@
+/* Copyright (C) 2015 Coos Baakman
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+
+#ifndef TEXTMESH_H
+#define TEXTMESH_H
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <string>
+#include <vector>
+
+#include "font.h"
+
+/*
+    A string, laid out once into a vertex and index buffer of glyph quads.
+    Rendering it costs one draw call per glyph atlas, usually just one.
+ */
+class TextMesh
+{
+private:
+    const Font *pFont;
+    unsigned int fontID;
+    std::string text;
+    int align;
+    float maxWidth;
+    bool distanceField; // must be drawn with the distance field shader
+
+    GLuint vbo, ibo;
+
+    // Index ranges, that share a texture:
+    struct TexRange
+    {
+        GLuint tex;
+        GLsizei first, count;
+    };
+    std::vector <TexRange> ranges;
+
+    void Build (void);
+
+    // Owns GL buffers, don't copy:
+    TextMesh (const TextMesh &);
+    TextMesh &operator= (const TextMesh &);
+public:
+    TextMesh (void);
+    ~TextMesh (void);
+
+    /**
+     * Sets the text to render. Layout only happens, if one of the inputs is different from last time.
+     * Arguments are the same as glRenderText's.
+     */
+    void Set (const Font *pFont, const char *pUTF8, const int align = TEXTALIGN_LEFT, const float maxWidth = -1.0f);
+
+    bool Matches (const Font *pFont, const char *pUTF8, const int align, const float maxWidth) const;
+
+    const std::string &GetText (void) const { return text; }
+
+    /**
+     * Renders with origin point (0,0,0), in the current color, like glRenderText.
+     */
+    void Render (void) const;
+};
+
+/**
+ * Gives a mesh for the text from a cache of recently used ones.
+ * The least recently used mesh is reused when the cache is full.
+ */
+const TextMesh *GetCachedTextMesh (const Font *pFont, const char *pUTF8, const int align, const float maxWidth);
+
+/**
+ * Makes the distance field shader the first time it's needed.
+ * It takes the color from gl_Color and the distance from the texture's alpha.
+ * :returns: 0 if it can't be made, then use an alpha test at 0.5 instead
+ */
+GLuint GetDistanceFieldProgram (void);
+
+/**
+ * Frees the cached meshes and the distance field shader. Must be called while the GL context still exists.
+ */
+void ClearTextMeshCache (void);
+
+#endif // TEXTMESH_H